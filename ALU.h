@@ -3,67 +3,74 @@
 #include <vector>
 #include <cstdint>
 #include <iostream>
+
+// ALU operations, what the ALU control unit selects for an instruction. Add is 0,
+// the operation of a bubble (all control signals cleared).
+enum alu_operation {
+    ALU_ADD,
+    ALU_SUB,
+    ALU_AND,
+    ALU_OR,
+    ALU_NOR,
+    ALU_SLT,
+    ALU_SLL,
+    ALU_SRL,
+    ALU_LUI,
+    ALU_OPERATIONS
+};
+
+// ALU control unit: the operation for the ALU_op control signal and the funct
+// (R-type) or opcode (other I-type) bits. Evaluated at compile time into the
+// decode table of control.h.
+constexpr int alu_control_funct(int funct) {
+    return funct == 0x00 ? ALU_SLL :
+        funct == 0x02 ? ALU_SRL :
+        funct == 0x22 || funct == 0x23 ? ALU_SUB :
+        funct == 0x24 ? ALU_AND :
+        funct == 0x25 ? ALU_OR :
+        funct == 0x27 ? ALU_NOR :
+        funct == 0x2a || funct == 0x2b ? ALU_SLT :
+        ALU_ADD;                // add, addu, jr (don't care) and anything else
+}
+
+constexpr int alu_control_opcode(int opcode) {
+    return opcode == 0xa || opcode == 0xb ? ALU_SLT :
+        opcode == 0xc ? ALU_AND :
+        opcode == 0xd ? ALU_OR :
+        opcode == 0xf ? ALU_LUI :
+        ALU_ADD;                // addi, addiu and anything else
+}
+
+constexpr int alu_control(int ALU_op, int funct, int opcode) {
+    return !ALU_op ? ALU_ADD :                  // loads, stores
+        ALU_op == 1 ? ALU_SUB :                 // beq, bne
+        ALU_op == 2 ? alu_control_funct(funct) :    // R-Type
+        alu_control_opcode(opcode);             // Other I-type
+}
+
 class ALU {
     private:
-        int ALU_control_inputs;
+        typedef uint32_t (*kernel)(uint32_t, uint32_t);
+
+        static uint32_t op_add(uint32_t a, uint32_t b) { return a + b; }
+        static uint32_t op_sub(uint32_t a, uint32_t b) { return a - b; }
+        static uint32_t op_and(uint32_t a, uint32_t b) { return a & b; }
+        static uint32_t op_or(uint32_t a, uint32_t b) { return a | b; }
+        static uint32_t op_nor(uint32_t a, uint32_t b) { return ~(a | b); }
+        static uint32_t op_slt(uint32_t a, uint32_t b) { return (int)a < (int)b; }
+        static uint32_t op_sll(uint32_t a, uint32_t b) { return b << a; }
+        static uint32_t op_srl(uint32_t a, uint32_t b) { return b >> a; }
+        static uint32_t op_lui(uint32_t, uint32_t b) { return b << 16; }
     public:
-        // Generate the control inputs for the ALU
-        void generate_control_inputs(int ALU_op, int funct, int opcode) {
-            if(!ALU_op) { // loads, stores
-                ALU_control_inputs = 2; // set to add
-            } 
-            else if(ALU_op == 1) { // beq, bne
-                ALU_control_inputs = 6; // set to subtract
-            } 
-            else if(ALU_op == 2) { // R-Type
-                switch(funct) {
-                    case 0x00: ALU_control_inputs = 3; break;               // sll
-                    case 0x02: ALU_control_inputs = 4; break;               // srl
-                    case 0x08: ALU_control_inputs = 2; break;               // don't care
-                    case 0x20: case 0x21: ALU_control_inputs = 2; break;    // add
-                    case 0x22: case 0x23: ALU_control_inputs = 6; break;    // sub
-                    case 0x24: ALU_control_inputs = 0; break;               // and
-                    case 0x25: ALU_control_inputs = 1; break;               // or
-                    case 0x27: ALU_control_inputs = 12; break;              // nor
-                    case 0x2a: case 0x2b: ALU_control_inputs = 7; break;    // slt
-                    default: ALU_control_inputs = 2;
-                }
-            }
-            else { // Other I-type
-                switch(opcode) {
-                    case 0x8: case 0x9: ALU_control_inputs = 2; break;      // add
-                    case 0xa: case 0xb: ALU_control_inputs = 7; break;      // slt
-                    case 0xc: ALU_control_inputs = 0; break;                // and
-                    case 0xd: ALU_control_inputs = 1; break;                // or
-                    case 0xf: ALU_control_inputs = 5; break;                // lui
-                    default: ALU_control_inputs = 2;
-                }
-            }
-        }
-        
-        // execute ALU operations, generate result, and set the zero control signal if necessary
-        uint32_t execute(uint32_t operand_1, uint32_t operand_2, uint32_t &ALU_zero) {
-            uint32_t result = 0;
-            switch(ALU_control_inputs) {
-                case 0: result = operand_1 & operand_2; break;
-                case 1: result = operand_1 | operand_2; break;
-                case 2: result = operand_1 + operand_2; break;
-                case 3: result = operand_2 << operand_1; break;
-                case 4: result = operand_2 >> operand_1; break;
-                case 5: result = operand_2 << 16; break;
-                case 6: result = operand_1 - operand_2; break;
-                case 7: result = ((int)operand_1 < (int)operand_2) ? 1 : 0; break;
-                case 12: result = ~(operand_1 | operand_2); break;
-                default: result = operand_1 + operand_2; break;
-            }
-            if(!result) {
-                ALU_zero = 1;
-            }
-            else {
-                ALU_zero = 0;
-            }
+        // execute an alu_operation, generate result, and set the zero control signal
+        uint32_t execute(int operation, uint32_t operand_1, uint32_t operand_2, uint32_t &ALU_zero) {
+            static const kernel kernels[ALU_OPERATIONS] = {
+                op_add, op_sub, op_and, op_or, op_nor, op_slt, op_sll, op_srl, op_lui
+            };
+            uint32_t result = kernels[operation](operand_1, operand_2);
+            ALU_zero = !result;
             return result;
         }
-            
+
 };
 #endif
@@ -0,0 +1,263 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <thread>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include "processor.h"
+#include "batch.h"
+
+using namespace std;
+
+extern bool load(const char *bmk, Memory &memory, uint32_t &entry, uint32_t &text_base, uint32_t &end_pc);
+
+WorkQueues::WorkQueues(int workers, size_t num_jobs) : queues(workers) {
+    for (size_t i = 0; i < num_jobs; i++)
+        queues[i % workers].jobs.push_back(i);
+}
+
+// Next job for this worker, false when there is nothing left anywhere
+bool WorkQueues::next(int worker, size_t &job) {
+    {
+        lock_guard<mutex> own(queues[worker].lock);
+        if (!queues[worker].jobs.empty()) {
+            job = queues[worker].jobs.back();
+            queues[worker].jobs.pop_back();
+            return true;
+        }
+    }
+    for (size_t i = 1; i < queues.size(); i++) {
+        queue &victim = queues[(worker + i) % queues.size()];
+        lock_guard<mutex> other(victim.lock);
+        if (!victim.jobs.empty()) {
+            job = victim.jobs.front();
+            victim.jobs.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+// A caches= value: a relative path to a configuration file is taken from the manifest's directory
+static string config_path(const string &config, const string &dir) {
+    if (Memory::isCacheConfigName(config) || config.find('=') != string::npos || config[0] == '/')
+        return config;
+    return dir + config;
+}
+
+static bool valid_prefetcher(const string &kind) {
+    Prefetcher *pf;
+    if (!make_prefetcher(kind, pf))
+        return false;
+    delete pf;
+    return true;
+}
+
+// Parse the manifest, false (with a message) on the first bad line
+static bool parse_manifest(const char *manifest, vector<batch_job> &jobs) {
+    ifstream in(manifest);
+    if (!in) {
+        cout << "Failed to open batch manifest: " << manifest << "\n";
+        return false;
+    }
+    string dir(manifest);
+    size_t slash = dir.rfind('/');
+    dir = slash == string::npos ? "" : dir.substr(0, slash + 1);
+
+    string line;
+    for (int num = 1; getline(in, line); num++) {
+        size_t hash = line.find('#');
+        if (hash != string::npos)
+            line.erase(hash);
+        istringstream words(line);
+        batch_job job;
+        string level;
+        if (!(words >> job.bmk))
+            continue;
+        if (!(words >> level)) {
+            cout << manifest << ":" << num << ": missing optimization level\n";
+            return false;
+        }
+        if (job.bmk[0] != '/')
+            job.bmk = dir + job.bmk;
+        size_t digit = level.find_first_not_of("-O");
+        if (digit == string::npos || level.size() != digit + 1 || level[digit] < '0' || level[digit] > '4') {
+            cout << manifest << ":" << num << ": bad optimization level " << level << "\n";
+            return false;
+        }
+        job.level = level[digit] - '0';
+        job.fast = job.jit = job.sample = false;
+        job.sample_cfg.interval = 100000;
+        job.sample_cfg.warmup = 100000;
+        job.sample_cfg.max_k = 10;
+        job.max_cycles = 0;
+        job.caches = "default";
+        job.mshrs = DEFAULT_MSHRS;
+        job.prefetch[0] = job.prefetch[1] = "none";
+        job.bpred = "not-taken";
+        job.width = 1;
+        job.rob = DEFAULT_ROB_SIZE;
+        job.iq = DEFAULT_IQ_SIZE;
+
+        string opt;
+        while (words >> opt) {
+            size_t eq = opt.find('=');
+            string key = opt.substr(0, eq);
+            uint64_t value = eq == string::npos ? 0 : strtoull(opt.c_str() + eq + 1, 0, 0);
+            if (key == "fast") job.fast = true;
+            else if (key == "jit") job.fast = job.jit = true;
+            else if (key == "sample") job.sample = true;
+            else if (key == "interval" && value) job.sample_cfg.interval = value;
+            else if (key == "warmup" && eq != string::npos) job.sample_cfg.warmup = value;
+            else if (key == "max-k" && value) job.sample_cfg.max_k = value;
+            else if (key == "max-cycles" && value) job.max_cycles = value;
+            else if (key == "caches" && eq != string::npos && Memory::checkCacheConfig(config_path(opt.substr(eq + 1), dir)))
+                job.caches = config_path(opt.substr(eq + 1), dir);
+            else if (key == "mshrs" && value && value <= MAX_MSHRS) job.mshrs = value;
+            else if ((key == "prefetch" || key == "l2-prefetch") && eq != string::npos && valid_prefetcher(opt.substr(eq + 1)))
+                job.prefetch[key != "prefetch"] = opt.substr(eq + 1);
+            else if (key == "bpred" && eq != string::npos && BranchUnit().setPredictor(opt.substr(eq + 1)))
+                job.bpred = opt.substr(eq + 1);
+            else if (key == "width" && (value == 1 || value == 2 || value == 4)) job.width = value;
+            else if (key == "rob" && value && value <= MAX_ROB_SIZE) job.rob = value;
+            else if (key == "iq" && value && value <= MAX_ROB_SIZE) job.iq = value;
+            else {
+                cout << manifest << ":" << num << ": bad option " << opt << "\n";
+                return false;
+            }
+        }
+        if (job.fast && job.level > 0 && !job.sample) {
+            cout << manifest << ":" << num << ": fast and jit only apply to level 0 and sample, running the -O"
+                 << job.level << " simulation\n";
+        }
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+// One simulation, the same steps main() takes for a single --bmk
+static void run_job(const batch_job &job, batch_result &result) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    Memory memory;
+    Processor processor(&memory);
+    int level = job.level;
+    uint64_t num_cycles = 0;
+
+    result.status = "ok";
+    result.instructions = 0;
+    result.cycles = 0;
+    result.ns = 0;
+    result.regs_hash = 0;
+
+    memory.setCacheConfig(job.caches);
+    memory.setMSHRs(job.mshrs);
+    memory.setPrefetcher(1, job.prefetch[0]);
+    memory.setPrefetcher(2, job.prefetch[1]);
+    processor.set_branch_predictor(job.bpred);
+    processor.set_width(job.width);
+    processor.set_window(job.rob, job.iq);
+    uint32_t entry, text_base, end_pc;
+    if (!load(job.bmk.c_str(), memory, entry, text_base, end_pc)) {
+        result.status = "load failed";
+    } else {
+        processor.set_entry(entry);
+        processor.initialize(level);
+        if (job.jit && (level == 0 || job.sample))
+            processor.enable_jit();
+        if (job.sample) {
+            ostringstream report;
+            if (level == 0)
+                level = 1;
+            Sampler sampler(&processor, &memory, text_base, end_pc, job.sample_cfg, report);
+            if (!sampler.run(level, num_cycles))
+                result.status = "sampling failed";
+            result.instructions = sampler.instructions();
+        } else {
+            memory.setOptLevel(level);
+            if (job.fast && level == 0) {
+                processor.load_program(text_base, end_pc);
+                num_cycles = processor.fast_forward(UINT64_MAX);
+                result.instructions = num_cycles;
+            }
+            while (processor.getPC() <= end_pc) {
+                if (job.max_cycles && num_cycles >= job.max_cycles) {
+                    result.status = "cycle limit";
+                    break;
+                }
+                processor.advance();
+                num_cycles++;
+                num_cycles += processor.skip_idle_cycles();
+            }
+            result.instructions += processor.get_retired();
+        }
+    }
+
+    uint32_t hash = 2166136261u;
+    PhysReg *regs = processor.get_regs();
+    for (int i = 0; i < 32; i++) {
+        for (int b = 0; b < 4; b++)
+            hash = (hash ^ ((uint32_t)regs[i].value >> (8*b) & 0xff)) * 16777619u;
+    }
+    result.regs_hash = hash;
+    result.cycles = num_cycles;
+    result.ns = (double)num_cycles*(level ? 1 : 125)*0.5;
+    result.host_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static const char *mode_name(const batch_job &job) {
+    return job.sample ? "sample" : job.jit && job.level == 0 ? "jit" : job.fast && job.level == 0 ? "fast" : "cycle";
+}
+
+bool run_batch(const char *manifest, int threads) {
+    vector<batch_job> jobs;
+    if (!parse_manifest(manifest, jobs))
+        return false;
+    if (threads < 1)
+        threads = 1;
+    if ((size_t)threads > jobs.size())
+        threads = jobs.size() ? jobs.size() : 1;
+
+    vector<batch_result> results(jobs.size());
+    WorkQueues work(threads, jobs.size());
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    vector<thread> workers;
+    for (int w = 0; w < threads; w++) {
+        workers.push_back(thread([&, w]() {
+            size_t job;
+            while (work.next(w, job))
+                run_job(jobs[job], results[job]);
+        }));
+    }
+    for (size_t w = 0; w < workers.size(); w++)
+        workers[w].join();
+    double wall = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    // one row per job in manifest order
+    bool ok = true;
+    double busy = 0;
+    cout << left << setw(5) << "job" << setw(32) << "benchmark" << setw(6) << "level" << setw(8) << "mode"
+         << right << setw(14) << "instructions" << setw(14) << "cycles" << setw(8) << "CPI"
+         << setw(16) << "time (ns)" << setw(10) << "host (s)" << setw(10) << "regs" << "  status\n";
+    for (size_t i = 0; i < jobs.size(); i++) {
+        const batch_result &r = results[i];
+        string name = jobs[i].bmk;
+        if (name.size() > 31)
+            name = "..." + name.substr(name.size() - 28);
+        cout << left << setw(5) << i << setw(32) << name << setw(6) << ("-O" + to_string(jobs[i].level))
+             << setw(8) << mode_name(jobs[i]) << right << setw(14) << r.instructions << setw(14) << r.cycles
+             << setw(8) << fixed << setprecision(3) << (r.instructions ? (double)r.cycles / r.instructions : 0.0)
+             << setw(16) << setprecision(1) << r.ns << setw(10) << setprecision(3) << r.host_seconds
+             << "  " << hex << setw(8) << setfill('0') << r.regs_hash << dec << setfill(' ')
+             << "  " << r.status << "\n";
+        busy += r.host_seconds;
+        ok = ok && r.status == "ok";
+    }
+    cout.unsetf(ios::fixed);
+    cout << setprecision(3) << fixed << "\n" << jobs.size() << " jobs on " << threads << " threads in "
+         << wall << " s (" << busy << " s of simulation, " << setprecision(2)
+         << (wall > 0 ? busy / wall : 0.0) << "x parallel)\n";
+    cout.unsetf(ios::fixed);
+    return ok;
+}
@@ -0,0 +1,63 @@
+#ifndef BATCH_CLASS
+#define BATCH_CLASS
+#include <vector>
+#include <deque>
+#include <string>
+#include <mutex>
+#include <cstdint>
+#include "sampler.h"
+
+// One line of a batch manifest:
+//   <elf> <level> [fast] [jit] [sample] [interval=N] [warmup=N] [max-k=N] [max-cycles=N]
+//         [caches=<config>] [mshrs=N] [prefetch=<kind>] [l2-prefetch=<kind>] [bpred=<kind>]
+//         [width=N] [rob=N] [iq=N]
+// The level is 0-4 (optionally written O1 or -O1). Relative paths, of the elf
+// and of a caches= file, are taken from the manifest's directory, '#' starts a comment.
+struct batch_job {
+    std::string bmk;
+    int level;
+    bool fast;
+    bool jit;
+    bool sample;
+    sampler_config sample_cfg;
+    uint64_t max_cycles;            // 0 for no limit
+    std::string caches;             // Memory::setCacheConfig() name or file
+    int mshrs;                      // per cache level, -O2 and up
+    std::string prefetch[2];        // make_prefetcher() kinds of L1 and L2
+    std::string bpred;              // make_branch_predictor() kind
+    int width;                      // Processor::set_width()
+    int rob, iq;                    // Processor::set_window()
+};
+
+struct batch_result {
+    std::string status;             // "ok", or why the job failed
+    uint64_t instructions;
+    uint64_t cycles;                // estimated when sampling
+    double ns;
+    double host_seconds;
+    uint32_t regs_hash;             // FNV-1a of the final register file, for regression checks
+};
+
+// Job queues of a work-stealing pool. Every worker starts with its own share
+// and pops from the back of its queue; once it runs dry it steals from the
+// front of the others'. Jobs never spawn jobs, so an empty sweep means done.
+class WorkQueues {
+    private:
+        struct queue {
+            std::mutex lock;
+            std::deque<size_t> jobs;
+        };
+        std::vector<queue> queues;
+    public:
+        WorkQueues(int workers, size_t num_jobs);
+
+        // Next job for this worker, false when there is nothing left anywhere
+        bool next(int worker, size_t &job);
+};
+
+// Runs every job of the manifest on threads workers, each job on its own
+// Memory/Processor pair, and prints one table with the results.
+// Returns false if the manifest can't be read or a job failed.
+bool run_batch(const char *manifest, int threads);
+
+#endif
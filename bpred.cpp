@@ -0,0 +1,329 @@
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <iostream>
+#include <cstring>
+#include "bpred.h"
+
+using namespace std;
+
+const char *branch_predictor_kinds = "not-taken, static, bimodal, gshare, tage";
+
+// history lengths of the tagged TAGE components, geometric from 5 to 44 outcomes
+static const int tage_history[TAGE_TABLES] = { 5, 11, 22, 44 };
+
+bool make_branch_predictor(const string &kind, BranchPredictor *&bp) {
+    bp = 0;
+    if (kind == "not-taken")
+        return true;
+    if (kind == "static")
+        bp = new StaticPredictor();
+    else if (kind == "bimodal")
+        bp = new BimodalPredictor();
+    else if (kind == "gshare")
+        bp = new GsharePredictor();
+    else if (kind == "tage")
+        bp = new TagePredictor();
+    return bp != 0;
+}
+
+// 2-bit (or wider) saturating counter
+static void train(uint8_t &ctr, bool taken, uint8_t max) {
+    if (taken && ctr < max)
+        ctr++;
+    else if (!taken && ctr > 0)
+        ctr--;
+}
+
+static void save_counters(CheckpointWriter &ckpt, const vector<uint8_t> &v) {
+    ckpt.put(v.data(), v.size());
+}
+
+static bool restore_counters(CheckpointReader &ckpt, vector<uint8_t> &v) {
+    return ckpt.get(v.data(), v.size());
+}
+
+bool BimodalPredictor::predict(uint32_t pc, uint32_t target, uint64_t history) {
+    return counters[(pc >> 2) % BIMODAL_ENTRIES] >= 2;
+}
+
+void BimodalPredictor::update(uint32_t pc, uint32_t target, uint64_t history, bool taken) {
+    train(counters[(pc >> 2) % BIMODAL_ENTRIES], taken, 3);
+}
+
+void BimodalPredictor::save(CheckpointWriter &ckpt) { save_counters(ckpt, counters); }
+bool BimodalPredictor::restore(CheckpointReader &ckpt) { return restore_counters(ckpt, counters); }
+
+bool GsharePredictor::predict(uint32_t pc, uint32_t target, uint64_t history) {
+    return counters[index(pc, history)] >= 2;
+}
+
+void GsharePredictor::update(uint32_t pc, uint32_t target, uint64_t history, bool taken) {
+    train(counters[index(pc, history)], taken, 3);
+}
+
+void GsharePredictor::save(CheckpointWriter &ckpt) { save_counters(ckpt, counters); }
+bool GsharePredictor::restore(CheckpointReader &ckpt) { return restore_counters(ckpt, counters); }
+
+TagePredictor::TagePredictor() : base(BIMODAL_ENTRIES, 1), updates(0) {
+    entry e = { 0, 4, 0 };
+    for (int t = 0; t < TAGE_TABLES; t++)
+        tables[t].assign(TAGE_ENTRIES, e);
+}
+
+// the first n outcomes folded into bits wide
+static uint32_t fold(uint64_t history, int n, int bits) {
+    if (n < 64)
+        history &= (1ull << n) - 1;
+    uint32_t f = 0;
+    for (; history; history >>= bits)
+        f ^= history & ((1u << bits) - 1);
+    return f;
+}
+
+uint32_t TagePredictor::index(int t, uint32_t pc, uint64_t history) {
+    return ((pc >> 2) ^ (pc >> 12) ^ fold(history, tage_history[t], 10)) % TAGE_ENTRIES;
+}
+
+uint16_t TagePredictor::tag(int t, uint32_t pc, uint64_t history) {
+    return ((pc >> 2) ^ fold(history, tage_history[t], TAGE_TAG_BITS) ^ (fold(history, tage_history[t], TAGE_TAG_BITS-1) << 1))
+        & ((1u << TAGE_TAG_BITS) - 1);
+}
+
+void TagePredictor::lookup(uint32_t pc, uint64_t history, int &provider, int &alt, uint32_t idx[TAGE_TABLES]) {
+    provider = alt = -1;
+    for (int t = TAGE_TABLES-1; t >= 0; t--) {
+        idx[t] = index(t, pc, history);
+        if (tables[t][idx[t]].tag != tag(t, pc, history))
+            continue;
+        if (provider < 0)
+            provider = t;
+        else if (alt < 0)
+            alt = t;
+    }
+}
+
+// Prediction of component t, -1 for the base
+bool TagePredictor::component(int t, uint32_t pc, const uint32_t idx[TAGE_TABLES]) {
+    return t < 0 ? base[(pc >> 2) % BIMODAL_ENTRIES] >= 2 : tables[t][idx[t]].ctr >= 4;
+}
+
+bool TagePredictor::predict(uint32_t pc, uint32_t target, uint64_t history) {
+    int provider, alt;
+    uint32_t idx[TAGE_TABLES];
+    lookup(pc, history, provider, alt, idx);
+    return component(provider, pc, idx);
+}
+
+void TagePredictor::update(uint32_t pc, uint32_t target, uint64_t history, bool taken) {
+    int provider, alt;
+    uint32_t idx[TAGE_TABLES];
+    lookup(pc, history, provider, alt, idx);
+    bool pred = component(provider, pc, idx);
+
+    if (provider < 0) {
+        train(base[(pc >> 2) % BIMODAL_ENTRIES], taken, 3);
+    } else {
+        entry &e = tables[provider][idx[provider]];
+        // the provider earns its keep where it disagrees with what it overrides
+        if (pred != component(alt, pc, idx))
+            train(e.useful, pred == taken, 3);
+        train(e.ctr, taken, 7);
+    }
+
+    // a misprediction claims an entry in a longer component, one whose entry is not useful
+    if (pred != taken && provider < TAGE_TABLES-1) {
+        bool allocated = false;
+        for (int t = provider+1; t < TAGE_TABLES && !allocated; t++) {
+            entry &e = tables[t][idx[t]];
+            if (e.useful == 0) {
+                e.tag = tag(t, pc, history);
+                e.ctr = taken ? 4 : 3;
+                allocated = true;
+            }
+        }
+        if (!allocated) {
+            for (int t = provider+1; t < TAGE_TABLES; t++)
+                train(tables[t][idx[t]].useful, false, 3);
+        }
+    }
+
+    // entries that were useful once do not stay so forever
+    if (++updates % TAGE_RESET_PERIOD == 0) {
+        for (int t = 0; t < TAGE_TABLES; t++) {
+            for (size_t i = 0; i < tables[t].size(); i++)
+                tables[t][i].useful >>= 1;
+        }
+    }
+}
+
+void TagePredictor::save(CheckpointWriter &ckpt) {
+    save_counters(ckpt, base);
+    for (int t = 0; t < TAGE_TABLES; t++)
+        ckpt.put(tables[t].data(), tables[t].size()*sizeof(entry));
+    ckpt.put(&updates, sizeof(updates));
+}
+
+bool TagePredictor::restore(CheckpointReader &ckpt) {
+    if (!restore_counters(ckpt, base))
+        return false;
+    for (int t = 0; t < TAGE_TABLES; t++) {
+        if (!ckpt.get(tables[t].data(), tables[t].size()*sizeof(entry)))
+            return false;
+    }
+    return ckpt.get(&updates, sizeof(updates));
+}
+
+BranchUnit &BranchUnit::operator=(const BranchUnit &other) {
+    if (this != &other) {
+        delete predictor;
+        predictor = other.predictor ? other.predictor->clone() : 0;
+        btb = other.btb;
+        itc = other.itc;
+        ras = other.ras;
+        cycleRAS = other.cycleRAS;
+        history = other.history;
+        branches = other.branches;
+        mispredicted = other.mispredicted;
+        takenBranches = other.takenBranches;
+        btbMisses = other.btbMisses;
+        for (int k = 0; k <= BR_INDIRECT; k++) {
+            jumps[k] = other.jumps[k];
+            jumpsMispredicted[k] = other.jumpsMispredicted[k];
+        }
+    }
+    return *this;
+}
+
+bool BranchUnit::setPredictor(const string &kind) {
+    BranchPredictor *bp;
+    if (!make_branch_predictor(kind, bp))
+        return false;
+    delete predictor;
+    predictor = bp;
+    return true;
+}
+
+uint32_t BranchUnit::predict(uint32_t pc, branch_record &r) {
+    r.predicted_pc = pc + 4;
+    r.history = history;
+    r.target = 0;
+    r.taken = false;
+    r.kind = BR_NONE;
+    r.ras_top = ras.top;
+    r.ras_value = ras.entries[ras.top];
+    btb_entry &e = btb[(pc >> 2) % BTB_ENTRIES];
+    if (!e.valid || e.pc != pc)
+        return r.predicted_pc;
+    switch (e.kind) {
+        case BR_COND:
+            if (predictor && predictor->predict(pc, e.target, history))
+                r.predicted_pc = e.target;
+            break;
+        case BR_CALL:
+            push(pc + 8);
+            r.predicted_pc = e.target;
+            break;
+        case BR_JUMP:
+            r.predicted_pc = e.target;
+            break;
+        case BR_RETURN:
+            r.predicted_pc = pop();
+            break;
+        case BR_INDIRECT: {
+            btb_entry &i = itcEntry(pc, history);
+            r.predicted_pc = i.valid && i.pc == pc ? i.target : e.target;
+            break;
+        }
+    }
+    return r.predicted_pc;
+}
+
+void BranchUnit::recover(uint32_t pc, const branch_record &r) {
+    ras.top = r.ras_top;
+    ras.entries[ras.top] = r.ras_value;
+    if (r.kind == BR_CALL)
+        push(pc + 8);
+    else if (r.kind == BR_RETURN)
+        pop();
+}
+
+void BranchUnit::resolve(uint32_t pc, const branch_record &r) {
+    uint32_t next = r.taken ? r.target : pc + 4;
+    if (r.kind == BR_COND) {
+        branches++;
+        mispredicted += next != r.predicted_pc;
+    } else {
+        jumps[r.kind]++;
+        jumpsMispredicted[r.kind] += next != r.predicted_pc;
+    }
+
+    btb_entry &e = btb[(pc >> 2) % BTB_ENTRIES];
+    bool known = e.valid && e.pc == pc;
+    if (r.kind == BR_COND && predictor)
+        predictor->update(pc, known ? e.target : r.target, r.history, r.taken);
+    if (r.kind == BR_INDIRECT) {
+        btb_entry &i = itcEntry(pc, r.history);
+        i.valid = true;
+        i.pc = pc;
+        i.target = r.target;
+    }
+    if (r.taken) {
+        takenBranches += r.kind == BR_COND;
+        btbMisses += r.kind == BR_COND && !known;
+        e.valid = true;
+        e.pc = pc;
+        e.target = r.target;
+        e.kind = r.kind;
+    }
+    if (r.kind == BR_COND)
+        history = (history << 1) | r.taken;
+}
+
+// The predictor's tables only make sense to the same kind of predictor, its name goes first
+void BranchUnit::save(CheckpointWriter &ckpt) {
+    char kind[16] = {};
+    strncpy(kind, name(), sizeof(kind)-1);
+    ckpt.put(kind, sizeof(kind));
+    ckpt.put(btb.data(), btb.size()*sizeof(btb_entry));
+    ckpt.put(itc.data(), itc.size()*sizeof(btb_entry));
+    ckpt.put(&ras, sizeof(ras));
+    ckpt.put(&history, sizeof(history));
+    if (predictor)
+        predictor->save(ckpt);
+}
+
+bool BranchUnit::restore(CheckpointReader &ckpt) {
+    char kind[16];
+    if (!ckpt.get(kind, sizeof(kind)))
+        return false;
+    kind[sizeof(kind)-1] = 0;
+    if (strcmp(kind, name())) {
+        cout << "The checkpoint was taken with the " << kind << " branch predictor\n";
+        return false;
+    }
+    return ckpt.get(btb.data(), btb.size()*sizeof(btb_entry)) &&
+           ckpt.get(itc.data(), itc.size()*sizeof(btb_entry)) &&
+           ckpt.get(&ras, sizeof(ras)) &&
+           ckpt.get(&history, sizeof(history)) &&
+           (!predictor || predictor->restore(ckpt));
+}
+
+void BranchUnit::registerStats(StatsRegistry &stats) {
+    stats.add("branches", &branches);
+    stats.add("branch_mispredicts", &mispredicted);
+    stats.add("btb_misses", &btbMisses);
+}
+
+void BranchUnit::printStats(ostream &out) {
+    out << "Branch prediction (" << name() << "): " << branches << " branches, " << mispredicted
+        << " mispredicted, accuracy " << (branches ? 1.0 - (double)mispredicted / branches : 0.0);
+    if (predictor)
+        out << ", BTB missed " << btbMisses << " of " << takenBranches << " taken";
+    out << "\n";
+    static const char *kinds[] = { "", "", "j", "jal", "jr $ra", "other jr" };
+    out << "Jumps:";
+    for (int k = BR_JUMP; k <= BR_INDIRECT; k++)
+        out << (k > BR_JUMP ? "," : "") << " " << kinds[k] << " " << jumps[k] << " (" << jumpsMispredicted[k] << " mispredicted)";
+    out << "\n";
+}
@@ -0,0 +1,223 @@
+#ifndef BPRED_CLASS
+#define BPRED_CLASS
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <iostream>
+#include "checkpoint.h"
+#include "stats.h"
+
+#define BTB_ENTRIES 512             // direct mapped, indexed by the word address of the branch
+#define RAS_ENTRIES 16              // return address stack, circular
+#define ITC_ENTRIES 256             // indirect target cache, indexed by pc and global history
+#define BIMODAL_ENTRIES 4096        // 2-bit counters
+#define GSHARE_HISTORY 12           // global history bits, gshare has 1 << GSHARE_HISTORY counters
+#define TAGE_TABLES 4               // tagged components on top of the bimodal base
+#define TAGE_ENTRIES 1024           // per tagged component
+#define TAGE_TAG_BITS 9
+#define TAGE_RESET_PERIOD (1 << 18) // updates between two halvings of the useful counters
+
+// Kinds of control transfer the BTB tells apart
+enum branch_kind { BR_NONE, BR_COND, BR_JUMP, BR_CALL, BR_RETURN, BR_INDIRECT };
+
+// What fetch guessed for one instruction, carried down the pipeline so decode
+// (jumps) or execute (branches) can check it and writeback can train the
+// predictor on the outcome
+struct branch_record {
+    uint32_t predicted_pc;          // where fetch went after this instruction
+    uint64_t history;               // global history the prediction was made with
+    uint32_t target;                // decode/execute: where a taken branch or jump goes
+    bool taken;                     // decode/execute: the outcome
+    uint8_t kind;                   // decode: branch_kind of the instruction
+    uint8_t ras_top;                // RAS top and its entry before fetch used the RAS,
+    uint32_t ras_value;             // to repair it when fetch went the wrong way
+
+    bool operator==(const branch_record &o) const {
+        return predicted_pc == o.predicted_pc && history == o.history && target == o.target &&
+            taken == o.taken && kind == o.kind && ras_top == o.ras_top && ras_value == o.ras_value;
+    }
+};
+
+// A direction predictor. The global history (most recent outcome in bit 0)
+// is kept by BranchUnit and passed in, update() gets the same history the
+// prediction was made with.
+class BranchPredictor {
+    public:
+        virtual ~BranchPredictor() {}
+
+        virtual BranchPredictor *clone() const = 0;
+
+        virtual const char *name() const = 0;
+
+        // target is the BTB's, for predictors that look at the direction of the branch
+        virtual bool predict(uint32_t pc, uint32_t target, uint64_t history) = 0;
+
+        virtual void update(uint32_t pc, uint32_t target, uint64_t history, bool taken) = 0;
+
+        virtual void save(CheckpointWriter &ckpt) = 0;
+        virtual bool restore(CheckpointReader &ckpt) = 0;
+};
+
+// Backward taken, forward not taken
+class StaticPredictor : public BranchPredictor {
+    public:
+        BranchPredictor *clone() const override { return new StaticPredictor(*this); }
+        const char *name() const override { return "static"; }
+        bool predict(uint32_t pc, uint32_t target, uint64_t history) override { return target < pc; }
+        void update(uint32_t pc, uint32_t target, uint64_t history, bool taken) override {}
+        void save(CheckpointWriter &ckpt) override {}
+        bool restore(CheckpointReader &ckpt) override { return true; }
+};
+
+// 2-bit saturating counters indexed by the pc
+class BimodalPredictor : public BranchPredictor {
+    private:
+        std::vector<uint8_t> counters;
+    public:
+        BimodalPredictor() : counters(BIMODAL_ENTRIES, 1) {}
+        BranchPredictor *clone() const override { return new BimodalPredictor(*this); }
+        const char *name() const override { return "bimodal"; }
+        bool predict(uint32_t pc, uint32_t target, uint64_t history) override;
+        void update(uint32_t pc, uint32_t target, uint64_t history, bool taken) override;
+        void save(CheckpointWriter &ckpt) override;
+        bool restore(CheckpointReader &ckpt) override;
+};
+
+// 2-bit counters indexed by the pc xor the last GSHARE_HISTORY outcomes
+class GsharePredictor : public BranchPredictor {
+    private:
+        std::vector<uint8_t> counters;
+        static uint32_t index(uint32_t pc, uint64_t history) {
+            return ((pc >> 2) ^ history) & ((1u << GSHARE_HISTORY) - 1);
+        }
+    public:
+        GsharePredictor() : counters(1u << GSHARE_HISTORY, 1) {}
+        BranchPredictor *clone() const override { return new GsharePredictor(*this); }
+        const char *name() const override { return "gshare"; }
+        bool predict(uint32_t pc, uint32_t target, uint64_t history) override;
+        void update(uint32_t pc, uint32_t target, uint64_t history, bool taken) override;
+        void save(CheckpointWriter &ckpt) override;
+        bool restore(CheckpointReader &ckpt) override;
+};
+
+// TAGE with a bimodal base and TAGE_TABLES tagged components that use
+// geometrically longer slices of the global history (up to 64 outcomes). The
+// longest component with a matching tag provides the prediction, a
+// misprediction allocates an entry in a longer one.
+class TagePredictor : public BranchPredictor {
+    private:
+        struct entry {
+            uint16_t tag;
+            uint8_t ctr;            // 3-bit, taken from 4 up
+            uint8_t useful;         // 2-bit
+        };
+        std::vector<uint8_t> base;
+        std::vector<entry> tables[TAGE_TABLES];
+        uint32_t updates;
+
+        uint32_t index(int t, uint32_t pc, uint64_t history);
+        uint16_t tag(int t, uint32_t pc, uint64_t history);
+        // Component providing the prediction (-1: the base) and the one it overrides
+        void lookup(uint32_t pc, uint64_t history, int &provider, int &alt, uint32_t idx[TAGE_TABLES]);
+        bool component(int t, uint32_t pc, const uint32_t idx[TAGE_TABLES]);
+    public:
+        TagePredictor();
+        BranchPredictor *clone() const override { return new TagePredictor(*this); }
+        const char *name() const override { return "tage"; }
+        bool predict(uint32_t pc, uint32_t target, uint64_t history) override;
+        void update(uint32_t pc, uint32_t target, uint64_t history, bool taken) override;
+        void save(CheckpointWriter &ckpt) override;
+        bool restore(CheckpointReader &ckpt) override;
+};
+
+// Direction predictor, branch target buffer, return address stack, indirect
+// target cache and global history of the pipelined core. Fetch asks for the
+// next pc of every instruction; only instructions in the BTB (taken before)
+// can redirect it. A branch goes to its target if the direction predictor
+// says taken (never without a predictor), j and jal always do, jal pushes
+// its return address and jr $ra pops it, other jr use the indirect target
+// cache. The RAS is updated speculatively at fetch and repaired from the
+// branch_record of the instruction fetch mispredicted.
+class BranchUnit {
+    private:
+        struct btb_entry {
+            uint32_t pc;
+            uint32_t target;
+            uint8_t kind;
+            bool valid;
+        };
+        struct ras_state {
+            uint32_t entries[RAS_ENTRIES];
+            uint8_t top;
+        };
+        BranchPredictor *predictor;     // 0 for always not taken
+        std::vector<btb_entry> btb;
+        std::vector<btb_entry> itc;
+        ras_state ras;
+        ras_state cycleRAS;             // at the start of the cycle, see undoCycle()
+        uint64_t history;
+
+        uint64_t branches;
+        uint64_t mispredicted;
+        uint64_t takenBranches;
+        uint64_t btbMisses;             // taken branches the BTB had no target for
+        uint64_t jumps[BR_INDIRECT+1];  // by kind, BR_JUMP and up
+        uint64_t jumpsMispredicted[BR_INDIRECT+1];
+
+        void push(uint32_t pc) {
+            ras.top = (ras.top + 1) % RAS_ENTRIES;
+            ras.entries[ras.top] = pc;
+        }
+        uint32_t pop() {
+            uint32_t pc = ras.entries[ras.top];
+            ras.top = (ras.top + RAS_ENTRIES - 1) % RAS_ENTRIES;
+            return pc;
+        }
+        btb_entry &itcEntry(uint32_t pc, uint64_t hist) { return itc[((pc >> 2) ^ hist) % ITC_ENTRIES]; }
+    public:
+        BranchUnit() : predictor(0), btb(BTB_ENTRIES, btb_entry()), itc(ITC_ENTRIES, btb_entry()), history(0) {
+            ras = ras_state();
+            cycleRAS = ras;
+            branches = mispredicted = takenBranches = btbMisses = 0;
+            for (int k = 0; k <= BR_INDIRECT; k++)
+                jumps[k] = jumpsMispredicted[k] = 0;
+        }
+        BranchUnit(const BranchUnit &other) : predictor(0) { *this = other; }
+        BranchUnit &operator=(const BranchUnit &other);
+        ~BranchUnit() { delete predictor; }
+
+        // See make_branch_predictor() for the kinds, false for an unknown one
+        bool setPredictor(const std::string &kind);
+
+        const char *name() { return predictor ? predictor->name() : "not-taken"; }
+
+        // Fetch: the pc to fetch after the instruction at pc, the guess is recorded in r
+        uint32_t predict(uint32_t pc, branch_record &r);
+
+        // Decode or execute found that fetch went the wrong way after the instruction at
+        // pc (r.kind filled in): put the RAS back as if fetch had known
+        void recover(uint32_t pc, const branch_record &r);
+
+        // The pipeline redoes this cycle's fetch (or the whole cycle): undo what it did to the RAS
+        void startCycle() { cycleRAS = ras; }
+        void undoCycle() { ras = cycleRAS; }
+
+        // Writeback: a branch or jump retired with the outcome recorded in r
+        void resolve(uint32_t pc, const branch_record &r);
+
+        void save(CheckpointWriter &ckpt);
+        bool restore(CheckpointReader &ckpt);
+
+        void printStats(std::ostream &out);
+
+        // Conditional branches, their mispredictions and the taken ones the BTB missed
+        void registerStats(StatsRegistry &stats);
+};
+
+// The predictor called kind, bp is 0 for "not-taken". False if there is no such kind.
+bool make_branch_predictor(const std::string &kind, BranchPredictor *&bp);
+
+// The kinds make_branch_predictor() accepts, for help texts
+extern const char *branch_predictor_kinds;
+
+#endif
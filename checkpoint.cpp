@@ -0,0 +1,94 @@
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "checkpoint.h"
+
+using namespace std;
+
+bool CheckpointWriter::write(const char *path, int opt_level, uint64_t cycle, uint32_t text_base, uint32_t end_pc) {
+    ckpt_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, CKPT_MAGIC, 8);
+    hdr.version = CKPT_VERSION;
+    hdr.opt_level = opt_level;
+    hdr.cycle = cycle;
+    hdr.text_base = text_base;
+    hdr.end_pc = end_pc;
+
+    uint64_t offset = CKPT_ALIGN;
+    for (int i = 0; i < CKPT_NUM_SECTIONS; i++) {
+        hdr.section[i].offset = offset;
+        hdr.section[i].size = data[i].size();
+        offset += (data[i].size() + CKPT_ALIGN-1) & ~(uint64_t)(CKPT_ALIGN-1);
+    }
+
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        cout << "Failed to create checkpoint: " << path << "\n";
+        return false;
+    }
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+    for (int i = 0; ok && i < CKPT_NUM_SECTIONS; i++) {
+        ok = fseek(f, hdr.section[i].offset, SEEK_SET) == 0 &&
+             fwrite(data[i].data(), 1, data[i].size(), f) == data[i].size();
+    }
+    // pad the last section so the whole file maps cleanly
+    ok = ok && ftruncate(fileno(f), offset) == 0;
+    ok = (fclose(f) == 0) && ok;
+    if (!ok)
+        cout << "Failed to write checkpoint: " << path << "\n";
+    return ok;
+}
+
+CheckpointReader::~CheckpointReader() {
+    if (map)
+        munmap((void *)map, map_size);
+}
+
+bool CheckpointReader::open(const char *path) {
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        cout << "Failed to open checkpoint: " << path << "\n";
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) || (size_t)st.st_size < sizeof(ckpt_header)) {
+        cout << "Checkpoint is truncated: " << path << "\n";
+        close(fd);
+        return false;
+    }
+    map_size = st.st_size;
+    void *m = mmap(0, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) {
+        cout << "Failed to map checkpoint: " << path << "\n";
+        return false;
+    }
+    map = (const uint8_t *)m;
+    hdr = (const ckpt_header *)map;
+
+    if (memcmp(hdr->magic, CKPT_MAGIC, 8) || hdr->version != CKPT_VERSION) {
+        cout << "Not a checkpoint (or unsupported version): " << path << "\n";
+        return false;
+    }
+    for (int i = 0; i < CKPT_NUM_SECTIONS; i++) {
+        if (hdr->section[i].offset + hdr->section[i].size > map_size) {
+            cout << "Checkpoint is truncated: " << path << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// Copy the next n bytes of the section, false if it is too short
+bool CheckpointReader::get(void *dst, size_t n) {
+    if (pos + n > hdr->section[cur].size)
+        return false;
+    memcpy(dst, map + hdr->section[cur].offset + pos, n);
+    pos += n;
+    return true;
+}
@@ -0,0 +1,76 @@
+#ifndef CHECKPOINT_CLASS
+#define CHECKPOINT_CLASS
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#define CKPT_MAGIC "MIPSCKPT"
+#define CKPT_VERSION 15
+#define CKPT_ALIGN 4096             // sections start on page boundaries so they can be mapped
+
+// Sections of a checkpoint file
+enum ckpt_section { CKPT_CPU, CKPT_L1I, CKPT_L1D, CKPT_SHARED, CKPT_MEM, CKPT_NUM_SECTIONS };
+
+// Checkpoint file header, followed by the page aligned sections
+struct ckpt_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t opt_level;             // level the state was saved at
+    uint64_t cycle;                 // cycles simulated when the checkpoint was taken
+    uint32_t text_base;             // the program, as for Processor::load_program()
+    uint32_t end_pc;
+    struct {
+        uint64_t offset;
+        uint64_t size;
+    } section[CKPT_NUM_SECTIONS];
+};
+
+// Collects the sections of a checkpoint and writes them out in one file
+class CheckpointWriter {
+    private:
+        std::vector<uint8_t> data[CKPT_NUM_SECTIONS];
+        int cur;
+    public:
+        CheckpointWriter() { cur = 0; }
+
+        // Following put() calls append to this section
+        void begin(int section) { cur = section; }
+
+        void put(const void *src, size_t n) {
+            const uint8_t *p = (const uint8_t *)src;
+            data[cur].insert(data[cur].end(), p, p + n);
+        }
+
+        bool write(const char *path, int opt_level, uint64_t cycle, uint32_t text_base, uint32_t end_pc);
+};
+
+// Maps a checkpoint file and hands out its sections
+class CheckpointReader {
+    private:
+        const uint8_t *map;
+        size_t map_size;
+        const ckpt_header *hdr;
+        int cur;
+        size_t pos;
+    public:
+        CheckpointReader() { map = 0; map_size = 0; hdr = 0; cur = 0; pos = 0; }
+        ~CheckpointReader();
+
+        bool open(const char *path);
+
+        const ckpt_header &header() { return *hdr; }
+
+        // Following get()/data() calls read from this section
+        void begin(int section) { cur = section; pos = 0; }
+
+        // Copy the next n bytes of the section, false if it is too short
+        bool get(void *dst, size_t n);
+
+        // The rest of the section in place, for large arrays
+        const uint8_t *data(size_t &n) {
+            n = hdr->section[cur].size - pos;
+            return map + hdr->section[cur].offset + pos;
+        }
+};
+
+#endif
@@ -3,26 +3,29 @@
 #include <vector>
 #include <cstdint>
 #include <iostream>
+#include "ALU.h"
 using namespace std;
 
-// Control signals for the processor
+// Control signals for the processor, packed into one 32-bit word so a latch
+// carries, copies and clears them as a single value
 struct control_t {
-    bool reg_dest;           // 0 if rt, 1 if rd
-    bool jump;               // 1 if jummp
-    bool jump_reg;           // 1 if jr
-    bool link;               // 1 if jal
-    bool shift;              // 1 if sll or srl
-    bool branch;             // 1 if branch
-    bool bne;                // 1 if bne
-    bool mem_read;           // 1 if memory needs to be read
-    bool mem_to_reg;         // 1 if memory needs to written to reg
-    unsigned ALU_op : 2;     // 10 for R-type, 00 for LW/SW, 01 for BEQ/BNE, 11 for others
-    bool mem_write;          // 1 if needs to be written to memory
-    bool halfword;           // 1 if loading/storing halfword from memory
-    bool byte;               // 1 if loading/storing a byte from memory
-    bool ALU_src;            // 0 if second operand is from reg_file, 1 if imm
-    bool reg_write;          // 1 if need to write back to reg file
-    bool zero_extend;        // 1 if immediate needs to be zero-extended
+    uint32_t reg_dest : 1;       // 0 if rt, 1 if rd
+    uint32_t jump : 1;           // 1 if jummp
+    uint32_t jump_reg : 1;       // 1 if jr
+    uint32_t link : 1;           // 1 if jal
+    uint32_t shift : 1;          // 1 if sll or srl
+    uint32_t branch : 1;         // 1 if branch
+    uint32_t bne : 1;            // 1 if bne
+    uint32_t mem_read : 1;       // 1 if memory needs to be read
+    uint32_t mem_to_reg : 1;     // 1 if memory needs to written to reg
+    uint32_t ALU_op : 2;         // 10 for R-type, 00 for LW/SW, 01 for BEQ/BNE, 11 for others
+    uint32_t mem_write : 1;      // 1 if needs to be written to memory
+    uint32_t halfword : 1;       // 1 if loading/storing halfword from memory
+    uint32_t byte : 1;           // 1 if loading/storing a byte from memory
+    uint32_t ALU_src : 1;        // 0 if second operand is from reg_file, 1 if imm
+    uint32_t reg_write : 1;      // 1 if need to write back to reg file
+    uint32_t zero_extend : 1;    // 1 if immediate needs to be zero-extended
+    uint32_t ALU_operation : 4;  // alu_operation picked by the ALU control unit
     
     void print() {      // Prints the generated contol signals
         cout << "REG_DEST: " << reg_dest << "\n";
@@ -36,114 +39,83 @@ struct control_t {
         cout << "REG_WRITE: " << reg_write << "\n";
     }
     void reset() {
-        reg_dest = 0;         
-        jump = 0;             
-        jump_reg = 0;         
-        link = 0;             
-        shift = 0;            
-        branch = 0;           
-        bne = 0;              
-        mem_read = 0;         
-        mem_to_reg = 0;       
-        ALU_op = 0;           
-        mem_write = 0;         
-        halfword = 0;          
-        byte = 0;              
-        ALU_src = 0;           
-        reg_write = 0;          
-        zero_extend = 0;        
-
+        *this = control_t();
+    }
+    // Signal by signal, the unused bits of the word don't count
+    bool operator==(const control_t &o) const {
+        return reg_dest == o.reg_dest && jump == o.jump && jump_reg == o.jump_reg && link == o.link &&
+            shift == o.shift && branch == o.branch && bne == o.bne && mem_read == o.mem_read &&
+            mem_to_reg == o.mem_to_reg && ALU_op == o.ALU_op && mem_write == o.mem_write &&
+            halfword == o.halfword && byte == o.byte && ALU_src == o.ALU_src && reg_write == o.reg_write &&
+            zero_extend == o.zero_extend && ALU_operation == o.ALU_operation;
     }
-    // Decode instructions into control signals
-    void decode(uint32_t instruction) {
-        reset();
-        // Get OPCODE
-        int opcode = (instruction >> 26) & 0x3f;
-        
-        if (!opcode) { // R-Type Instructions
-            reg_dest = 1;
-            reg_write = 1;
-            ALU_op = 2;
+    // Decode instructions into control signals, one lookup in decode_table
+    void decode(uint32_t instruction);
 
-            // Special Case: jr
-            if ((instruction & 0x3f) == 0x08) {
-                reg_dest = 0;
-                reg_write = 0;
-                ALU_op = 0;
-                jump = 1;
-                jump_reg = 1;
-            }
+    // The control signals of an instruction as a constant expression: R-type
+    // by funct, the others by opcode
+    static constexpr control_t of(int opcode, int funct) {
+        return !opcode ? r_type(funct) :
+            opcode == 0x2 || opcode == 0x3 ? j_type(opcode) :
+            i_type(opcode);
+    }
 
-            // Special Case: shift
-            if ((instruction & 0x3f) == 0x0 || (instruction & 0x3f) == 0x2) {
-                shift = 1;
-            }
-        } // end R-Type
-        
-        else if (opcode == 0x2 || opcode == 0x3) { // J-Type Instructions
-            jump = 1;
-            
-            // Special Case: jal
-            if (opcode == 0x3) {
-                link = 1;
-                reg_write = 1;
-            }
-        } // end J-Type
+    static constexpr control_t make(bool reg_dest, bool jump, bool jump_reg, bool link, bool shift,
+            bool branch, bool bne, bool mem_read, bool mem_to_reg, int ALU_op, bool mem_write,
+            bool halfword, bool byte, bool ALU_src, bool reg_write, bool zero_extend, int ALU_operation) {
+        return control_t{reg_dest, jump, jump_reg, link, shift, branch, bne, mem_read, mem_to_reg,
+            (uint32_t)ALU_op, mem_write, halfword, byte, ALU_src, reg_write, zero_extend, (uint32_t)ALU_operation};
+    }
 
-        else { // I-Type Instructions
-            ALU_src = 1; // choose immediate for alu source
-            
-            if (opcode == 0x4 || opcode == 0x5) { // beq, bne
-                branch = 1;
-                ALU_op = 1;
-                ALU_src = 0;
-                
-                // Special Case: bne
-                if (opcode == 0x5) {
-                    bne = 1;
-                }
-            } // end beq, bne
-            
-            else if (opcode == 0x2b || opcode == 0x28 || opcode == 0x29) { // Stores
-                mem_write = 1;
+    static constexpr control_t r_type(int funct) {
+        // Special Case: jr, and sll or srl shift
+        return funct == 0x08 ? make(0, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, ALU_ADD) :
+            make(1, 0, 0, 0, funct == 0x0 || funct == 0x2, 0, 0, 0, 0, 2, 0, 0, 0, 0, 1, 0,
+                alu_control(2, funct, 0));
+    }
 
-                // Special Case: sb, sh
-                if (opcode == 0x28) { // sb
-                    byte = 1;
-                }
-                else if (opcode == 0x29) { // sh
-                    halfword = 1;
-                }
-            } // end stores
+    static constexpr control_t j_type(int opcode) {
+        // Special Case: jal
+        return make(0, 1, 0, opcode == 0x3, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, opcode == 0x3, 0, ALU_ADD);
+    }
 
-            else if ((opcode >= 0x23 && opcode <= 0x25) || opcode == 0x30) { // Loads
-                mem_read = 1;
-                mem_to_reg = 1;
-                reg_write = 1;
-                
-                // Special Case: lbu, lhu
-                if (opcode == 0x24) { // lbu
-                    byte = 1;
-                }
-                else if (opcode == 0x25) { // lhu
-                    halfword = 1;
-                }
-            } // end loads
+    static constexpr control_t i_type(int opcode) {
+        // beq, bne
+        return opcode == 0x4 || opcode == 0x5 ?
+                make(0, 0, 0, 0, 0, 1, opcode == 0x5, 0, 0, 1, 0, 0, 0, 0, 0, 0, ALU_SUB) :
+            // Stores, special case: sb, sh
+            opcode == 0x2b || opcode == 0x28 || opcode == 0x29 ?
+                make(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, opcode == 0x29, opcode == 0x28, 1, 0, 0, ALU_ADD) :
+            // Loads, special case: lbu, lhu
+            (opcode >= 0x23 && opcode <= 0x25) || opcode == 0x30 ?
+                make(0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 0, opcode == 0x25, opcode == 0x24, 1, 1, 0, ALU_ADD) :
+            // Catch all I-type Instrcutions, special case: ori, andi
+            make(0, 0, 0, 0, 0, 0, 0, 0, 0, 3, 0, 0, 0, 1, 1, opcode == 0xc || opcode == 0xd,
+                alu_control(3, 0, opcode));
+    }
+};
 
-            else { // Catch all I-type Instrcutions
-                reg_write = 1;
-                ALU_op = 3; 
-                // Special Case: ori, andi
-                if (opcode == 0xc || opcode == 0xd) {
-                    zero_extend = 1;
-                }
-            }
+// Control signals of every instruction, generated at compile time: entry opcode
+// for opcodes 1-63, 64 + funct for R-type (entry 0 is unused)
+#define DECODE_ENTRIES 128
 
-        }// end I-Type
-    }
+struct control_table {
+    control_t entry[DECODE_ENTRIES];
 };
 
+template <int... I> struct decode_index {};
+template <int N, int... I> struct make_decode_index : make_decode_index<N-1, N-1, I...> {};
+template <int... I> struct make_decode_index<0, I...> { typedef decode_index<I...> type; };
+
+template <int... I> constexpr control_table make_control_table(decode_index<I...>) {
+    return control_table{{ control_t::of(I < 64 ? I : 0, I < 64 ? 0 : I - 64)... }};
+}
 
+static constexpr control_table decode_table = make_control_table(make_decode_index<DECODE_ENTRIES>::type());
 
+inline void control_t::decode(uint32_t instruction) {
+    int opcode = instruction >> 26;
+    *this = decode_table.entry[opcode ? opcode : 64 + (instruction & 0x3f)];
+}
 
 #endif
@@ -0,0 +1,199 @@
+#include <cstdint>
+#include <iostream>
+#include "functional.h"
+#include "control.h"
+#include "ALU.h"
+
+#ifdef ENABLE_DEBUG
+#define DEBUG(x) x
+#else
+#define DEBUG(x)
+#endif
+
+// Resolve the instruction word at pc into its ops entry
+void FunctionalCore::decode(uint32_t pc) {
+    uint32_t instruction = memory->words()[pc/4];
+    decoded_op &op = ops[(pc - text_base)/4];
+
+    // Reuse the reference decoder so both engines can never disagree
+    control_t control;
+    control.decode(instruction);
+
+    uint32_t imm = instruction & 0xffff;
+    imm = control.zero_extend ? imm : (imm >> 15) ? 0xffff0000 | imm : imm;
+
+    op.rs = (instruction >> 21) & 0x1f;
+    op.rt = (instruction >> 16) & 0x1f;
+    op.dst = control.link ? 31 : control.reg_dest ? (instruction >> 11) & 0x1f : op.rt;
+    op.imm = imm;
+
+    if (control.jump_reg) {
+        op.kind = OP_JR;
+    } else if (control.jump) {
+        // same target computation as single_cycle_processor_advance()
+        op.kind = control.link ? OP_JAL : OP_J;
+        op.imm = ((pc+4) & 0xf0000000) | ((instruction & 0x3ffffff) << 2);
+    } else if (control.branch) {
+        op.kind = control.bne ? OP_BNE : OP_BEQ;
+        op.imm = pc + 4 + (imm << 2);
+    } else if (control.mem_write) {
+        op.kind = control.halfword ? OP_SH : control.byte ? OP_SB : OP_SW;
+    } else if (control.mem_read) {
+        op.kind = control.halfword ? OP_LHU : control.byte ? OP_LBU : OP_LW;
+    } else if (control.shift) {
+        op.kind = control.ALU_operation == ALU_SRL ? OP_SRL : OP_SLL;
+        op.imm = (instruction >> 6) & 0x1f;
+    } else {
+        int base = control.ALU_src ? OP_ADD_RI : OP_ADD_RR;
+        switch (control.ALU_operation) {
+            case ALU_AND: op.kind = base + (OP_AND_RR - OP_ADD_RR); break;
+            case ALU_OR: op.kind = base + (OP_OR_RR - OP_ADD_RR); break;
+            case ALU_SUB: op.kind = base + (OP_SUB_RR - OP_ADD_RR); break;
+            case ALU_SLT: op.kind = base + (OP_SLT_RR - OP_ADD_RR); break;
+            case ALU_NOR: op.kind = base + (OP_NOR_RR - OP_ADD_RR); break;
+            case ALU_LUI: op.kind = OP_LUI; op.imm = imm << 16; break;
+            default: op.kind = base; break;
+        }
+    }
+    DEBUG(cout << "Predecoded 0x" << std::hex << pc << ": " << instruction << std::dec << " -> " << (int)op.kind << "\n");
+}
+
+// Predecode the program, instructions are read from memory so load() must have run
+void FunctionalCore::load(uint32_t base, uint32_t end) {
+    text_base = base;
+    end_pc = end;
+    ops.resize((end_pc - text_base)/4 + 2);
+    for (uint32_t pc = text_base; pc <= end_pc; pc += 4) {
+        decode(pc);
+    }
+    ops.back().kind = OP_EXIT;
+}
+
+// Number of instructions in the basic block starting at pc (at most max_len)
+uint32_t FunctionalCore::block_length(uint32_t pc, uint32_t max_len) {
+    uint32_t n = 0;
+    for (uint32_t a = pc; a <= end_pc && n < max_len; a += 4) {
+        n++;
+        if (lookup(a).kind >= OP_BEQ)
+            break;
+    }
+    return n;
+}
+
+// Handlers are written once and threaded with computed goto on GCC/Clang,
+// with a plain switch loop as the portable fallback.
+#if defined(__GNUC__)
+#define HANDLER(k)  L_##k:
+#define DISPATCH()  { if (!budget) goto out; --budget; goto *dispatch[op->kind]; }
+#else
+#define HANDLER(k)  case k:
+#define DISPATCH()  continue
+#endif
+
+#define RS          ((uint32_t)R[op->rs].value)
+#define RT          ((uint32_t)R[op->rt].value)
+#define SET(v)      R[op->dst].value = (int32_t)(v)
+#define NEXT()      { ++op; DISPATCH(); }
+#define OP_PC       (text_base + (uint32_t)(op - base)*4)
+#define JUMP(t)     { uint32_t t_ = (t); if (!inText(t_)) { pc = t_; goto out_pc; } op = base + (t_ - text_base)/4; DISPATCH(); }
+#define STORE(w, v) { uint32_t w_ = (w); mem[w_] = (v); if (w_ - first <= last) { base[w_ - first].kind = OP_REDECODE; text_writes++; } }
+
+// Run until pc leaves [text_base, end_pc] or max_insts instructions have executed.
+// Returns the number of instructions executed (= cycles at -O0).
+uint64_t FunctionalCore::run(uint64_t max_insts) {
+    if (ops.empty() || !inText(regfile->pc)) {
+        return 0;
+    }
+
+#if defined(__GNUC__)
+    static void *dispatch[NUM_OP_KINDS] = {
+        &&L_OP_ADD_RR, &&L_OP_SUB_RR, &&L_OP_AND_RR, &&L_OP_OR_RR, &&L_OP_NOR_RR, &&L_OP_SLT_RR,
+        &&L_OP_ADD_RI, &&L_OP_SUB_RI, &&L_OP_AND_RI, &&L_OP_OR_RI, &&L_OP_NOR_RI, &&L_OP_SLT_RI,
+        &&L_OP_SLL, &&L_OP_SRL, &&L_OP_LUI,
+        &&L_OP_LW, &&L_OP_LHU, &&L_OP_LBU,
+        &&L_OP_SW, &&L_OP_SH, &&L_OP_SB,
+        &&L_OP_BEQ, &&L_OP_BNE,
+        &&L_OP_J, &&L_OP_JAL, &&L_OP_JR,
+        &&L_OP_REDECODE, &&L_OP_EXIT
+    };
+#endif
+
+    PhysReg *R = regfile->data();
+    uint32_t *mem = memory->words();
+    decoded_op *base = ops.data();
+    decoded_op *op = base + (regfile->pc - text_base)/4;
+    uint32_t first = text_base/4, last = (end_pc - text_base)/4;
+    uint32_t pc = 0;
+    uint64_t budget = max_insts;
+
+#if defined(__GNUC__)
+    DISPATCH();
+#else
+    for (;;) {
+        if (!budget) goto out;
+        --budget;
+        switch (op->kind) {
+#endif
+    HANDLER(OP_ADD_RR) SET(RS + RT); NEXT();
+    HANDLER(OP_SUB_RR) SET(RS - RT); NEXT();
+    HANDLER(OP_AND_RR) SET(RS & RT); NEXT();
+    HANDLER(OP_OR_RR)  SET(RS | RT); NEXT();
+    HANDLER(OP_NOR_RR) SET(~(RS | RT)); NEXT();
+    HANDLER(OP_SLT_RR) SET((int32_t)RS < (int32_t)RT); NEXT();
+    HANDLER(OP_ADD_RI) SET(RS + op->imm); NEXT();
+    HANDLER(OP_SUB_RI) SET(RS - op->imm); NEXT();
+    HANDLER(OP_AND_RI) SET(RS & op->imm); NEXT();
+    HANDLER(OP_OR_RI)  SET(RS | op->imm); NEXT();
+    HANDLER(OP_NOR_RI) SET(~(RS | op->imm)); NEXT();
+    HANDLER(OP_SLT_RI) SET((int32_t)RS < (int32_t)op->imm); NEXT();
+    HANDLER(OP_SLL)    SET(RT << op->imm); NEXT();
+    HANDLER(OP_SRL)    SET(RT >> op->imm); NEXT();
+    HANDLER(OP_LUI)    SET(op->imm); NEXT();
+    HANDLER(OP_LW)     SET(mem[(RS + op->imm)/4]); NEXT();
+    HANDLER(OP_LHU)    SET(mem[(RS + op->imm)/4] & 0xffff); NEXT();
+    HANDLER(OP_LBU)    SET(mem[(RS + op->imm)/4] & 0xff); NEXT();
+    HANDLER(OP_SW) {
+        STORE((RS + op->imm)/4, RT);
+        NEXT();
+    }
+    HANDLER(OP_SH) {
+        uint32_t w = (RS + op->imm)/4;
+        STORE(w, (mem[w] & 0xffff0000) | (RT & 0xffff));
+        NEXT();
+    }
+    HANDLER(OP_SB) {
+        uint32_t w = (RS + op->imm)/4;
+        STORE(w, (mem[w] & 0xffffff00) | (RT & 0xff));
+        NEXT();
+    }
+    HANDLER(OP_BEQ)
+        if (RS == RT) JUMP(op->imm);
+        NEXT();
+    HANDLER(OP_BNE)
+        if (RS != RT) JUMP(op->imm);
+        NEXT();
+    HANDLER(OP_J)      JUMP(op->imm);
+    HANDLER(OP_JAL)
+        // link value matches single_cycle_processor_advance(): past the delay slot
+        SET(OP_PC + 8);
+        JUMP(op->imm);
+    HANDLER(OP_JR)     JUMP(RS);
+    HANDLER(OP_REDECODE)
+        decode(OP_PC);
+        ++budget;
+        DISPATCH();
+    HANDLER(OP_EXIT)
+        ++budget;
+        goto out;
+#if !defined(__GNUC__)
+        }
+    }
+#endif
+
+out:
+    regfile->pc = OP_PC;
+    return max_insts - budget;
+out_pc:
+    regfile->pc = pc;
+    return max_insts - budget;
+}
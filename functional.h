@@ -0,0 +1,90 @@
+#ifndef FUNCTIONAL_CORE
+#define FUNCTIONAL_CORE
+#include <vector>
+#include <cstdint>
+#include "memory.h"
+#include "regfile.h"
+
+// Handlers of the predecoded interpreter. Every instruction of the text
+// section is resolved once into one of these, so the hot loop never has to
+// look at control_t or the ALU switch again.
+enum op_kind {
+    OP_ADD_RR, OP_SUB_RR, OP_AND_RR, OP_OR_RR, OP_NOR_RR, OP_SLT_RR,
+    OP_ADD_RI, OP_SUB_RI, OP_AND_RI, OP_OR_RI, OP_NOR_RI, OP_SLT_RI,
+    OP_SLL, OP_SRL, OP_LUI,
+    OP_LW, OP_LHU, OP_LBU,
+    OP_SW, OP_SH, OP_SB,
+    OP_BEQ, OP_BNE,
+    OP_J, OP_JAL, OP_JR,
+    OP_REDECODE,            // entry was invalidated by a store, decode it again
+    OP_EXIT,                // fell off the end of the program
+    NUM_OP_KINDS
+};
+
+// A pre-resolved instruction
+struct decoded_op {
+    uint8_t kind;           // op_kind
+    uint8_t rs, rt;         // source registers
+    uint8_t dst;            // register written (rd, rt or 31 already resolved)
+    uint32_t imm;           // extended immediate, shamt, lui constant, link value or target pc
+};
+
+// Fast functional engine for -O0. It has exactly the semantics of
+// Processor::single_cycle_processor_advance() but decodes [text_base, end_pc] once
+// and runs it with computed-goto dispatch straight on the register array and
+// the flat memory, bypassing Memory::access.
+class FunctionalCore {
+    private:
+        Registers *regfile;
+        Memory *memory;
+        std::vector<decoded_op> ops;    // one entry per word in [text_base, end_pc], plus a trailing OP_EXIT
+        uint32_t text_base, end_pc;
+        uint64_t text_writes;           // stores that hit the predecoded range
+
+        // Resolve the instruction word at pc into its ops entry
+        void decode(uint32_t pc);
+    public:
+        FunctionalCore(Registers *regs, Memory *mem) {
+            regfile = regs;
+            memory = mem;
+            text_base = 0;
+            end_pc = 0;
+            text_writes = 0;
+        }
+
+        // Predecode the program in [base, end], instructions are read from memory so load() must have run
+        void load(uint32_t base, uint32_t end);
+
+        // Drop the predecoded entry for a word address (call on any store into text)
+        void invalidate(uint32_t address) {
+            if ((address - text_base)/4 + 1 < ops.size()) {
+                ops[(address - text_base)/4].kind = OP_REDECODE;
+                text_writes++;
+            }
+        }
+
+        // Predecoded entry for pc (decoded again if it was invalidated), pc must be inText()
+        const decoded_op &lookup(uint32_t pc) {
+            if (ops[(pc - text_base)/4].kind == OP_REDECODE)
+                decode(pc);
+            return ops[(pc - text_base)/4];
+        }
+
+        uint32_t getTextBase() { return text_base; }
+        uint32_t getEndPC() { return end_pc; }
+
+        // pc is in [text_base, end_pc]
+        bool inText(uint32_t pc) { return pc - text_base <= end_pc - text_base; }
+
+        // Number of instructions in the basic block starting at pc (at most max_len)
+        uint32_t block_length(uint32_t pc, uint32_t max_len);
+
+        // Number of stores into text so far, translators compare this to detect self-modifying code
+        uint64_t textWrites() { return text_writes; }
+
+        // Run until pc leaves [text_base, end_pc] or max_insts instructions have executed.
+        // Returns the number of instructions executed (= cycles at -O0).
+        uint64_t run(uint64_t max_insts);
+};
+
+#endif
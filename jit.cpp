@@ -0,0 +1,476 @@
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <sys/mman.h>
+#include "jit.h"
+
+#ifdef ENABLE_DEBUG
+#define DEBUG(x) x
+#else
+#define DEBUG(x)
+#endif
+
+using namespace std;
+
+#define CODE_SIZE       (16 << 20)  // translation cache
+#define MAX_BLOCK_INSTS 64
+#define MAX_BLOCK_BYTES 16384       // worst case for one block including exit stubs
+#define HOT_THRESHOLD   16          // block entries before it gets translated
+
+enum host_reg { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+enum host_cc { CC_B = 0x2, CC_E = 0x4, CC_NE = 0x5, CC_A = 0x7, CC_L = 0xc };
+
+// Host registers that can hold guest registers during a block.
+// rax/rcx/rdx are scratch, r12-r15 hold regs/mem/budget/context.
+static const int alloc_regs[] = { RBX, RBP, RSI, RDI, R8, R9, R10, R11 };
+#define NUM_ALLOC_REGS 8
+
+#define GUEST(g) ((int32_t)((g)*sizeof(PhysReg) + offsetof(PhysReg, value)))
+
+// Just enough of an x86-64 encoder for the translator
+struct Emitter {
+    uint8_t *p;
+
+    Emitter(uint8_t *at) { p = at; }
+
+    void byte(uint8_t b) { *p++ = b; }
+    void dword(uint32_t d) { memcpy(p, &d, 4); p += 4; }
+
+    void rex(bool w, int reg, int index, int base) {
+        uint8_t r = 0x40 | (w << 3) | ((reg >> 3) << 2) | ((index >> 3) << 1) | (base >> 3);
+        if (r != 0x40)
+            byte(r);
+    }
+    // opc reg, rm (both registers)
+    void rr(uint8_t opc, int reg, int rm, bool w = false) {
+        rex(w, reg, 0, rm);
+        byte(opc);
+        byte(0xc0 | (reg & 7) << 3 | (rm & 7));
+    }
+    // opc reg, [base + index*scale + disp32], index < 0 for none
+    void mem(uint8_t opc, int reg, int base, int index, int scale, int32_t disp, bool w = false) {
+        rex(w, reg, index < 0 ? 0 : index, base);
+        byte(opc);
+        if (index < 0 && (base & 7) != RSP) {
+            byte(0x80 | (reg & 7) << 3 | (base & 7));
+        } else {
+            int ss = scale == 8 ? 3 : scale == 4 ? 2 : scale == 2 ? 1 : 0;
+            byte(0x84 | (reg & 7) << 3);
+            byte(ss << 6 | ((index < 0 ? RSP : index) & 7) << 3 | (base & 7));
+        }
+        dword(disp);
+    }
+    // group 1 with imm32: 0 add, 1 or, 4 and, 5 sub, 7 cmp
+    void ri(int ext, int rm, uint32_t imm, bool w = false) {
+        rex(w, 0, 0, rm);
+        byte(0x81);
+        byte(0xc0 | ext << 3 | (rm & 7));
+        dword(imm);
+    }
+    // group 2 with imm8: 4 shl, 5 shr
+    void shift(int ext, int rm, uint8_t n) {
+        rex(false, 0, 0, rm);
+        byte(0xc1);
+        byte(0xc0 | ext << 3 | (rm & 7));
+        byte(n);
+    }
+    void mov(int dst, int src) { if (dst != src) rr(0x8b, dst, src); }
+    void mov_imm(int reg, uint32_t imm) { rex(false, 0, 0, reg); byte(0xb8 | (reg & 7)); dword(imm); }
+    void not_(int rm) { rex(false, 0, 0, rm); byte(0xf7); byte(0xd0 | (rm & 7)); }
+    void push(int r) { rex(false, 0, 0, r); byte(0x50 | (r & 7)); }
+    void pop(int r) { rex(false, 0, 0, r); byte(0x58 | (r & 7)); }
+    void setl_eax() { byte(0x0f); byte(0x9c); byte(0xc0); }
+
+    // Jumps return their rel32 field so they can be patched later
+    uint8_t *jmp(uint8_t *target) {
+        byte(0xe9);
+        dword(target - (p + 4));
+        return p - 4;
+    }
+    uint8_t *jcc(int cc, uint8_t *target) {
+        byte(0x0f);
+        byte(0x80 | cc);
+        dword(target ? target - (p + 4) : 0);
+        return p - 4;
+    }
+    static void patch(uint8_t *field, uint8_t *target) {
+        int32_t rel = target - (field + 4);
+        memcpy(field, &rel, 4);
+    }
+};
+
+// Which operands a predecoded op touches
+static bool reads_rs(int k) {
+    return k <= OP_SLT_RI || (k >= OP_LW && k <= OP_SB) || k == OP_BEQ || k == OP_BNE || k == OP_JR;
+}
+static bool reads_rt(int k) {
+    return k <= OP_SLT_RR || k == OP_SLL || k == OP_SRL || (k >= OP_SW && k <= OP_SB) || k == OP_BEQ || k == OP_BNE;
+}
+static bool writes_dst(int k) {
+    return k <= OP_LBU || k == OP_JAL;
+}
+
+// Guest register g in a host register, loading it into scratch if it is not allocated
+static int src(Emitter &e, const int *host, int g, int scratch) {
+    if (host[g] >= 0)
+        return host[g];
+    e.mem(0x8b, scratch, R12, -1, 1, GUEST(g));
+    return scratch;
+}
+
+static void set_dst(Emitter &e, const int *host, int g, int from) {
+    if (host[g] >= 0)
+        e.mov(host[g], from);
+    else
+        e.mem(0x89, from, R12, -1, 1, GUEST(g));
+}
+
+static void writeback(Emitter &e, const int *host, const bool *written) {
+    for (int g = 0; g < 32; g++) {
+        if (host[g] >= 0 && written[g])
+            e.mem(0x89, host[g], R12, -1, 1, GUEST(g));
+    }
+}
+
+JIT::JIT(FunctionalCore *core, Registers *regs, Memory *mem) {
+    functional = core;
+    regfile = regs;
+    memory = mem;
+    code = 0;
+    code_used = code_start = 0;
+    epilogue = 0;
+    enter = 0;
+    num_translated = num_chained = num_flushes = 0;
+
+#if defined(__x86_64__)
+    void *buf = mmap(0, CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED) {
+        cout << "JIT: could not allocate the code buffer, using the interpreter\n";
+        return;
+    }
+    code = (uint8_t *)buf;
+
+    // uint32_t enter(jit_context *ctx, uint8_t *block)
+    Emitter e(code);
+    e.push(RBX); e.push(RBP); e.push(R12); e.push(R13); e.push(R14); e.push(R15);
+    e.rr(0x8b, R15, RDI, true);
+    e.mem(0x8b, R12, R15, -1, 1, offsetof(jit_context, regs), true);
+    e.mem(0x8b, R13, R15, -1, 1, offsetof(jit_context, mem), true);
+    e.mem(0x8b, R14, R15, -1, 1, offsetof(jit_context, budget), true);
+    e.byte(0xff); e.byte(0xe6);     // jmp rsi
+
+    // every block leaves through here with the next pc in eax
+    epilogue = e.p;
+    e.mem(0x89, R14, R15, -1, 1, offsetof(jit_context, budget), true);
+    e.pop(R15); e.pop(R14); e.pop(R13); e.pop(R12); e.pop(RBP); e.pop(RBX);
+    e.byte(0xc3);
+
+    enter = (uint32_t (*)(jit_context *, uint8_t *))code;
+    code_used = code_start = e.p - code;
+#endif
+}
+
+JIT::~JIT() {
+    if (code)
+        munmap(code, CODE_SIZE);
+}
+
+// Throw away all translations (self-modifying code or a full buffer)
+void JIT::flush() {
+    code_used = code_start;
+    for (size_t i = 0; i < blocks.size(); i++) {
+        blocks[i] = 0;
+        hits[i] = 0;
+        pending[i].clear();
+    }
+    num_flushes++;
+}
+
+// Translate the basic block at pc, returns its entry or 0
+uint8_t *JIT::translate(uint32_t pc) {
+#if defined(__x86_64__)
+    if (!code)
+        return 0;
+    if (CODE_SIZE - code_used < MAX_BLOCK_BYTES)
+        flush();
+
+    uint32_t text_base = functional->getTextBase(), end_pc = functional->getEndPC();
+    uint32_t first = text_base/4, last = (end_pc - text_base)/4;
+
+    // Gather the block and count register uses
+    decoded_op insts[MAX_BLOCK_INSTS];
+    int n = 0;
+    int uses[32] = {0};
+    bool written[32] = {false};
+    for (uint32_t a = pc; a <= end_pc && n < MAX_BLOCK_INSTS; a += 4) {
+        const decoded_op &op = functional->lookup(a);
+        insts[n++] = op;
+        if (reads_rs(op.kind)) uses[op.rs]++;
+        if (reads_rt(op.kind)) uses[op.rt]++;
+        if (writes_dst(op.kind)) { uses[op.dst]++; written[op.dst] = true; }
+        if (op.kind >= OP_BEQ)
+            break;
+    }
+
+    // Give the most used guest registers a host register for the whole block
+    int host[32];
+    for (int g = 0; g < 32; g++)
+        host[g] = -1;
+    for (int r = 0; r < NUM_ALLOC_REGS; r++) {
+        int best = -1;
+        for (int g = 0; g < 32; g++) {
+            if (host[g] < 0 && uses[g] && (best < 0 || uses[g] > uses[best]))
+                best = g;
+        }
+        if (best < 0)
+            break;
+        host[best] = alloc_regs[r];
+    }
+
+    Emitter e(code + code_used);
+    uint8_t *entry = e.p;
+
+    // Charge the whole block up front, bail to the interpreter if the budget is too small
+    e.ri(7, R14, n, true);
+    uint8_t *bail = e.jcc(CC_B, 0);
+    e.ri(5, R14, n, true);
+    for (int g = 0; g < 32; g++) {
+        if (host[g] >= 0)
+            e.mem(0x8b, host[g], R12, -1, 1, GUEST(g));
+    }
+
+    std::vector<std::pair<uint8_t *, uint32_t> > exits;     // chainable jumps and their targets
+    bool ends_block = false;
+    for (int i = 0; i < n; i++) {
+        const decoded_op &op = insts[i];
+        uint32_t cur = pc + 4*i;
+        int a, b;
+        switch (op.kind) {
+            case OP_ADD_RR: case OP_SUB_RR: case OP_AND_RR: case OP_OR_RR: case OP_NOR_RR: {
+                static const uint8_t opc[] = { 0x01, 0x29, 0x21, 0x09, 0x09 };
+                a = src(e, host, op.rs, RCX);
+                b = src(e, host, op.rt, RDX);
+                e.mov(RAX, a);
+                e.rr(opc[op.kind - OP_ADD_RR], b, RAX);
+                if (op.kind == OP_NOR_RR)
+                    e.not_(RAX);
+                set_dst(e, host, op.dst, RAX);
+                break;
+            }
+            case OP_ADD_RI: case OP_SUB_RI: case OP_AND_RI: case OP_OR_RI: case OP_NOR_RI: {
+                static const int ext[] = { 0, 5, 4, 1, 1 };
+                a = src(e, host, op.rs, RCX);
+                e.mov(RAX, a);
+                e.ri(ext[op.kind - OP_ADD_RI], RAX, op.imm);
+                if (op.kind == OP_NOR_RI)
+                    e.not_(RAX);
+                set_dst(e, host, op.dst, RAX);
+                break;
+            }
+            case OP_SLT_RR:
+                a = src(e, host, op.rs, RCX);
+                b = src(e, host, op.rt, RDX);
+                e.rr(0x31, RAX, RAX);
+                e.rr(0x39, b, a);
+                e.setl_eax();
+                set_dst(e, host, op.dst, RAX);
+                break;
+            case OP_SLT_RI:
+                a = src(e, host, op.rs, RCX);
+                e.rr(0x31, RAX, RAX);
+                e.ri(7, a, op.imm);
+                e.setl_eax();
+                set_dst(e, host, op.dst, RAX);
+                break;
+            case OP_SLL: case OP_SRL:
+                b = src(e, host, op.rt, RCX);
+                e.mov(RAX, b);
+                e.shift(op.kind == OP_SLL ? 4 : 5, RAX, op.imm);
+                set_dst(e, host, op.dst, RAX);
+                break;
+            case OP_LUI:
+                e.mov_imm(RAX, op.imm);
+                set_dst(e, host, op.dst, RAX);
+                break;
+            case OP_LW: case OP_LHU: case OP_LBU:
+                a = src(e, host, op.rs, RCX);
+                e.mov(RAX, a);
+                e.ri(0, RAX, op.imm);
+                e.shift(5, RAX, 2);
+                e.mem(0x8b, RAX, R13, RAX, 4, 0);
+                if (op.kind != OP_LW)
+                    e.ri(4, RAX, op.kind == OP_LHU ? 0xffff : 0xff);
+                set_dst(e, host, op.dst, RAX);
+                break;
+            case OP_SW: case OP_SH: case OP_SB: {
+                a = src(e, host, op.rs, RCX);
+                e.mov(RAX, a);
+                e.ri(0, RAX, op.imm);
+                e.shift(5, RAX, 2);
+                b = src(e, host, op.rt, RCX);
+                if (op.kind != OP_SW) {
+                    // partial stores merge into the low bits of the old word, like the reference core
+                    uint32_t keep = op.kind == OP_SH ? 0xffff : 0xff;
+                    e.mov(RCX, b);
+                    e.ri(4, RCX, keep);
+                    e.mem(0x8b, RDX, R13, RAX, 4, 0);
+                    e.ri(4, RDX, ~keep);
+                    e.rr(0x09, RDX, RCX);
+                    b = RCX;
+                }
+                e.mem(0x89, b, R13, RAX, 4, 0);
+
+                // Store into text: refund the rest of the block and let the dispatcher invalidate
+                e.mov(RDX, RAX);
+                if (first)
+                    e.ri(5, RDX, first);
+                e.ri(7, RDX, last);
+                uint8_t *skip = e.jcc(CC_A, 0);
+                e.mem(0x89, RAX, R15, -1, 1, offsetof(jit_context, smc_word));
+                if (n - i - 1)
+                    e.ri(0, R14, n - i - 1, true);
+                writeback(e, host, written);
+                e.mov_imm(RAX, cur + 4);
+                e.jmp(epilogue);
+                Emitter::patch(skip, e.p);
+                break;
+            }
+            case OP_BEQ: case OP_BNE: {
+                a = src(e, host, op.rs, RCX);
+                b = src(e, host, op.rt, RDX);
+                writeback(e, host, written);
+                e.rr(0x39, b, a);
+                uint8_t *taken = e.jcc(op.kind == OP_BEQ ? CC_E : CC_NE, 0);
+                exits.push_back(make_pair(e.jmp(e.p + 5), cur + 4));
+                e.mov_imm(RAX, cur + 4);
+                e.jmp(epilogue);
+                Emitter::patch(taken, e.p);
+                exits.push_back(make_pair(e.jmp(e.p + 5), op.imm));
+                e.mov_imm(RAX, op.imm);
+                e.jmp(epilogue);
+                ends_block = true;
+                break;
+            }
+            case OP_J: case OP_JAL:
+                if (op.kind == OP_JAL) {
+                    e.mov_imm(RAX, cur + 8);
+                    set_dst(e, host, op.dst, RAX);
+                }
+                writeback(e, host, written);
+                exits.push_back(make_pair(e.jmp(e.p + 5), op.imm));
+                e.mov_imm(RAX, op.imm);
+                e.jmp(epilogue);
+                ends_block = true;
+                break;
+            case OP_JR:
+                a = src(e, host, op.rs, RCX);
+                e.mov(RAX, a);
+                writeback(e, host, written);
+                e.jmp(epilogue);
+                ends_block = true;
+                break;
+            default:
+                // nothing else can come out of the predecoder inside [text_base, end_pc]
+                return 0;
+        }
+    }
+    if (!ends_block) {
+        writeback(e, host, written);
+        exits.push_back(make_pair(e.jmp(e.p + 5), pc + 4*n));
+        e.mov_imm(RAX, pc + 4*n);
+        e.jmp(epilogue);
+    }
+
+    Emitter::patch(bail, e.p);
+    e.mov_imm(RAX, pc);
+    e.jmp(epilogue);
+    code_used = e.p - code;
+
+    // Chain exits to blocks that already exist, the rest wait for their target
+    for (size_t i = 0; i < exits.size(); i++) {
+        uint32_t t = exits[i].second;
+        if (!functional->inText(t) || (t & 3))
+            continue;
+        uint32_t ti = (t - text_base)/4;
+        if (t == pc || blocks[ti]) {
+            Emitter::patch(exits[i].first, t == pc ? entry : blocks[ti]);
+            num_chained++;
+        } else {
+            pending[ti].push_back(exits[i].first);
+        }
+    }
+    uint32_t pi = (pc - text_base)/4;
+    blocks[pi] = entry;
+    for (size_t i = 0; i < pending[pi].size(); i++) {
+        Emitter::patch(pending[pi][i], entry);
+        num_chained++;
+    }
+    pending[pi].clear();
+    num_translated++;
+
+    DEBUG(cout << "JIT: translated " << n << " instructions at 0x" << hex << pc << dec << " into " << (e.p - entry) << " bytes\n");
+    return entry;
+#else
+    return 0;
+#endif
+}
+
+// Same contract as FunctionalCore::run()
+uint64_t JIT::run(uint64_t max_insts) {
+    uint32_t text_base = functional->getTextBase();
+    uint32_t words = (functional->getEndPC() - text_base)/4 + 1;
+    if (blocks.size() != words) {
+        blocks.assign(words, 0);
+        hits.assign(words, 0);
+        pending.assign(words, std::vector<uint8_t *>());
+    }
+
+    jit_context ctx;
+    ctx.regs = regfile->data();
+    ctx.mem = memory->words();
+
+    uint64_t budget = max_insts;
+    while (budget && functional->inText(regfile->pc)) {
+        uint32_t pc = regfile->pc;
+        uint8_t *block = 0;
+        if (!(pc & 3)) {
+            uint32_t pi = (pc - text_base)/4;
+            block = blocks[pi];
+            if (!block && ++hits[pi] == HOT_THRESHOLD) {
+                block = translate(pc);
+                // untranslatable for now, give it another HOT_THRESHOLD entries
+                if (!block)
+                    hits[pi] = 0;
+            }
+        }
+
+        if (block) {
+            ctx.budget = budget;
+            ctx.smc_word = ~0u;
+            regfile->pc = enter(&ctx, block);
+            if (ctx.budget == budget) {
+                // not enough budget left for the whole block
+                budget -= functional->run(budget);
+                continue;
+            }
+            budget = ctx.budget;
+            if (ctx.smc_word != ~0u) {
+                functional->invalidate(ctx.smc_word*4);
+                flush();
+            }
+        } else {
+            uint64_t writes = functional->textWrites();
+            uint64_t n = functional->block_length(pc, MAX_BLOCK_INSTS);
+            budget -= functional->run(n < budget ? n : budget);
+            if (functional->textWrites() != writes)
+                flush();
+        }
+    }
+    return max_insts - budget;
+}
+
+void JIT::printStats() {
+    cout << "JIT: " << num_translated << " blocks translated, " << num_chained << " exits chained, "
+         << num_flushes << " flushes\n";
+}
@@ -0,0 +1,60 @@
+#ifndef JIT_CLASS
+#define JIT_CLASS
+#include <vector>
+#include <cstdint>
+#include "memory.h"
+#include "regfile.h"
+#include "functional.h"
+
+// State shared between the dispatcher and translated code
+struct jit_context {
+    PhysReg *regs;          // register array (r12 in translated code)
+    uint32_t *mem;          // flat memory (r13)
+    uint64_t budget;        // instructions left to run (r14)
+    uint32_t smc_word;      // word index of a store into text, ~0 if none
+};
+
+// Dynamic binary translator for the -O0 functional engine. Hot basic blocks
+// of the predecoded text are translated to x86-64, with the most used MIPS
+// registers of each block held in host registers and memory accessed through
+// a base register. Blocks are chained by patching their exit jumps, and the
+// FunctionalCore interpreter runs everything that is cold or untranslatable.
+// On other hosts translate() always fails and the interpreter does all the work.
+class JIT {
+    private:
+        FunctionalCore *functional;
+        Registers *regfile;
+        Memory *memory;
+
+        uint8_t *code;                          // executable code buffer
+        uint32_t code_used;
+        uint32_t code_start;                    // first byte after the entry/exit glue
+        uint8_t *epilogue;                      // common block exit, returns eax as the next pc
+        uint32_t (*enter)(jit_context *ctx, uint8_t *block);
+
+        std::vector<uint8_t *> blocks;          // translated entry per word index, or 0
+        std::vector<uint32_t> hits;             // block entry counts before translation
+        std::vector<std::vector<uint8_t *> > pending; // rel32 fields waiting for a block to chain to
+
+        uint64_t num_translated;
+        uint64_t num_chained;
+        uint64_t num_flushes;
+
+        // Translate the basic block at pc, returns its entry or 0
+        uint8_t *translate(uint32_t pc);
+    public:
+        JIT(FunctionalCore *core, Registers *regs, Memory *mem);
+        ~JIT();
+        JIT(const JIT &) = delete;              // owns the mapped code buffer
+        JIT &operator=(const JIT &) = delete;
+
+        // Same contract as FunctionalCore::run()
+        uint64_t run(uint64_t max_insts);
+
+        // Throw away all translations (self-modifying code, a full buffer or a new program image)
+        void flush();
+
+        void printStats();
+};
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef PIPELINE_LATCH
+#define PIPELINE_LATCH
+#include <cstdint>
+#include <cstddef>
+
+// A pipeline register between two stages, double buffered: out() is what the
+// stage in front wrote last cycle and the stage behind reads this cycle, in()
+// is what the stage in front writes this cycle. clock() makes in() the new
+// out() by flipping a bank index, nothing is copied.
+//
+// A stage that stalls holds its latch: in() becomes the same bank as out(), so
+// the held value stays where it is and whatever was written to in() before
+// the hold is dropped. Every stage has to either write all of in() or hold it,
+// in() starts a cycle with the value of two cycles ago.
+//
+// T can be an array, a group of latches of the superscalar pipeline. It needs
+// an operator== that compares field by field: the padding of a struct is not
+// part of its value and need not match between the banks.
+template <class T> bool latch_equal(const T &a, const T &b) {
+    return a == b;
+}
+template <class T, size_t N> bool latch_equal(const T (&a)[N], const T (&b)[N]) {
+    for (size_t i = 0; i < N; i++) {
+        if (!latch_equal(a[i], b[i]))
+            return false;
+    }
+    return true;
+}
+
+template <class T> class Latch {
+    private:
+        T bank[2];
+        uint8_t rd;             // bank of out()
+        uint8_t wr;             // bank of in(), rd when held
+    public:
+        Latch() : bank(), rd(0), wr(1) {}
+
+        T &in() { return bank[wr]; }
+        T &out() { return bank[rd]; }
+
+        void clock() { rd = wr; wr = rd ^ 1; }
+        void hold() { wr = rd; }
+        bool held() const { return wr == rd; }
+
+        // Both banks cleared, for initialize()
+        void reset() { *this = Latch(); }
+
+        // in() is the same as out(), the latch went through the cycle unchanged
+        bool unchanged() const { return held() || latch_equal(bank[0], bank[1]); }
+};
+
+#endif
@@ -8,64 +8,107 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <errno.h>
 #include <getopt.h>
+#include <thread>
 #include "processor.h"
+#include "sampler.h"
+#include "batch.h"
+#include "stackdist.h"
+#include "stats.h"
 
 using namespace std;
 
 extern void single_cycle_main_loop(Registers &reg_file, Memory &memory, uint32_t end_pc);
-extern void pipelined_main_loop(Registers &reg_file, Memory &memory, uint32_t end_pc, int width);
-extern void processor_main_loop(Registers &reg_file, Memory &memory, uint32_t end_pc, int width);
 
-/* Load Binary. */
-uint32_t load(char *bmk, Memory &memory)
+/* Load Binary: every PT_LOAD segment goes to its address, straight from a mapping of the
+   file. entry is where execution starts, end_pc the end of the executable section holding
+   it; the program is done once the pc is past end_pc. text_base is the start of the
+   executable segment, the functional engine predecodes [text_base, end_pc]. */
+bool load(const char *bmk, Memory &memory, uint32_t &entry, uint32_t &text_base, uint32_t &end_pc)
 {
-  Elf32_Ehdr ehdr;
-  Elf32_Shdr shdr;
-
-  /* Open binary executable. */
-  FILE *binary, *binary_copy;
-  binary = fopen(bmk, "r");
-  if (!binary) {
-      cout << "Failed to open executable binary: " << string(optarg) << "\n";
-      return 0;
+  int fd = open(bmk, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0) {
+      cout << "Failed to open executable binary: " << bmk << "\n";
+      if (fd >= 0)
+          close(fd);
+      return false;
+  }
+  size_t size = st.st_size;
+  const uint8_t *file = size ? (const uint8_t *)mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0) : (const uint8_t *)MAP_FAILED;
+  close(fd);
+  if (file == MAP_FAILED) {
+      cout << "Failed to map executable binary: " << bmk << "\n";
+      return false;
   }
 
-  /* Read and verify executable header. */
-  int num_read = fread(&ehdr, 1, sizeof(ehdr), binary);
-  if ((num_read != sizeof(ehdr)) || memcmp(ehdr.e_ident, "\177ELF\1\1\1", 7)) {
-     cout << "Error in ELF header\n";
-     return 0;
+  /* Verify the executable header and that the program and section headers are in the file. */
+  const Elf32_Ehdr *ehdr = (const Elf32_Ehdr *)file;
+  bool ok = size >= sizeof(Elf32_Ehdr) && !memcmp(ehdr->e_ident, "\177ELF\1\1\1", 7) &&
+            ehdr->e_phentsize == sizeof(Elf32_Phdr) &&
+            (uint64_t)ehdr->e_phoff + (uint64_t)ehdr->e_phnum * sizeof(Elf32_Phdr) <= size &&
+            (!ehdr->e_shnum || (ehdr->e_shentsize == sizeof(Elf32_Shdr) &&
+             (uint64_t)ehdr->e_shoff + (uint64_t)ehdr->e_shnum * sizeof(Elf32_Shdr) <= size));
+  if (!ok) {
+      cout << "Error in ELF header\n";
+      munmap((void *)file, size);
+      return false;
   }
 
-  /* Read section headers. */
-  fseek(binary, ehdr.e_shoff, SEEK_SET);
-  for (int i = 0; i < ehdr.e_shnum; i++) {
-      num_read = fread(&shdr, sizeof(shdr), 1, binary);
-      if (num_read != 1) {
-          cout << "Error in section header: " << num_read << " shdr=" << shdr.sh_addr << "\n";
+  entry = ehdr->e_entry;
+  bool found = false;
+  const Elf32_Phdr *phdr = (const Elf32_Phdr *)(file + ehdr->e_phoff);
+  for (int i = 0; i < ehdr->e_phnum && ok; i++) {
+      const Elf32_Phdr &p = phdr[i];
+      if (p.p_type != PT_LOAD)
+          continue;
+      if ((uint64_t)p.p_offset + p.p_filesz > size || p.p_filesz > p.p_memsz ||
+              (uint64_t)p.p_vaddr + p.p_memsz > MEM_BYTES) {
+          cout << "Error in program header " << i << ": offset=" << p.p_offset << " vaddr=" << p.p_vaddr <<
+                  " filesz=" << p.p_filesz << " memsz=" << p.p_memsz << "\n";
+          ok = false;
           break;
       }
-      uint32_t word, dummy_word;
-      if ((shdr.sh_flags & SHF_EXECINSTR) != 0 && shdr.sh_addr == 0) { /* Text section -- we hardcoded this to zero during compilation. */
-          binary_copy = fopen(bmk, "r");
-          fseek(binary_copy, shdr.sh_offset, SEEK_SET);
-          for (int j = 0; j < (int)shdr.sh_size; j += 4) {
-              num_read = fread(&word, 1, 4, binary_copy);
-              if (num_read != 4) {
-                  cout << "Could not populate memory from section: " << shdr.sh_addr <<
-                          ": bytes read=" << j + num_read << ", section header size=" << shdr.sh_size << "\n";
-                  return 0;
-              }
-              memory.access((uint32_t)shdr.sh_addr+j, dummy_word, word, false, true);
-          }
-          fclose(binary_copy);
-          return shdr.sh_size;
+      memory.loadSegment(p.p_vaddr, file + p.p_offset, p.p_filesz, p.p_memsz);
+      if ((p.p_flags & PF_X) && entry >= p.p_vaddr && entry < p.p_vaddr + p.p_filesz) {
+          text_base = p.p_vaddr;
+          end_pc = p.p_vaddr + p.p_filesz;
+          found = true;
       }
   }
 
-  return 0;
+  /* The segment also holds .rodata and the like after the code, the program ends with the
+     executable section (only a file without section headers runs to the end of the segment). */
+  const Elf32_Shdr *shdr = (const Elf32_Shdr *)(file + ehdr->e_shoff);
+  for (int i = 0; i < ehdr->e_shnum && found; i++) {
+      const Elf32_Shdr &s = shdr[i];
+      if ((s.sh_flags & SHF_EXECINSTR) && entry >= s.sh_addr && entry < s.sh_addr + s.sh_size &&
+              s.sh_addr + s.sh_size <= end_pc) {
+          end_pc = s.sh_addr + s.sh_size;
+          break;
+      }
+  }
+  munmap((void *)file, size);
+  if (ok && !found) {
+      cout << "The entry point 0x" << hex << entry << dec << " is not in an executable segment\n";
+      ok = false;
+  }
+  return ok;
+}
+
+/* Save the whole simulator state, see checkpoint.h */
+bool save_checkpoint(const char *path, Processor &processor, Memory &memory, int optLevel, uint64_t cycle, uint32_t text_base, uint32_t end_pc)
+{
+  CheckpointWriter ckpt;
+  processor.save(ckpt);
+  memory.save(ckpt);
+  if (!ckpt.write(path, optLevel, cycle, text_base, end_pc)) {
+      return false;
+  }
+  cout << "Checkpoint written to " << path << " at cycle " << cycle << "\n";
+  return true;
 }
 
 void print_help()
@@ -74,11 +117,70 @@ void print_help()
             "--bmk <path-to-executable>           Path to the benchmark executable binary.\n"
             "Optional:\n"
             "--help                               Print this help message\n"
+            "--fast                               Run -O0 on the predecoded functional engine\n"
+            "                                     (only the final register file is printed)\n"
+            "--jit                                Like --fast, translating hot blocks to x86-64\n"
+            "--trace <file>                       Write a binary trace (decode it with tracedump)\n"
+            "--trace-level <level>                none, commit, delta or full (default commit)\n"
+            "--trace-compress                     gzip the trace\n"
+            "--checkpoint <file>                  Save the full simulator state to a file ...\n"
+            "--checkpoint-at <cycle>              ... once this many cycles have run (default 0)\n"
+            "--restore <file>                     Continue from a checkpoint instead of --bmk; -O0\n"
+            "                                     checkpoints can be continued at any level\n"
+            "--sample                             Estimate the run from a few simulated intervals\n"
+            "                                     (SimPoint style, at -O1 unless a higher level is given)\n"
+            "--interval <n>                       Instructions per sampling interval (default 100000)\n"
+            "--warmup <n>                         Instructions of cache warming before each sample\n"
+            "                                     (default 100000)\n"
+            "--max-k <n>                          Most clusters tried when sampling (default 10)\n"
+            "--batch <manifest>                   Run every job of a manifest and print a results table.\n"
+            "                                     One job per line: <elf> <level> [fast] [jit] [sample]\n"
+            "                                     [interval=N] [warmup=N] [max-k=N] [max-cycles=N]\n"
+            "                                     [caches=<config>] [mshrs=N] [prefetch=<kind>]\n"
+            "                                     [l2-prefetch=<kind>] [bpred=<kind>] [width=N]\n"
+            "                                     [rob=N] [iq=N]\n"
+            "--threads <n>                        Worker threads for --batch (default: all cores)\n"
+            "--stack-profile                      Print LRU miss ratios of every cache capacity and\n"
+            "                                     associativity for the run's address stream\n"
+            "                                     (use -O0 for the exact program order)\n"
+            "--stats <file>                       Write the performance counters (cycles, IPC, load/use\n"
+            "                                     stalls, branch flushes, per level cache hits, misses,\n"
+            "                                     writebacks and MPKI, ...) to a file at exit\n"
+            "--stats-format <format>              json or csv (default: csv for *.csv files, else json)\n"
+            "--stats-interval <n>                 Also write them every n cycles, cumulative\n"
+            "--caches <config>                    Cache hierarchy used from -O1 up (default: default),\n"
+            "                                     one of these, a file with one level per line or the\n"
+            "                                     levels separated by ';', e.g. \"l1 size=32K assoc=8;\n"
+            "                                     l2 size=1M assoc=16 latency=14 inclusion=exclusive;\n"
+            "                                     memory latency=80\" (keys: size, latency,\n"
+            "                                     assoc=1-64|full (full: up to 64 lines),\n"
+            "                                     inclusion=inclusive|non-inclusive|exclusive,\n"
+            "                                     write=back|through,\n"
+            "                                     policy=lru|plru|srrip|brrip|drrip|random;\n"
+            "                                     l1i and l1d split the L1):\n";
+    Memory::listCacheConfigs(cout);
+    cout << "--mshrs <n>                          Miss status holding registers per cache level at -O2\n"
+            "                                     and up (1-" << MAX_MSHRS << ", default " << DEFAULT_MSHRS << ")\n"
+            "--prefetch <kind>                    L1 prefetcher from -O1 up: " << prefetcher_kinds << "\n"
+            "                                     (default none)\n"
+            "--l2-prefetch <kind>                 Prefetcher of the first level below L1, trained on the\n"
+            "                                     L1 misses (default none)\n"
+            "--branch-predictor <kind>            Branch predictor of the pipelined core, with a BTB:\n"
+            "                                     " << branch_predictor_kinds << " (default not-taken)\n"
+            "--width <n>                          Instructions the pipelined core fetches, issues and\n"
+            "                                     retires per cycle, in order: 1, 2 or 4 (default 1);\n"
+            "                                     at -O3 and up the out-of-order core's width\n"
+            "--rob <n>                            Reorder buffer entries at -O3 and up (1-" << MAX_ROB_SIZE << ", default " << DEFAULT_ROB_SIZE << ")\n"
+            "--iq <n>                             Issue queue entries at -O3 and up (1-" << MAX_ROB_SIZE << ", default " << DEFAULT_IQ_SIZE << ")\n"
+            "--print-cycles                       Print the register file after every cycle\n"
+            "                                     (otherwise only after the last one)\n"
             "-O0                                  Optimization Level 0 (single-cycle processor)\n"
             "-O1                                  Optimization Level 1 (pipelined processor)\n"
-            "-O2                                  Optimization Level 2 (custom optimization TBD; includes O1)\n"
-            "-O3                                  Optimization Level 3 (custom optimization TBD; includes O2)\n"
-            "-O4                                  Optimization Level 4 (custom optimization TBD; includes O3)\n"
+            "-O2                                  Optimization Level 2 (lockup-free caches; includes O1)\n"
+            "-O3                                  Optimization Level 3 (out-of-order core with register\n"
+            "                                     renaming; lockup-free caches as at O2)\n"
+            "-O4                                  Optimization Level 4 (O3 with loads issuing ahead of\n"
+            "                                     older stores whose address is not known yet)\n"
             "                                     Defaults to -O0\n";
 }
 
@@ -91,19 +193,69 @@ int main(int argc, char *argv[]) {
       {"opt2", optional_argument, 0, '2'},
       {"opt3", optional_argument, 0, '3'},
       {"opt4", optional_argument, 0, '4'},
+      {"fast", no_argument, 0, 'f'},
+      {"jit", no_argument, 0, 'j'},
+      {"trace", required_argument, 0, 't'},
+      {"trace-level", required_argument, 0, 'l'},
+      {"trace-compress", no_argument, 0, 'z'},
+      {"print-cycles", no_argument, 0, 'p'},
+      {"checkpoint", required_argument, 0, 'c'},
+      {"checkpoint-at", required_argument, 0, 'a'},
+      {"restore", required_argument, 0, 'r'},
+      {"sample", no_argument, 0, 's'},
+      {"interval", required_argument, 0, 'i'},
+      {"warmup", required_argument, 0, 'w'},
+      {"max-k", required_argument, 0, 'k'},
+      {"batch", required_argument, 0, 'm'},
+      {"threads", required_argument, 0, 'n'},
+      {"stack-profile", no_argument, 0, 'S'},
+      {"stats", required_argument, 0, 'o'},
+      {"stats-format", required_argument, 0, 'F'},
+      {"stats-interval", required_argument, 0, 'N'},
+      {"caches", required_argument, 0, 'C'},
+      {"mshrs", required_argument, 0, 'M'},
+      {"prefetch", required_argument, 0, 'P'},
+      {"l2-prefetch", required_argument, 0, 'Q'},
+      {"branch-predictor", required_argument, 0, 'B'},
+      {"width", required_argument, 0, 'W'},
+      {"rob", required_argument, 0, 'R'},
+      {"iq", required_argument, 0, 'I'},
       {"help", no_argument, 0, 'h'}
     };
     int option_index = 0;
     bool initialized = false;
+    bool fast = false;
+    bool print_cycles = false;
+    char *trace_path = 0;
+    trace_level trace_lvl = TRACE_COMMIT;
+    bool trace_compress = false;
+    char *checkpoint_path = 0;
+    uint64_t checkpoint_cycle = 0;
+    char *restore_path = 0;
+    bool level_given = false;
+    bool sample = false;
+    sampler_config sample_cfg = { .interval = 100000, .warmup = 100000, .max_k = 10 };
+    char *batch_path = 0;
+    int threads = std::thread::hardware_concurrency();
+    bool stack_profile = false;
+    char *stats_path = 0;
+    stats_format stats_fmt = STATS_JSON;
+    bool stats_fmt_given = false;
+    uint64_t stats_interval = 0;
+    int num_mshrs = DEFAULT_MSHRS;
+    bool branch_stats = false;
+    bool ipc_stats = false;
+    int rob_entries = DEFAULT_ROB_SIZE;
+    int iq_entries = DEFAULT_IQ_SIZE;
 
     Memory memory;
     Processor processor(&memory); 
-    uint32_t end_pc = 0;
+    uint32_t text_base = 0, end_pc = 0;
 
     int optLevel = 0;
 
     while (true) {
-      char c = getopt_long(argc, argv, "b:O01234h", long_options, &option_index);
+      char c = getopt_long(argc, argv, "b:O01234fjt:l:zpc:a:r:si:w:k:m:n:So:F:N:C:M:P:Q:B:W:R:I:h", long_options, &option_index);
       if (c == -1) {
           if (!initialized) {
               print_help();
@@ -116,11 +268,132 @@ int main(int argc, char *argv[]) {
           case 'h':
               print_help();
               exit(0);
-          case 'b':
-              end_pc = load(optarg, memory);
+          case 'b': {
+              uint32_t entry;
+              if (!load(optarg, memory, entry, text_base, end_pc)) {
+                  exit(1);
+              }
+              processor.set_entry(entry);
               break;
+          }
           case 'O':
               break;
+          case 'f':
+              fast = true;
+              break;
+          case 'j':
+              fast = true;
+              processor.enable_jit();
+              break;
+          case 't':
+              trace_path = optarg;
+              break;
+          case 'l':
+              if (!strcmp(optarg, "none")) trace_lvl = TRACE_NONE;
+              else if (!strcmp(optarg, "commit")) trace_lvl = TRACE_COMMIT;
+              else if (!strcmp(optarg, "delta")) trace_lvl = TRACE_DELTA;
+              else if (!strcmp(optarg, "full")) trace_lvl = TRACE_FULL;
+              else {
+                  cout << "Unknown trace level: " << optarg << "\n";
+                  exit(1);
+              }
+              break;
+          case 'z':
+              trace_compress = true;
+              break;
+          case 'p':
+              print_cycles = true;
+              break;
+          case 'c':
+              checkpoint_path = optarg;
+              break;
+          case 'a':
+              checkpoint_cycle = strtoull(optarg, 0, 0);
+              break;
+          case 's':
+              sample = true;
+              initialized = 1;
+              break;
+          case 'i':
+              sample_cfg.interval = strtoull(optarg, 0, 0);
+              break;
+          case 'w':
+              sample_cfg.warmup = strtoull(optarg, 0, 0);
+              break;
+          case 'k':
+              sample_cfg.max_k = atoi(optarg);
+              break;
+          case 'm':
+              batch_path = optarg;
+              initialized = 1;
+              break;
+          case 'n':
+              threads = atoi(optarg);
+              break;
+          case 'S':
+              stack_profile = true;
+              break;
+          case 'o':
+              stats_path = optarg;
+              break;
+          case 'F':
+              if (!parse_stats_format(optarg, stats_fmt)) {
+                  cout << "Unknown stats format: " << optarg << "\n";
+                  print_help();
+                  exit(1);
+              }
+              stats_fmt_given = true;
+              break;
+          case 'N':
+              stats_interval = strtoull(optarg, 0, 0);
+              break;
+          case 'M':
+              num_mshrs = atoi(optarg);
+              if (num_mshrs < 1 || num_mshrs > MAX_MSHRS) {
+                  cout << "--mshrs must be between 1 and " << MAX_MSHRS << "\n";
+                  exit(1);
+              }
+              break;
+          case 'P':
+          case 'Q':
+              if (!memory.setPrefetcher(c == 'P' ? 1 : 2, optarg)) {
+                  cout << "Unknown prefetcher: " << optarg << "\n";
+                  print_help();
+                  exit(1);
+              }
+              break;
+          case 'B':
+              if (!processor.set_branch_predictor(optarg)) {
+                  cout << "Unknown branch predictor: " << optarg << "\n";
+                  print_help();
+                  exit(1);
+              }
+              branch_stats = true;
+              break;
+          case 'W':
+              if (!processor.set_width(atoi(optarg))) {
+                  cout << "--width must be 1, 2 or 4\n";
+                  exit(1);
+              }
+              ipc_stats = true;
+              break;
+          case 'R':
+              rob_entries = atoi(optarg);
+              break;
+          case 'I':
+              iq_entries = atoi(optarg);
+              break;
+          case 'C':
+              if (!memory.setCacheConfig(optarg)) {
+                  cout << "Unknown or invalid cache configuration: " << optarg << "\n";
+                  print_help();
+                  exit(1);
+              }
+              break;
+          case 'r':
+              restore_path = optarg;
+              initialized = 1;
+              break;
           case '0':
           case '1':
           case '2':
@@ -129,18 +402,189 @@ int main(int argc, char *argv[]) {
               optLevel = c-'0';
               processor.initialize(optLevel);
               initialized = 1;
+              level_given = true;
               break;
       }
     }
 
-    memory.setOptLevel(optLevel);
+    if (batch_path) {
+        exit(run_batch(batch_path, threads) ? 0 : 1);
+    }
+
+    memory.setMSHRs(num_mshrs);
+    if (!processor.set_window(rob_entries, iq_entries)) {
+        cout << "--rob and --iq must be between 1 and " << MAX_ROB_SIZE << "\n";
+        exit(1);
+    }
+
     uint64_t num_cycles = 0;
+    if (restore_path) {
+        CheckpointReader ckpt;
+        if (!ckpt.open(restore_path)) {
+            exit(1);
+        }
+        if (!level_given) {
+            optLevel = ckpt.header().opt_level;
+        }
+        text_base = ckpt.header().text_base;
+        end_pc = ckpt.header().end_pc;
+        num_cycles = ckpt.header().cycle;
+        if (!processor.restore(ckpt, optLevel) || !memory.restore(ckpt)) {
+            cout << "Failed to restore checkpoint: " << restore_path << "\n";
+            exit(1);
+        }
+    }
+
+    //--sample fast-forwards between its samples at any level
+    if (fast && optLevel > 0 && !sample) {
+        cout << "--fast and --jit only apply to -O0 and --sample, running the -O" << optLevel << " simulation\n";
+    }
+
+    if (sample) {
+        if (restore_path || trace_path || checkpoint_path || print_cycles || stats_path) {
+            cout << "--sample can't be combined with --restore, --trace, --checkpoint, --print-cycles or --stats\n";
+            exit(1);
+        }
+        if (!sample_cfg.interval || sample_cfg.max_k < 1) {
+            cout << "--interval and --max-k must be positive\n";
+            exit(1);
+        }
+        if (optLevel == 0) {
+            optLevel = 1;
+        }
+        Sampler sampler(&processor, &memory, text_base, end_pc, sample_cfg);
+        if (!sampler.run(optLevel, num_cycles)) {
+            exit(1);
+        }
+    }
+
+    memory.setOptLevel(optLevel);
+    uint64_t first_cycle = num_cycles;
+
+    StackProfiler profiler;
+    if (stack_profile) {
+        if (sample || (fast && optLevel == 0)) {
+            cout << "--stack-profile needs the cycle-level simulation, not --fast, --jit or --sample\n";
+            exit(1);
+        }
+        memory.setProfiler(&profiler);
+    }
+
+    Tracer tracer;
+    if (trace_path && !tracer.open(trace_path, trace_lvl, trace_compress)) {
+        exit(1);
+    }
+    if (tracer.enabled()) {
+        processor.set_tracer(&tracer);
+    }
+
+    StatsRegistry stats;
+    if (stats_interval && !stats_path) {
+        cout << "--stats-interval needs --stats\n";
+        exit(1);
+    }
+    if (stats_path) {
+        size_t len = strlen(stats_path);
+        if (!stats_fmt_given && len >= 4 && !strcmp(stats_path + len - 4, ".csv")) {
+            stats_fmt = STATS_CSV;
+        }
+        if (!stats.open(stats_path, stats_fmt)) {
+            exit(1);
+        }
+        // a restored run only counts what it simulated itself, --fast runs one instruction a cycle
+        stats.add("cycles", [&] { return num_cycles - first_cycle; });
+        stats.add("instructions", [&] { return fast && optLevel == 0 ? num_cycles - first_cycle : processor.get_retired(); });
+        stats.addRatio("ipc", "instructions", "cycles");
+        processor.register_stats(stats);
+        memory.registerStats(stats);
+    }
+    uint64_t next_stats = stats_interval;
+
+    if (fast && optLevel == 0) {
+        if (tracer.enabled()) {
+            cout << "Tracing is not supported by --fast/--jit, the trace will be empty\n";
+        }
+        processor.load_program(text_base, end_pc);
+        if (checkpoint_path) {
+            num_cycles += processor.fast_forward(checkpoint_cycle > num_cycles ? checkpoint_cycle - num_cycles : 0);
+            if (processor.getPC() <= end_pc) {
+                save_checkpoint(checkpoint_path, processor, memory, optLevel, num_cycles, text_base, end_pc);
+                checkpoint_path = 0;
+            }
+        }
+        uint64_t chunk = stats_interval ? stats_interval : UINT64_MAX;
+        uint64_t n;
+        do {
+            n = processor.fast_forward(chunk);
+            num_cycles += n;
+            if (n == chunk && processor.getPC() <= end_pc) {
+                stats.write("interval");
+            }
+        } while (n == chunk && processor.getPC() <= end_pc);
+        next_stats = num_cycles - first_cycle + stats_interval;
+        DEBUG(processor.print_jit_stats());
+    }
 
     while (processor.getPC() <= end_pc) {
+        if (checkpoint_path && num_cycles >= checkpoint_cycle) {
+            save_checkpoint(checkpoint_path, processor, memory, optLevel, num_cycles, text_base, end_pc);
+            checkpoint_path = 0;
+        }
+        tracer.setCycle(num_cycles);
         processor.advance();
-        cout << "\nCYCLE " << num_cycles << "\n";
-        processor.printRegFile();
+        if (print_cycles) {
+            cout << "\nCYCLE " << num_cycles << "\n";
+            processor.printRegFile();
+        }
+        if (tracer.enabled()) {
+            tracer.endCycle(processor.getPC(), processor.get_regs());
+        }
         num_cycles++;
+        //--print-cycles prints every cycle, the idle ones too
+        if (!print_cycles) {
+            num_cycles += processor.skip_idle_cycles();
+        }
+        if (stats_interval && num_cycles - first_cycle >= next_stats) {
+            stats.write("interval");
+            next_stats = (num_cycles - first_cycle) / stats_interval * stats_interval + stats_interval;
+        }
+    }
+    tracer.close();
+    stats.write("final");
+    stats.close();
+    if (checkpoint_path) {
+        cout << "Program finished before cycle " << checkpoint_cycle << ", no checkpoint written\n";
+    }
+
+    if (!print_cycles) {
+        // the last cycle that ran, or the initial state if the program ended before the first
+        cout << "\nCYCLE " << (num_cycles ? num_cycles-1 : 0) << "\n";
+        processor.printRegFile();
+    }
+
+    if (stack_profile) {
+        profiler.print(cout);
+    }
+
+    if (optLevel >= 2 && !sample) {
+        memory.printMSHRStats(cout);
+    }
+
+    if (optLevel >= 3 && !sample) {
+        processor.print_ooo_stats(cout);
+    }
+
+    if (optLevel >= 1 && !sample) {
+        memory.printPrefetchStats(cout);
+        if (branch_stats) {
+            processor.print_branch_stats();
+        }
+        if (ipc_stats) {
+            // a restored run only counts what it simulated itself
+            uint64_t cycles = num_cycles - first_cycle;
+            cout << "Retired " << processor.get_retired() << " instructions in " << cycles << " cycles, IPC "
+                 << (cycles ? (double)processor.get_retired() / cycles : 0.0) << "\n";
+        }
     }
 
     cout << "\nCompleted execution in " << (double)num_cycles*(optLevel ? 1 : 125)*0.5 << " nanoseconds.\n";
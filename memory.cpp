@@ -2,7 +2,19 @@
 #include <cstdint>
 #include <iostream>
 #include <cmath>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <fstream>
+#include <sstream>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include "memory.h"
+#include "stackdist.h"
 
 #ifdef ENABLE_DEBUG
 #define DEBUG(x) x
@@ -12,77 +24,107 @@
 
 using namespace std;
 
-// Check if hit in the cache
-bool Cache::isHit(uint32_t address, uint32_t &loc) {
-    int idx = getIndex(address);
-    int tag = getTag(address);
-
-    for (int w=0; w<assoc; w++) {
-        if (line[idx*assoc+w].valid && line[idx*assoc+w].tag == tag) {
-            loc = idx*assoc+w;
-            updateReplacementBits(idx, w);
-            return true;
-        }
+// Bit w set if way w of set idx holds a valid line with this tag.
+// Compares 4 packed tags per SSE2 instruction.
+template <int Assoc, int LineBytes, class Policy>
+uint64_t Cache<Assoc, LineBytes, Policy>::matchWays(int idx, uint32_t tag) {
+    const uint32_t *t = &tags[idx*ways()];
+    uint64_t match = 0;
+    int w = 0;
+#if defined(__SSE2__)
+    __m128i key4 = _mm_set1_epi32(tag);
+    for (; w + 4 <= ways(); w += 4) {
+        __m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)(t + w)), key4);
+        match |= (uint64_t)_mm_movemask_ps(_mm_castsi128_ps(eq)) << w;
     }
-    return false;
+#endif
+    for (; w < ways(); w++) {
+        match |= (uint64_t)(t[w] == tag) << w;
+    }
+    return match & validMask[idx];
+}
+
+// Copy a line out into the exchange format
+template <int Assoc, int LineBytes, class Policy>
+CacheLine Cache<Assoc, LineBytes, Policy>::getLine(int loc) {
+    CacheLine c;
+    int idx = loc/ways();
+    int way = loc%ways();
+    memcpy(c.data, &data[loc*Words], LineBytes);
+    c.address = lineAddress(loc);
+    c.tag = tags[loc];
+    c.valid = (validMask[idx] >> way) & 1;
+    c.dirty = (dirtyMask[idx] >> way) & 1;
+    c.prefetched = (prefetchMask[idx] >> way) & 1;
+    c.replBits = repl[loc];
+    return c;
 }
 
-// Update replacement bits after access
-void Cache::updateReplacementBits(int idx, int way) {
-    uint8_t curRepl = line[idx*assoc+way].replBits;
-    for (int w=0; w<assoc; w++) {
-        if (line[idx*assoc+w].valid && line[idx*assoc+w].replBits > curRepl)
-            line[idx*assoc+w].replBits--;
+// Check if hit in the cache
+template <int Assoc, int LineBytes, class Policy>
+bool Cache<Assoc, LineBytes, Policy>::isHit(uint32_t address, uint32_t &loc) {
+    int idx = getIndex(address);
+    uint64_t match = matchWays(idx, getTag(address));
+    if (!match) {
+        return false;
+    }
+    int w = __builtin_ctzll(match);
+    loc = idx*ways()+w;
+    policy.touch(&repl[idx*ways()], validMask[idx], w, ways());
+    lastHitPrefetched = (prefetchMask[idx] >> w) & 1;
+    if (lastHitPrefetched) {
+        prefetchMask[idx] &= ~(1ull << w);
+        prefetchUseful++;
     }
-    line[idx*assoc+way].replBits = assoc-1;
+    return true;
 }
 
 // Read a word from this cache
-bool Cache::read(uint32_t address, uint32_t &read_data) {
+template <int Assoc, int LineBytes, class Policy>
+bool Cache<Assoc, LineBytes, Policy>::read(uint32_t address, uint32_t &read_data, int port) {
     uint32_t loc = 0;
-    if (missCountdown) {
-        DEBUG(cout << name + " Cache (read miss) at address " << std::hex << address << std::dec << ": " << missCountdown << " cycles remaining to be serviced\n");
-        missCountdown--;
+    if (missCountdown[port]) {
+        DEBUG(cout << name + " Cache (read miss) at address " << std::hex << address << std::dec << ": " << missCountdown[port] << " cycles remaining to be serviced\n");
+        missCountdown[port]--;
         return false;
     }
     // Once miss penalty is completely paid, isHit should return true
     if (!isHit(address, loc)) {
-        missCountdown = missPenalty-1;
+        missCountdown[port] = missPenalty-1;
         return false;
     }
-    read_data = line[loc].data[getOffset(address)/4]; 
+    read_data = data[loc*Words + getOffset(address)/4];
     DEBUG(cout << name + " Cache (read hit): " << read_data << "<-[" << std::hex << address << std::dec << "]\n");
     return true;
 }
 
 // Write a word to this cache
-bool Cache::write(uint32_t address, uint32_t write_data) {
+template <int Assoc, int LineBytes, class Policy>
+bool Cache<Assoc, LineBytes, Policy>::write(uint32_t address, uint32_t write_data, int port) {
     uint32_t loc = 0;
-    if (missCountdown) {
-        DEBUG(cout << name + " Cache (write miss) at address " << std::hex << address << std::dec << ": " << missCountdown << " cycles remaining to be serviced\n");
-        missCountdown--;
+    if (missCountdown[port]) {
+        DEBUG(cout << name + " Cache (write miss) at address " << std::hex << address << std::dec << ": " << missCountdown[port] << " cycles remaining to be serviced\n");
+        missCountdown[port]--;
         return false;
     }
     // Once miss penalty is completely paid, isHit should return true
     if (!isHit(address, loc)) {
-        missCountdown = missPenalty-1;
+        missCountdown[port] = missPenalty-1;
         return false;
     }
-    line[loc].data[getOffset(address)/4] = write_data;
-    line[loc].dirty = true; 
+    data[loc*Words + getOffset(address)/4] = write_data;
+    dirtyMask[loc/ways()] |= (uint64_t)!writeThrough << (loc%ways());
     DEBUG(cout << name + " Cache (write hit): [" << std::hex << address << std::dec << "]<-" << write_data << "\n");
     return true;
 }
 
 // Call this only if you know that a valid line with matching tag exists at that address 
-CacheLine Cache::readLine(uint32_t address) {
+template <int Assoc, int LineBytes, class Policy>
+CacheLine Cache<Assoc, LineBytes, Policy>::readLine(uint32_t address) {
     int idx = getIndex(address);
-    int tag = getTag(address);
-
-    for (int w=0; w<assoc; w++) {
-        if (line[idx*assoc+w].valid && line[idx*assoc+w].tag == tag) {
-            return line[idx*assoc+w];
-        }
+    uint64_t match = matchWays(idx, getTag(address));
+    if (match) {
+        return getLine(idx*ways() + __builtin_ctzll(match));
     }
     CacheLine c;
     c.valid = false;
@@ -90,57 +132,813 @@ CacheLine Cache::readLine(uint32_t address) {
 }
 
 // Call this only if you know that a valid line with matching tag exists at that address 
-void Cache::writeBackLine(CacheLine evictedLine) {
+template <int Assoc, int LineBytes, class Policy>
+void Cache<Assoc, LineBytes, Policy>::writeBackLine(CacheLine evictedLine) {
     int idx = getIndex(evictedLine.address);
-    int tag = getTag(evictedLine.address);
-
-    for (int w=0; w<assoc; w++) {
-        if (line[idx*assoc+w].valid && line[idx*assoc+w].tag == tag) {
-            for (int i = 0; i < CACHE_LINE_SIZE/4; i++) {
-                line[idx*assoc+w].data[i] = evictedLine.data[i];
-            }
-            line[idx*assoc+w].dirty = true;
-        }
+    uint64_t match = matchWays(idx, getTag(evictedLine.address));
+    if (match) {
+        int w = __builtin_ctzll(match);
+        memcpy(&data[(idx*ways()+w)*Words], evictedLine.data, LineBytes);
+        dirtyMask[idx] |= (uint64_t)!writeThrough << w;
     }
 }
 
 // Replace a line at the set corresponding this address
-void Cache::replace(uint32_t address, CacheLine newLine, CacheLine &evictedLine) {
+template <int Assoc, int LineBytes, class Policy>
+void Cache<Assoc, LineBytes, Policy>::replace(uint32_t address, CacheLine newLine, CacheLine &evictedLine) {
     int idx = getIndex(address);
-    newLine.address = address;
-    newLine.tag = getTag(address);
-    newLine.valid = true;
-   
+    uint32_t tag = getTag(address);
+
     /* Return if replacement already completed. */ 
-    for (int w=0; w<assoc; w++) {
-        if (line[idx*assoc+w].valid && line[idx*assoc+w].tag == newLine.tag) {
-            return;
-        }
+    if (matchWays(idx, tag)) {
+        return;
     }
-    /* Replace. */ 
-    for (int w=0; w<assoc; w++) {
-        if (!line[idx*assoc+w].valid || line[idx*assoc+w].replBits == 0) {
-            DEBUG(cout << name + " Cache: replacing line at idx:" << idx << " way:" << w << " due to conflicting address:" << std::hex << address << std::dec << "\n");
-            evictedLine = line[idx*assoc+w];
-            line[idx*assoc+w] = newLine;
-            return;
-        }
+    /* Replace: an invalid way if there is one, else the policy's victim. */ 
+    uint64_t valid = validMask[idx];
+    uint64_t invalid = ~valid & wayMask();
+    int w = invalid ? __builtin_ctzll(invalid) : policy.victim(&repl[idx*ways()], ways());
+    int loc = idx*ways()+w;
+    DEBUG(cout << name + " Cache: replacing line at idx:" << idx << " way:" << w << " due to conflicting address:" << std::hex << address << std::dec << "\n");
+    if ((valid >> w) & 1) {
+        evictedLine = getLine(loc);
+        prefetchUseless += evictedLine.prefetched;
+    } else {
+        evictedLine.valid = false;
     }
+    tags[loc] = tag;
+    memcpy(&data[loc*Words], newLine.data, LineBytes);
+    validMask[idx] |= 1ull << w;
+    dirtyMask[idx] = (dirtyMask[idx] & ~(1ull << w)) | ((uint64_t)(newLine.dirty && !writeThrough) << w);
+    prefetchMask[idx] = (prefetchMask[idx] & ~(1ull << w)) | ((uint64_t)newLine.prefetched << w);
+    policy.insert(&repl[idx*ways()], validMask[idx], w, ways(), idx, sets);
 }
 
 // Invalidate a line
-void Cache::invalidateLine(uint32_t address) {
+template <int Assoc, int LineBytes, class Policy>
+void Cache<Assoc, LineBytes, Policy>::invalidateLine(uint32_t address) {
     int idx = getIndex(address);
-    int tag = getTag(address);
+    uint64_t match = matchWays(idx, getTag(address));
+    prefetchUseless += (prefetchMask[idx] & match) != 0;
+    prefetchMask[idx] &= ~match;
+    validMask[idx] &= ~match;
+}
+
+// Check if a valid line holds this address, without touching replacement bits
+template <int Assoc, int LineBytes, class Policy>
+bool Cache<Assoc, LineBytes, Policy>::contains(uint32_t address) {
+    return matchWays(getIndex(address), getTag(address)) != 0;
+}
+
+// Check if the line holding this address is the most recently used in its set
+template <int Assoc, int LineBytes, class Policy>
+bool Cache<Assoc, LineBytes, Policy>::isMRU(uint32_t address) {
+    int idx = getIndex(address);
+    uint64_t match = matchWays(idx, getTag(address));
+    return match && policy.isMRU(&repl[idx*ways()], __builtin_ctzll(match), ways());
+}
+
+// Reload the data of every valid line from mem and mark it clean
+template <int Assoc, int LineBytes, class Policy>
+void Cache<Assoc, LineBytes, Policy>::reload(const uint32_t *mem) {
+    for (int loc = 0; loc < sets*ways(); loc++) {
+        if ((validMask[loc/ways()] >> (loc%ways())) & 1) {
+            memcpy(&data[loc*Words], &mem[lineAddress(loc)/4], LineBytes);
+        }
+    }
+    std::fill(dirtyMask.begin(), dirtyMask.end(), 0);
+    memset(missCountdown, 0, sizeof(missCountdown));
+    mshrs.clear();
+}
+
+// Checkpointing: geometry and replacement policy, miss state and every line including
+// its metadata
+template <int Assoc, int LineBytes, class Policy>
+void Cache<Assoc, LineBytes, Policy>::save(CheckpointWriter &ckpt) {
+    int size = getSize(), assoc = ways();
+    char pol[8] = {};
+    strncpy(pol, Policy::name(), sizeof(pol) - 1);
+    ckpt.put(&size, sizeof(size));
+    ckpt.put(&assoc, sizeof(assoc));
+    ckpt.put(pol, sizeof(pol));
+    ckpt.put(&policy, sizeof(policy));
+    ckpt.put(&missPenalty, sizeof(missPenalty));
+    ckpt.put(missCountdown, sizeof(missCountdown));
+    ckpt.put(tags.data(), tags.size()*sizeof(tags[0]));
+    ckpt.put(validMask.data(), sets*sizeof(uint64_t));
+    ckpt.put(dirtyMask.data(), sets*sizeof(uint64_t));
+    ckpt.put(prefetchMask.data(), sets*sizeof(uint64_t));
+    ckpt.put(repl.data(), repl.size());
+    ckpt.put(data.data(), data.size()*sizeof(data[0]));
+}
+
+template <int Assoc, int LineBytes, class Policy>
+bool Cache<Assoc, LineBytes, Policy>::restore(CheckpointReader &ckpt) {
+    int sz, asc;
+    char pol[8];
+    if (!ckpt.get(&sz, sizeof(sz)) || !ckpt.get(&asc, sizeof(asc)) || !ckpt.get(pol, sizeof(pol))) {
+        return false;
+    }
+    pol[sizeof(pol) - 1] = 0;
+    if (sz != getSize() || asc != ways() || strcmp(pol, Policy::name())) {
+        cout << name + " Cache: checkpoint has a " << sz << "B " << asc << "-way " << pol << " cache, this one is "
+             << getSize() << "B " << ways() << "-way " << Policy::name() << "\n";
+        return false;
+    }
+    return ckpt.get(&policy, sizeof(policy)) &&
+           ckpt.get(&missPenalty, sizeof(missPenalty)) &&
+           ckpt.get(missCountdown, sizeof(missCountdown)) &&
+           ckpt.get(tags.data(), tags.size()*sizeof(tags[0])) &&
+           ckpt.get(validMask.data(), sets*sizeof(uint64_t)) &&
+           ckpt.get(dirtyMask.data(), sets*sizeof(uint64_t)) &&
+           ckpt.get(prefetchMask.data(), sets*sizeof(uint64_t)) &&
+           ckpt.get(repl.data(), repl.size()) &&
+           ckpt.get(data.data(), data.size()*sizeof(data[0]));
+}
+
+// Print a cache line
+template <int Assoc, int LineBytes, class Policy>
+void Cache<Assoc, LineBytes, Policy>::printLine(uint32_t address) {
+    int idx = getIndex(address);
+    uint64_t match = matchWays(idx, getTag(address));
+    if (!match) {
+        return;
+    }
+    int loc = idx*ways() + __builtin_ctzll(match);
+    std::cout<< "Valid:" << 1 << "\n";
+    std::cout<< "Address:" << lineAddress(loc) << "\n";
+    std::cout<< "Tag:" << tags[loc] << "\n";
+    std::cout<< "Dirty:" << ((dirtyMask[idx] >> (loc%ways())) & 1) << "\n";
+    std::cout<< "Replacement Bits:" << (int)repl[loc] << "\n";
+    for (int i = 0; i < Words; i++) {
+        std::cout<< "DATA[" << i << "]: " << data[loc*Words+i] << "\n";
+    }
+}
+
+// Lockup-free access: read or write the word if the line is here
+template <int Assoc, int LineBytes, class Policy>
+bool Cache<Assoc, LineBytes, Policy>::probe(uint32_t address, uint32_t &read_data, uint32_t write_data, bool mem_read, bool mem_write) {
+    uint32_t loc;
+    if (!isHit(address, loc)) {
+        return false;
+    }
+    uint32_t &word = data[loc*Words + getOffset(address)/4];
+    if (mem_read) {
+        read_data = word;
+    }
+    if (mem_write) {
+        word = write_data;
+        dirtyMask[loc/ways()] |= (uint64_t)!writeThrough << (loc%ways());
+    }
+    return true;
+}
+
+template <int Assoc, int LineBytes, class Policy>
+bool Cache<Assoc, LineBytes, Policy>::claimPrefetch(uint32_t address) {
+    int idx = getIndex(address);
+    uint64_t match = matchWays(idx, getTag(address)) & prefetchMask[idx];
+    lastHitPrefetched = match != 0;
+    if (match) {
+        prefetchMask[idx] &= ~match;
+        prefetchUseful++;
+    }
+    return lastHitPrefetched;
+}
+
+// Track a miss: a new fill, or a merge into the fill of the same line. A
+// demand miss that finds a prefetch in flight turns it into a late prefetch.
+void CacheBase::allocateMSHR(uint32_t line, int &countdown, bool fetch, bool prefetch) {
+    MSHR *m = findMSHR(line);
+    if (m) {
+        if (prefetch) {
+            // the line is on its way already
+        } else if (!m->demanded) {
+            demandPrefetch(m);
+        } else if (!(fetch && m->fetched)) {
+            mergedMisses++;
+        }
+        m->fetched |= fetch;
+        countdown = m->countdown;
+        return;
+    }
+    MSHR n;
+    n.line = line;
+    n.countdown = countdown;
+    n.fetched = fetch;
+    n.prefetch = prefetch;
+    n.demanded = !prefetch;
+    mshrs.push_back(n);
+    if (prefetch) {
+        prefetchIssued++;
+    } else {
+        demandMisses++;
+    }
+}
+
+// Count down every fill by one cycle, the fills that arrive are appended to done
+void CacheBase::tickMSHRs(std::vector<MSHR> &done) {
+    if (mshrs.empty()) {
+        return;
+    }
+    busyCycles++;
+    fillCycles += mshrs.size();
+    size_t kept = 0;
+    for (size_t i = 0; i < mshrs.size(); i++) {
+        if (--mshrs[i].countdown <= 0) {
+            done.push_back(mshrs[i]);
+        } else {
+            mshrs[kept++] = mshrs[i];
+        }
+    }
+    mshrs.resize(kept);
+}
+
+void CacheBase::saveMSHRs(CheckpointWriter &ckpt) {
+    int n = mshrs.size();
+    ckpt.put(&n, sizeof(n));
+    ckpt.put(mshrs.data(), n*sizeof(MSHR));
+}
+
+bool CacheBase::restoreMSHRs(CheckpointReader &ckpt) {
+    int n;
+    if (!ckpt.get(&n, sizeof(n)) || n < 0 || n > MAX_MSHRS) {
+        return false;
+    }
+    mshrs.resize(n);
+    return ckpt.get(mshrs.data(), n*sizeof(MSHR));
+}
+
+// The caches are looked up when a record is written, setCacheConfig() and restore() replace them
+void Memory::registerStats(StatsRegistry &stats) {
+    // L1I, L1D, then the shared levels, named after the cache in lower case
+    for (int level = -1; level < (int)shared.size() + 1; level++) {
+        std::string prefix = level < 1 ? (level ? "l1i." : "l1d.") : "";
+        if (level > 0) {
+            const std::string &name = shared[level-1]->getName();
+            for (size_t i = 0; i < name.size(); i++)
+                prefix += tolower(name[i]);
+            prefix += ".";
+        }
+        auto cache = [this, level] { return level < 1 ? l1(level < 0) : shared[level-1]; };
+        stats.add(prefix + "hits", [cache] { return cache()->getHits(); });
+        stats.add(prefix + "misses", [cache] { return cache()->getMisses(); });
+        stats.add(prefix + "writebacks", [cache] { return cache()->getWritebacks(); });
+        stats.addRatio(prefix + "mpki", prefix + "misses", "instructions", 1000);
+    }
+}
+
+void CacheBase::printMSHRStats(std::ostream &out) {
+    out << name << ": " << demandMisses << " misses, " << mergedMisses << " merged, "
+        << blockedMisses << " turned away by full MSHRs (" << maxMSHRs << "), " << hitsUnderMiss
+        << " hits under miss, " << (busyCycles ? (double)fillCycles / busyCycles : 0.0)
+        << " fills in flight on average\n";
+}
+
+void CacheBase::printPrefetchStats(std::ostream &out, const char *kind) {
+    uint64_t used = prefetchUseful + prefetchLate;
+    out << name << " " << kind << " prefetcher: " << prefetchIssued << " issued, " << prefetchUseful
+        << " useful, " << prefetchLate << " late, " << prefetchUseless << " evicted unused\n";
+    out << "  accuracy " << (prefetchIssued ? (double)used / prefetchIssued : 0.0)
+        << ", coverage " << (used + demandMisses ? (double)used / (used + demandMisses) : 0.0)
+        << ", timeliness " << (used ? (double)prefetchUseful / used : 0.0) << "\n";
+}
+
+// The usual associativities get their own Cache instantiation with each replacement
+// policy, any other one up to 64 the instantiation that takes it at run time
+template <class Policy>
+static CacheBase *make_cache_ways(int assoc, const std::string &name, int penalty, int size) {
+    switch (assoc) {
+        case 1: return new Cache<1, CACHE_LINE_SIZE, Policy>(name, penalty, size);
+        case 2: return new Cache<2, CACHE_LINE_SIZE, Policy>(name, penalty, size);
+        case 4: return new Cache<4, CACHE_LINE_SIZE, Policy>(name, penalty, size);
+        case 8: return new Cache<8, CACHE_LINE_SIZE, Policy>(name, penalty, size);
+        case 12: return new Cache<12, CACHE_LINE_SIZE, Policy>(name, penalty, size);
+        case 16: return new Cache<16, CACHE_LINE_SIZE, Policy>(name, penalty, size);
+        case 20: return new Cache<20, CACHE_LINE_SIZE, Policy>(name, penalty, size);
+        case 32: return new Cache<32, CACHE_LINE_SIZE, Policy>(name, penalty, size);
+        case 64: return new Cache<64, CACHE_LINE_SIZE, Policy>(name, penalty, size);
+    }
+    return new Cache<0, CACHE_LINE_SIZE, Policy>(name, penalty, size, assoc);
+}
+
+// The replacement policies a level can have (see memory.h), the first one is the default
+static const struct {
+    const char *name;
+    CacheBase *(*make)(int, const std::string &, int, int);
+} cache_policies[] = {
+    {LRUPolicy::name(), make_cache_ways<LRUPolicy>},
+    {TreePLRUPolicy::name(), make_cache_ways<TreePLRUPolicy>},
+    {SRRIPPolicy::name(), make_cache_ways<SRRIPPolicy>},
+    {BRRIPPolicy::name(), make_cache_ways<BRRIPPolicy>},
+    {DRRIPPolicy::name(), make_cache_ways<DRRIPPolicy>},
+    {RandomPolicy::name(), make_cache_ways<RandomPolicy>},
+};
+
+// One level of a hierarchy as setCacheConfig() reads it
+struct cache_level_config {
+    std::string name;
+    int size;
+    int assoc;                      // 0: fully associative, -1 until given
+    int latency;
+    cache_inclusion inclusion;
+    bool write_through;
+    int policy;                     // in cache_policies[]
+};
+
+// The number of ways of a level, 0 (and why, on out) if there is no such geometry
+static int level_ways(const cache_level_config &c, std::ostream &out) {
+    int assoc = c.assoc ? c.assoc : c.size / CACHE_LINE_SIZE;
+    int sets = assoc ? c.size / CACHE_LINE_SIZE / assoc : 0;
+    if (c.size <= 0 || !assoc || c.size % (CACHE_LINE_SIZE*assoc) || (sets & (sets-1))) {
+        out << c.name << ": " << c.size << " bytes is not a power-of-two number of sets of "
+            << assoc << " " << CACHE_LINE_SIZE << "-byte lines\n";
+        return 0;
+    }
+    if (assoc > 64) {
+        out << c.name << ": " << assoc << " ways, a set has at most 64 (a fully associative level at most "
+            << 64*CACHE_LINE_SIZE << " bytes)\n";
+        return 0;
+    }
+    return assoc;
+}
+
+// A cache for one level, 0 (and why, on out) if there is no such geometry
+static CacheBase *make_cache(const cache_level_config &c, const std::string &name, int penalty, std::ostream &out) {
+    int assoc = level_ways(c, out);
+    if (!assoc)
+        return 0;
+    CacheBase *cache = cache_policies[c.policy].make(assoc, name, penalty, c.size);
+    cache->setInclusion(c.inclusion);
+    cache->setWriteThrough(c.write_through);
+    return cache;
+}
+
+// A size with an optional K, M or G suffix
+static bool parse_size(const std::string &s, int &bytes) {
+    char *end;
+    unsigned long long n = strtoull(s.c_str(), &end, 10);
+    int shift = 0;
+    switch (toupper(*end)) {
+        case 'K': shift = 10; end++; break;
+        case 'M': shift = 20; end++; break;
+        case 'G': shift = 30; end++; break;
+    }
+    if (toupper(*end) == 'B')
+        end++;
+    if (end == s.c_str() || *end || (n << shift) > (1u << 31) - 1)
+        return false;
+    bytes = n << shift;
+    return true;
+}
+
+// The levels of a hierarchy spec (see setCacheConfig()) and the memory latency, false
+// (and why, on out) if it is not valid
+static bool parse_hierarchy(const std::string &spec, std::vector<cache_level_config> &levels, int &mem_latency, std::ostream &out) {
+    levels.clear();
+    mem_latency = 0;
+    std::istringstream lines(spec);
+    std::string line;
+    while (getline(lines, line)) {
+        std::istringstream entries(line.substr(0, line.find('#')));
+        std::string entry;
+        while (getline(entries, entry, ';')) {
+            std::istringstream words(entry);
+            cache_level_config c;
+            if (!(words >> c.name))
+                continue;
+            if (mem_latency) {
+                out << c.name << ": memory has to be the last level\n";
+                return false;
+            }
+            c.size = c.latency = 0;
+            c.assoc = -1;
+            c.inclusion = INCLUSIVE;
+            c.write_through = false;
+            c.policy = 0;
+            bool memory = c.name == "memory";
+            std::string opt;
+            while (words >> opt) {
+                size_t eq = opt.find('=');
+                std::string key = opt.substr(0, eq), value = eq == std::string::npos ? "" : opt.substr(eq + 1);
+                int n = atoi(value.c_str());
+                bool ok = true;
+                if (key == "latency" && n > 0)
+                    c.latency = n;
+                else if (memory)
+                    ok = false;
+                else if (key == "size")
+                    ok = parse_size(value, c.size);
+                else if (key == "assoc" && (value == "full" || n > 0))
+                    c.assoc = n;            // 0 for full
+                else if (key == "inclusion" && value == "inclusive")
+                    c.inclusion = INCLUSIVE;
+                else if (key == "inclusion" && value == "non-inclusive")
+                    c.inclusion = NON_INCLUSIVE;
+                else if (key == "inclusion" && value == "exclusive")
+                    c.inclusion = EXCLUSIVE;
+                else if (key == "write" && (value == "back" || value == "through"))
+                    c.write_through = value == "through";
+                else if (key == "policy") {
+                    size_t i = 0;
+                    while (i < sizeof(cache_policies)/sizeof(cache_policies[0]) && value != cache_policies[i].name)
+                        i++;
+                    ok = i < sizeof(cache_policies)/sizeof(cache_policies[0]);
+                    c.policy = i;
+                } else
+                    ok = false;
+                if (!ok) {
+                    out << c.name << ": bad option " << opt << "\n";
+                    return false;
+                }
+            }
+            if (memory) {
+                mem_latency = c.latency;
+                if (!mem_latency) {
+                    out << "memory: needs a latency\n";
+                    return false;
+                }
+                continue;
+            }
+            // l1, or l1i and l1d, then the shared levels
+            bool is_l1 = c.name == "l1" || c.name == "l1i" || c.name == "l1d";
+            bool want_l1d = levels.size() == 1 && levels[0].name == "l1i";
+            if (levels.empty() ? c.name != "l1" && c.name != "l1i" : want_l1d ? c.name != "l1d" : is_l1) {
+                out << c.name << ": the hierarchy starts with l1, or l1i and l1d\n";
+                return false;
+            }
+            if (!c.size || c.assoc < 0) {
+                out << c.name << ": needs a size and an assoc\n";
+                return false;
+            }
+            if (is_l1 && (c.latency || c.inclusion != INCLUSIVE)) {
+                out << c.name << ": an L1 has no latency or inclusion, its hits are part of the MEM stage\n";
+                return false;
+            }
+            if (!is_l1 && !c.latency) {
+                out << c.name << ": needs a latency\n";
+                return false;
+            }
+            levels.push_back(c);
+        }
+    }
+    if (levels.empty() || levels.back().name == "l1i" || !mem_latency) {
+        out << "a hierarchy is l1 (or l1i and l1d), any shared levels and memory latency=<cycles>\n";
+        return false;
+    }
+    return true;
+}
+
+// The compiled-in hierarchies, in the syntax of setCacheConfig(). The first one is the default.
+static const struct {
+    const char *name;
+    const char *description;
+    const char *levels;
+} cache_configs[] = {
+    {"default", "32KB 8-way L1I and L1D, 256KB 8-way L2",
+     "l1 size=32K assoc=8; l2 size=256K assoc=8 latency=12; memory latency=59"},
+    {"small", "16KB 4-way L1I and L1D, 128KB 8-way L2",
+     "l1 size=16K assoc=4; l2 size=128K assoc=8 latency=12; memory latency=59"},
+    {"large", "64KB 8-way L1I and L1D, 1MB 16-way L2",
+     "l1 size=64K assoc=8; l2 size=1M assoc=16 latency=12; memory latency=59"},
+    {"direct", "32KB direct-mapped L1I and L1D, 256KB 4-way L2",
+     "l1 size=32K assoc=1; l2 size=256K assoc=4 latency=12; memory latency=59"},
+    {"l3", "default plus an 8MB 16-way L3",
+     "l1 size=32K assoc=8; l2 size=256K assoc=8 latency=12; l3 size=8M assoc=16 latency=40; memory latency=120"},
+    {"victim", "default with a 16-line victim cache under L1",
+     "l1 size=32K assoc=8; vc size=1K assoc=full latency=2 inclusion=exclusive; l2 size=256K assoc=8 latency=12; memory latency=59"},
+};
+
+// The levels a setCacheConfig() argument stands for: those of the configuration of
+// that name, the argument itself or the contents of the file it names. False (and
+// why, on out) if it is none of them.
+static bool cache_spec(const std::string &config, std::string &spec, std::ostream &out) {
+    spec = config;
+    for (size_t i = 0; i < sizeof(cache_configs)/sizeof(cache_configs[0]); i++) {
+        if (config == cache_configs[i].name)
+            spec = cache_configs[i].levels;
+    }
+    // neither a name nor levels: a file of them
+    if (spec.find('=') == std::string::npos) {
+        std::ifstream file(config.c_str());
+        if (!file) {
+            out << config << ": not a configuration name, and can't open it as a file: " << strerror(errno) << "\n";
+            return false;
+        }
+        std::ostringstream contents;
+        contents << file.rdbuf();
+        spec = contents.str();
+    }
+    return true;
+}
+
+bool Memory::checkCacheConfig(const std::string &config) {
+    std::string spec;
+    std::vector<cache_level_config> levels;
+    int mem_latency;
+    if (!cache_spec(config, spec, cout) || !parse_hierarchy(spec, levels, mem_latency, cout))
+        return false;
+    for (size_t i = 0; i < levels.size(); i++) {
+        if (!level_ways(levels[i], cout))
+            return false;
+    }
+    return true;
+}
+
+bool Memory::isCacheConfigName(const std::string &config) {
+    for (size_t i = 0; i < sizeof(cache_configs)/sizeof(cache_configs[0]); i++) {
+        if (config == cache_configs[i].name)
+            return true;
+    }
+    return false;
+}
+
+bool Memory::setCacheConfig(const std::string &config) {
+    std::string spec;
+    std::vector<cache_level_config> levels;
+    int mem_latency;
+    if (!cache_spec(config, spec, cout) || !parse_hierarchy(spec, levels, mem_latency, cout))
+        return false;
+
+    // a level's miss penalty is the latency of the one below it, L1I and L1D both miss into the first shared level
+    bool split = levels[0].name == "l1i";
+    size_t first_shared = split ? 2 : 1;
+    std::vector<CacheBase *> caches;
+    for (size_t i = 0; i < levels.size(); i++) {
+        size_t below = i < first_shared ? first_shared : i + 1;
+        int penalty = below < levels.size() ? levels[below].latency : mem_latency;
+        std::string name = levels[i].name;
+        for (size_t j = 0; j < name.size(); j++)
+            name[j] = toupper(name[j]);
+        CacheBase *cache = make_cache(levels[i], name == "L1" ? "L1I" : name, penalty, cout);
+        if (cache && name == "L1") {
+            caches.push_back(cache);
+            cache = make_cache(levels[i], "L1D", penalty, cout);
+        }
+        if (!cache) {
+            for (size_t j = 0; j < caches.size(); j++)
+                delete caches[j];
+            return false;
+        }
+        caches.push_back(cache);
+    }
+
+    delete L1I;
+    delete L1D;
+    for (size_t i = 0; i < shared.size(); i++)
+        delete shared[i];
+    L1I = caches[0];
+    L1D = caches[1];
+    shared.assign(caches.begin() + 2, caches.end());
+    setMSHRs(num_mshrs);
+    return true;
+}
+
+void Memory::listCacheConfigs(std::ostream &out) {
+    for (size_t i = 0; i < sizeof(cache_configs)/sizeof(cache_configs[0]); i++) {
+        out << "  " << cache_configs[i].name << string(35 - strlen(cache_configs[i].name), ' ')
+            << cache_configs[i].description << "\n";
+    }
+}
+
+void Memory::mapMemory() {
+    // a memfd rather than anonymous memory: SEEK_DATA finds the touched pages even
+    // once they are swapped out, and a hole punched into it reads as zeros again
+    mem_fd = memfd_create("memory", MFD_CLOEXEC);
+    void *m = MAP_FAILED;
+    if (mem_fd >= 0 && ftruncate(mem_fd, MEM_BYTES) == 0) {
+        m = mmap(0, MEM_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, mem_fd, 0);
+    }
+    if (m == MAP_FAILED) {
+        cout << "Can't map " << (MEM_BYTES >> 30) << " GB of simulated memory: " << strerror(errno) << "\n";
+        exit(1);
+    }
+    mem = (uint32_t *)m;
+}
+
+Memory::~Memory() {
+    munmap(mem, MEM_BYTES);
+    close(mem_fd);
+    delete L1I;
+    delete L1D;
+    for (size_t i = 0; i < shared.size(); i++)
+        delete shared[i];
+    delete prefetcher[0];
+    delete prefetcher[1];
+}
+
+void Memory::touchedRuns(vector<pair<uint64_t, uint64_t> > &runs) {
+    runs.clear();
+    off_t data = 0;
+    while ((data = lseek(mem_fd, data, SEEK_DATA)) >= 0) {
+        off_t hole = lseek(mem_fd, data, SEEK_HOLE);
+        runs.push_back(make_pair((uint64_t)data, (uint64_t)(hole - data)));
+        data = hole;
+    }
+}
+
+void Memory::clearMemory() {
+    fallocate(mem_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 0, MEM_BYTES);
+}
+
+void Memory::loadSegment(uint32_t address, const uint8_t *data, uint32_t file_bytes, uint32_t mem_bytes) {
+    uint8_t *bytes = (uint8_t *)mem;
+    memcpy(bytes + address, data, file_bytes);
+    // whole pages of the zeroed part are given back, only its ends are written
+    uint64_t start = (uint64_t)address + file_bytes, end = (uint64_t)address + mem_bytes;
+    uint64_t first = (start + MEM_PAGE_SIZE-1) & ~(uint64_t)(MEM_PAGE_SIZE-1);
+    uint64_t last = end & ~(uint64_t)(MEM_PAGE_SIZE-1);
+    if (first >= last) {
+        memset(bytes + start, 0, end - start);
+        return;
+    }
+    memset(bytes + start, 0, first - start);
+    fallocate(mem_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, first, last - first);
+    memset(bytes + last, 0, end - last);
+}
+
+void Memory::saveImage(mem_image &image) {
+    vector<pair<uint64_t, uint64_t> > runs;
+    touchedRuns(runs);
+    image.start.clear();
+    image.bytes.clear();
+    image.words.clear();
+    for (size_t i = 0; i < runs.size(); i++) {
+        image.start.push_back(runs[i].first);
+        image.bytes.push_back(runs[i].second);
+        image.words.insert(image.words.end(), mem + runs[i].first/4, mem + (runs[i].first + runs[i].second)/4);
+    }
+}
+
+void Memory::restoreImage(const mem_image &image) {
+    clearMemory();
+    const uint32_t *w = image.words.data();
+    for (size_t i = 0; i < image.start.size(); i++) {
+        memcpy(mem + image.start[i]/4, w, image.bytes[i]);
+        w += image.bytes[i]/4;
+    }
+}
 
-    for (int w=0; w<assoc; w++) {
-        if (line[idx*assoc+w].valid && line[idx*assoc+w].tag == tag) {
-            line[idx*assoc+w].valid = false;
+Memory &Memory::operator=(const Memory &other) {
+    if (this != &other) {
+        mem_image image;
+        const_cast<Memory &>(other).saveImage(image);
+        restoreImage(image);
+        delete L1I;
+        delete L1D;
+        for (size_t i = 0; i < shared.size(); i++)
+            delete shared[i];
+        L1I = other.L1I->clone();
+        L1D = other.L1D->clone();
+        shared.resize(other.shared.size());
+        for (size_t i = 0; i < shared.size(); i++)
+            shared[i] = other.shared[i]->clone();
+        opt_level = other.opt_level;
+        num_mshrs = other.num_mshrs;
+        profiler = other.profiler;
+        for (int i = 0; i < 2; i++) {
+            delete prefetcher[i];
+            prefetcher[i] = other.prefetcher[i] ? other.prefetcher[i]->clone() : 0;
+            missLine[i] = other.missLine[i];
         }
     }
+    return *this;
 }
 
-bool Memory::access(uint32_t address, uint32_t &read_data, uint32_t write_data, bool mem_read, bool mem_write) {
+bool Memory::setPrefetcher(int level, const std::string &kind) {
+    Prefetcher *pf;
+    if ((level != 1 && level != 2) || !make_prefetcher(kind, pf)) {
+        return false;
+    }
+    delete prefetcher[level-1];
+    prefetcher[level-1] = pf;
+    return true;
+}
+
+// Bring a line into level k from the first level below that has it, or memory. The
+// levels in between that are not exclusive get a copy on the way (an inclusive one
+// has to hold it before the levels above can), an exclusive level the line comes
+// from gives it up and its dirty bit goes along.
+void Memory::fill(int k, uint32_t address, bool fetch, bool prefetched) {
+    CacheBase *target = level(k, fetch);
+    if (target->contains(address)) {
+        return;
+    }
+    uint32_t lineAddr = address & ~(CACHE_LINE_SIZE-1);
+    int from = k + 1;
+    while (from < numLevels() && !shared[from-1]->contains(address)) {
+        from++;
+    }
+    CacheLine c;
+    if (from < numLevels()) {
+        CacheBase *source = shared[from-1];
+        // a fill of the level above is the demand stream of this one
+        source->claimPrefetch(address);
+        c = source->readLine(address);
+        if (source->isExclusive()) {
+            source->invalidateLine(address);
+        } else {
+            c.dirty = false;
+        }
+    } else {
+        DEBUG(print(lineAddr, 8));
+        memcpy(c.data, &mem[lineAddr/4], CACHE_LINE_SIZE);
+        c.dirty = false;
+    }
+    c.prefetched = false;
+    c.replBits = 0;
+    for (int j = from - 1; j > k; j--) {
+        if (!shared[j-1]->isExclusive()) {
+            CacheLine copy = c;
+            copy.dirty = false;
+            install(j, address, copy, fetch);
+        }
+    }
+    if (k == 0 && fetch) {
+        // stores since the level below got the line are in L1D, code written by the
+        // program is fetched from there
+        CacheLine d = L1D->readLine(address);
+        if (d.valid && d.dirty) {
+            memcpy(c.data, d.data, CACHE_LINE_SIZE);
+        }
+    }
+    // L1I and write-through levels keep no dirty lines, the data goes further down
+    if (c.dirty && ((k == 0 && fetch) || target->isWriteThrough())) {
+        c.address = lineAddr;
+        writeBelow(k, c);
+        c.dirty = false;
+    }
+    c.prefetched = prefetched;
+    install(k, address, c, fetch);
+}
+
+void Memory::install(int k, uint32_t address, CacheLine &line, bool fetch) {
+    CacheLine evictedLine;
+    evictedLine.valid = false;
+    level(k, fetch)->replace(address, line, evictedLine);
+    if (evictedLine.valid) {
+        evict(k, evictedLine, fetch);
+    }
+}
+
+// A line left level k. An inclusive level takes it out of every level above (the
+// dirty copy nearest the pipeline is the newest), then it becomes a victim of the
+// exclusive level below, if there is one, or is written back if it is dirty.
+void Memory::evict(int k, CacheLine &line, bool fetch) {
+    CacheBase *cache = level(k, fetch);
+    if (k > 0 && cache->isInclusive()) {
+        bool newer = false;
+        for (int j = -1; j < k; j++) {
+            CacheBase *upper = j < 1 ? l1(j < 0) : shared[j-1];
+            CacheLine up = upper->readLine(line.address);
+            if (up.valid && up.dirty && !newer) {
+                memcpy(line.data, up.data, CACHE_LINE_SIZE);
+                line.dirty = newer = true;
+            }
+            upper->invalidateLine(line.address);
+        }
+    }
+    if (line.dirty) {
+        cache->countWriteback();
+    }
+    if (k + 1 < numLevels() && shared[k]->isExclusive()) {
+        line.prefetched = false;
+        install(k + 1, line.address, line, fetch);
+    } else if (line.dirty) {
+        writeBelow(k, line);
+    }
+}
+
+void Memory::writeBelow(int k, const CacheLine &line) {
+    for (int j = k + 1; j < numLevels(); j++) {
+        if (shared[j-1]->contains(line.address)) {
+            shared[j-1]->writeBackLine(line);
+            if (!shared[j-1]->isWriteThrough()) {
+                return;
+            }
+        }
+    }
+    uint32_t lineAddr = line.address & ~(CACHE_LINE_SIZE-1);
+    memcpy(&mem[lineAddr/4], line.data, CACHE_LINE_SIZE);
+}
+
+void Memory::storeDone(int k, uint32_t address, uint32_t word) {
+    L1I->invalidateLine(address);
+    if (k == numLevels() || !level(k, false)->isWriteThrough()) {
+        return;
+    }
+    for (int j = k + 1; j < numLevels(); j++) {
+        uint32_t unused;
+        if (shared[j-1]->probe(address, unused, word, false, true) && !shared[j-1]->isWriteThrough()) {
+            return;
+        }
+    }
+    mem[address/4] = word;
+}
+
+bool Memory::access(uint32_t address, uint32_t &read_data, uint32_t write_data, bool mem_read, bool mem_write, bool fetch, uint32_t pc) {
+    if (!mem_read && !mem_write) {
+        return true;
+    }
+
     if (opt_level == 0) {
         if (mem_read) {
             read_data = mem[address/4];
@@ -148,48 +946,455 @@ bool Memory::access(uint32_t address, uint32_t &read_data, uint32_t write_data,
         if (mem_write) {
             mem[address/4] = write_data;
         }
+        if (profiler) {
+            profiler->record(address, fetch);
+        }
         return true;
     }
 
-    if (!mem_read && !mem_write) {
-        return true;
+    if (opt_level >= 2) {
+        return accessNonBlocking(address, read_data, write_data, mem_read, mem_write, fetch, pc) == MEM_HIT;
     }
 
-    if ((mem_read && L1.read(address, read_data)) || (mem_write && L1.write(address, write_data))) {
+    uint32_t line = address & ~(CACHE_LINE_SIZE-1);
+    bool first = missLine[fetch] != line;
+    int port = fetch ? PORT_FETCH : PORT_DATA;
+    CacheBase *L1 = l1(fetch);
+    if ((mem_read && L1->read(address, read_data, port)) || (mem_write && L1->write(address, write_data, port))) {
+        if (mem_write) {
+            storeDone(0, address, write_data);
+        }
+        // only the call that completes counts, the retries before it are the same access
+        if (profiler) {
+            profiler->record(address, fetch);
+        }
+        if (first) {
+            L1->countHit();
+            observe(address, pc, fetch, true);
+        }
+        missLine[fetch] = 1;
         return true;
-    } else if ((mem_read && L2.read(address, read_data)) || (mem_write && L2.write(address, write_data))) {
-        // Read from L2 but don't return a success status until miss penalty is paid off completely
-        CacheLine evictedLine;
-        L1.replace(address, L2.readLine(address), evictedLine);
+    }
 
-        // writeback dirty line
-        if (evictedLine.valid && evictedLine.dirty) {
-            L2.writeBackLine(evictedLine);
-        }
+    // a prefetch of the line is in flight: the miss waits for it instead of going below
+    MSHR *m = L1->findMSHR(line);
+    if (m) {
+        L1->demandPrefetch(m);
+        L1->shortenMiss(m->countdown, port);
     } else {
-        // Read from memory but don't return a success status until miss penalty is paid off completely
-        int lineAddr = address & ~(CACHE_LINE_SIZE-1);
-        CacheLine c;
-        CacheLine evictedLine;
-        evictedLine.valid = false;
-        DEBUG(print(lineAddr, 8));
-        for (int i = 0; i < CACHE_LINE_SIZE/4; i++) {
-           c.data[i] = mem[lineAddr/4+i];
+        if (first) {
+            L1->countDemandMiss();
+        }
+        // Walk down the levels: the first one that has the line fills the level above it, one
+        // with a prefetch of it in flight waits for that, and memory fills the last one. A level
+        // still counting down on a miss of this port passes the access on, so the latencies of
+        // the levels overlap. Below L1 the line is only looked up, a store lands in L1 once
+        // the line is there.
+        for (int k = 1; ; k++) {
+            int above = fillLevel(k);
+            if (k == numLevels()) {
+                // Read from memory but don't return a success status until miss penalty is paid off completely
+                fill(above, address, fetch);
+                break;
+            }
+            CacheBase *cache = shared[k-1];
+            bool fresh = cache->getMissCountdown(port) == 0;
+            if (fresh && level(above, fetch)->contains(line)) {
+                // the line is up there already and only waits for that level's countdown
+                break;
+            }
+            uint32_t word;
+            if (cache->read(address, word, port)) {
+                if (first) {
+                    cache->countHit();
+                }
+                // Read from below but don't return a success status until miss penalty is paid off completely
+                fill(above, address, fetch);
+                break;
+            }
+            if ((m = cache->findMSHR(line))) {
+                cache->demandPrefetch(m);
+                cache->shortenMiss(m->countdown, port);
+                break;
+            }
+            if (fresh && !cache->contains(line)) {
+                cache->countDemandMiss();
+            }
         }
-        L2.replace(address, c, evictedLine); 
+    }
+    if (first) {
+        missLine[fetch] = line;
+        observe(address, pc, fetch, false);
+    }
+    return false;
+}
 
-        // model an inclusive hierarchy
-        if (evictedLine.valid) {
-            L1.invalidateLine(evictedLine.address);
+// Start (or join) the fill of a line into level k: it takes the miss penalty of k if the
+// level below has the line. Otherwise it waits for (or starts) the fill of the level below
+// and lands a cycle after it, the penalty of k overlaps the lookup below just like the
+// stall-on-miss path at -O1. Exclusive levels without the line are passed over, the line
+// will not go through them.
+bool Memory::startFill(int k, uint32_t line, bool instr, bool fetch, bool prefetch, int &countdown) {
+    CacheBase *cache = level(k, instr);
+    countdown = cache->getMissPenalty();
+    if (!cache->findMSHR(line)) {
+        if (!cache->freeMSHR(prefetch)) {
+            return false;
+        }
+        int j = k + 1;
+        while (j < numLevels() && shared[j-1]->isExclusive() && !shared[j-1]->contains(line)) {
+            j++;
+        }
+        countdown = level(j-1, instr)->getMissPenalty();
+        if (j < numLevels() && shared[j-1]->contains(line)) {
+            if (!prefetch) {
+                shared[j-1]->countHit();
+                shared[j-1]->claimPrefetch(line);
+            }
+        } else if (j < numLevels()) {
+            int below;
+            if (!startFill(j, line, false, false, prefetch, below)) {
+                return false;
+            }
+            countdown = below + 1;
         }
+    }
+    cache->allocateMSHR(line, countdown, fetch, prefetch);
+    return true;
+}
 
-        // writeback dirty line
-        if (evictedLine.valid && evictedLine.dirty) {
-            lineAddr = evictedLine.address & ~(CACHE_LINE_SIZE-1);
-            for (int i = 0; i < CACHE_LINE_SIZE/4; i++) {
-               mem[lineAddr/4+i] = evictedLine.data[i];
+// A demand access completed (hit) or started a miss: each prefetcher sees the accesses
+// of its level, the first shared level's are the L1 misses. The lines they propose that
+// are neither cached nor in flight start filling, prefetches into L1 go to the L1 of the
+// access (fetches prefetch code) and bring the line into the levels below on the way.
+void Memory::observe(uint32_t address, uint32_t pc, bool fetch, bool hit) {
+    if (!prefetcher[0] && (!prefetcher[1] || shared.empty())) {
+        return;
+    }
+    uint32_t line = address & ~(CACHE_LINE_SIZE-1);
+    prefetch_event e;
+    e.address = address;
+    e.pc = fetch ? address : pc;
+    e.fetch = fetch;
+    for (int level = 0; level < std::min(2, numLevels()); level++) {
+        CacheBase *cache = this->level(level, fetch);
+        if (!prefetcher[level] || (level && hit)) {
+            continue;
+        }
+        e.hit = level ? cache->contains(line) : hit;
+        e.prefetch_hit = e.hit && cache->lastPrefetchHit();
+        proposed.clear();
+        prefetcher[level]->observe(e, proposed);
+        for (size_t i = 0; i < proposed.size(); i++) {
+            uint32_t p = proposed[i];
+            if (p == line || cache->contains(p) || cache->findMSHR(p)) {
+                continue;
             }
+            int countdown;
+            startFill(level, p, fetch, false, true, countdown);
         }
     }
-    return false;
+}
+
+bool Memory::fetchGroup(uint32_t address, uint32_t *words, int n) {
+    if (!access(address, words[0], 0, true, false, true, address)) {
+        return false;
+    }
+    if (n > 1) {
+        CacheLine line = L1I->readLine(address);
+        int offset = (address & (CACHE_LINE_SIZE-1)) / 4;
+        for (int i = 1; i < n; i++) {
+            words[i] = line.data[offset + i];
+        }
+    }
+    return true;
+}
+
+mem_status Memory::accessNonBlocking(uint32_t address, uint32_t &read_data, uint32_t write_data, bool mem_read, bool mem_write, bool fetch, uint32_t pc) {
+    if (!mem_read && !mem_write) {
+        return MEM_HIT;
+    }
+    uint32_t line = address & ~(CACHE_LINE_SIZE-1);
+    CacheBase *L1 = l1(fetch);
+    if (L1->probe(address, read_data, write_data, mem_read, mem_write)) {
+        if (mem_write) {
+            storeDone(0, address, write_data);
+        }
+        if (profiler) {
+            profiler->record(address, fetch);
+        }
+        // a fetch that waited for its line was seen (and counted) when it missed
+        if (missLine[fetch] != line) {
+            L1->countHit();
+            observe(address, pc, fetch, true);
+        }
+        missLine[fetch] = 1;
+        return MEM_HIT;
+    }
+
+    int countdown;
+    if (!startFill(0, line, fetch, fetch, false, countdown)) {
+        return MEM_BLOCKED;
+    }
+    if (missLine[fetch] != line) {
+        observe(address, pc, fetch, false);
+    }
+    if (fetch) {
+        missLine[fetch] = line;
+        // fetches wait for the line and come back for it
+        return MEM_MISS;
+    }
+
+    // the word moves now: L1D has no copy, so the newest one is in the first level below
+    // that has the line or else in memory, and the fill picks up whatever was written here
+    // when it completes
+    int k = 1;
+    while (k < numLevels() && !shared[k-1]->probe(address, read_data, write_data, mem_read, mem_write)) {
+        k++;
+    }
+    if (k == numLevels()) {
+        if (mem_read) {
+            read_data = mem[address/4];
+        }
+        if (mem_write) {
+            mem[address/4] = write_data;
+        }
+    }
+    if (mem_write) {
+        storeDone(k, address, write_data);
+    }
+    if (profiler) {
+        profiler->record(address, fetch);
+    }
+    return MEM_MISS;
+}
+
+// One cycle passes, fills that complete install their lines. A prefetched line
+// only keeps its mark if no demand miss caught up with the fill.
+void Memory::tick() {
+    std::vector<MSHR> done;
+    // the lowest level first, a fill never completes before the fill below it waits on
+    for (int k = shared.size(); k > 0; k--) {
+        done.clear();
+        shared[k-1]->tickMSHRs(done);
+        for (size_t i = 0; i < done.size(); i++) {
+            fill(k, done[i].line, false, done[i].prefetch && !done[i].demanded);
+        }
+    }
+    // L1I and L1D fill independently
+    for (int side = 1; side >= 0; side--) {
+        done.clear();
+        l1(side)->tickMSHRs(done);
+        for (size_t i = 0; i < done.size(); i++) {
+            fill(0, done[i].line, side, done[i].prefetch && !done[i].demanded);
+        }
+    }
+}
+
+// Number of upcoming access() calls to this address that would do nothing but
+// count down outstanding misses, so a frozen pipeline can skip them in one step
+int Memory::idleCycles(uint32_t address, bool fetch) {
+    int idle = idleMissCycles(address, fetch);
+    // stop short of the next prefetch fill, tick() has to install it
+    int next = std::min(L1I->nextFill(), L1D->nextFill());
+    for (size_t i = 0; i < shared.size(); i++) {
+        next = std::min(next, shared[i]->nextFill());
+    }
+    return std::max(0, std::min(idle, next - 1));
+}
+
+// Follows the walk of access() down the levels
+int Memory::idleMissCycles(uint32_t address, bool fetch) {
+    int port = fetch ? PORT_FETCH : PORT_DATA;
+    int idle = l1(fetch)->getMissCountdown(port);
+    if (opt_level == 0 || idle == 0) {
+        // L1 looks the address up on the next call
+        return 0;
+    }
+    if (l1(fetch)->findMSHR(address & ~(CACHE_LINE_SIZE-1))) {
+        // waits for the prefetch in flight
+        return idle;
+    }
+    for (int k = 1; k < numLevels(); k++) {
+        CacheBase *cache = shared[k-1];
+        int countdown = cache->getMissCountdown(port);
+        if (!countdown) {
+            // the walk ends here once the line is in the level above, otherwise this
+            // level looks it up
+            return level(fillLevel(k), fetch)->contains(address) ? idle : 0;
+        }
+        // the levels count down together
+        idle = std::min(idle, countdown);
+        if (cache->findMSHR(address & ~(CACHE_LINE_SIZE-1))) {
+            return idle;
+        }
+    }
+    // every level counts down, idle unless memory still has to fill the line in
+    return level(fillLevel(numLevels()), fetch)->contains(address) ? idle : 0;
+}
+
+// Skip n cycles returned by idleCycles() for the same access. Only the levels its walk
+// reaches count down, a level below may still hold the countdown of an older miss.
+void Memory::skipCycles(int n, uint32_t address, bool fetch) {
+    int port = fetch ? PORT_FETCH : PORT_DATA;
+    uint32_t line = address & ~(CACHE_LINE_SIZE-1);
+    l1(fetch)->skipMiss(n, port);
+    if (!l1(fetch)->findMSHR(line)) {
+        for (int k = 1; k < numLevels(); k++) {
+            CacheBase *cache = shared[k-1];
+            if (!cache->getMissCountdown(port)) {
+                break;
+            }
+            cache->skipMiss(n, port);
+            if (cache->findMSHR(line)) {
+                break;
+            }
+        }
+    }
+    L1I->skipFills(n);
+    L1D->skipFills(n);
+    for (size_t i = 0; i < shared.size(); i++) {
+        shared[i]->skipFills(n);
+    }
+}
+
+// Functional cache warming: update tags and replacement state as an access to this
+// address would, without timing or moving data
+void Memory::warm(uint32_t address, bool fetch) {
+    uint32_t loc;
+    int k = 0;
+    while (k < numLevels() && !level(k, fetch)->isHit(address, loc)) {
+        k++;
+    }
+    if (k == 0) {
+        return;
+    }
+    if (k < numLevels() && shared[k-1]->isExclusive()) {
+        shared[k-1]->invalidateLine(address);
+    }
+    for (int j = k - 1; j >= 0; j--) {
+        if (j == 0 || !shared[j-1]->isExclusive()) {
+            warmInstall(j, address, fetch);
+            level(j, fetch)->isHit(address, loc);
+        }
+    }
+}
+
+// The tag-only counterpart of install() and evict()
+void Memory::warmInstall(int k, uint32_t address, bool fetch) {
+    CacheLine c;
+    CacheLine evictedLine;
+    c.dirty = false;
+    c.prefetched = false;
+    c.replBits = 0;
+    evictedLine.valid = false;
+    level(k, fetch)->replace(address, c, evictedLine);
+    if (!evictedLine.valid) {
+        return;
+    }
+    // model the inclusion of the level
+    if (k > 0 && shared[k-1]->isInclusive()) {
+        L1I->invalidateLine(evictedLine.address);
+        L1D->invalidateLine(evictedLine.address);
+        for (int j = 1; j < k; j++) {
+            shared[j-1]->invalidateLine(evictedLine.address);
+        }
+    }
+    if (k + 1 < numLevels() && shared[k]->isExclusive()) {
+        warmInstall(k + 1, evictedLine.address, fetch);
+    }
+}
+
+// Checkpointing: every cache and the whole memory image
+void Memory::save(CheckpointWriter &ckpt) {
+    ckpt.begin(CKPT_L1I);
+    L1I->save(ckpt);
+    L1I->saveMSHRs(ckpt);
+    ckpt.begin(CKPT_L1D);
+    L1D->save(ckpt);
+    L1D->saveMSHRs(ckpt);
+    ckpt.begin(CKPT_SHARED);
+    int levels = shared.size();
+    ckpt.put(&levels, sizeof(levels));
+    for (size_t i = 0; i < shared.size(); i++) {
+        shared[i]->save(ckpt);
+        shared[i]->saveMSHRs(ckpt);
+    }
+    // the L1 and L2 prefetchers, each as its kind and its training state
+    for (int i = 0; i < 2; i++) {
+        char kind[16] = {};
+        strncpy(kind, prefetcher[i] ? prefetcher[i]->name() : "none", sizeof(kind)-1);
+        ckpt.put(kind, sizeof(kind));
+        if (prefetcher[i])
+            prefetcher[i]->save(ckpt);
+    }
+    // runs of touched pages, each as its first byte, its length and its contents; runs
+    // are cut at 2 GB so the length fits in 32 bits
+    ckpt.begin(CKPT_MEM);
+    vector<pair<uint64_t, uint64_t> > runs;
+    touchedRuns(runs);
+    for (size_t i = 0; i < runs.size(); i++) {
+        for (uint64_t off = 0; off < runs[i].second; off += 1u << 31) {
+            uint32_t start = runs[i].first + off;
+            uint32_t bytes = min<uint64_t>(runs[i].second - off, 1u << 31);
+            ckpt.put(&start, sizeof(start));
+            ckpt.put(&bytes, sizeof(bytes));
+            ckpt.put(mem + start/4, bytes);
+        }
+    }
+}
+
+bool Memory::restore(CheckpointReader &ckpt) {
+    ckpt.begin(CKPT_L1I);
+    if (!L1I->restore(ckpt) || !L1I->restoreMSHRs(ckpt)) {
+        return false;
+    }
+    ckpt.begin(CKPT_L1D);
+    if (!L1D->restore(ckpt) || !L1D->restoreMSHRs(ckpt)) {
+        return false;
+    }
+    ckpt.begin(CKPT_SHARED);
+    int levels;
+    if (!ckpt.get(&levels, sizeof(levels))) {
+        return false;
+    }
+    if (levels != (int)shared.size()) {
+        cout << "The checkpoint has " << levels << " cache levels below L1, this hierarchy " << shared.size() << "\n";
+        return false;
+    }
+    for (size_t i = 0; i < shared.size(); i++) {
+        if (!shared[i]->restore(ckpt) || !shared[i]->restoreMSHRs(ckpt)) {
+            return false;
+        }
+    }
+    for (int i = 0; i < 2; i++) {
+        char kind[16];
+        if (!ckpt.get(kind, sizeof(kind))) {
+            return false;
+        }
+        kind[sizeof(kind)-1] = 0;
+        const char *mine = prefetcher[i] ? prefetcher[i]->name() : "none";
+        if (strcmp(kind, mine)) {
+            cout << "The checkpoint was taken with " << kind << " as the " << (i ? "L2" : "L1")
+                 << " prefetcher, this run uses " << mine << "\n";
+            return false;
+        }
+        if (prefetcher[i] && !prefetcher[i]->restore(ckpt)) {
+            return false;
+        }
+    }
+    missLine[0] = missLine[1] = 1;
+    ckpt.begin(CKPT_MEM);
+    clearMemory();
+    size_t n;
+    ckpt.data(n);
+    while (n) {
+        uint32_t start, bytes;
+        if (!ckpt.get(&start, sizeof(start)) || !ckpt.get(&bytes, sizeof(bytes)) ||
+                (uint64_t)start + bytes > MEM_BYTES || !ckpt.get(mem + start/4, bytes)) {
+            return false;
+        }
+        ckpt.data(n);
+    }
+    return true;
 }
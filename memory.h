@@ -4,8 +4,18 @@
 #include <cstdint>
 #include <iostream>
 #include <cmath>
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include "checkpoint.h"
+#include "prefetch.h"
+#include "stats.h"
 
 #define CACHE_LINE_SIZE 64
+#define MEM_BYTES (1ull << 32)      // the backing store covers the whole 32-bit address space
+#define MEM_PAGE_SIZE 4096          // ... and allocates it a page at a time, on first touch
+
+class StackProfiler;
 
 struct CacheLine {
     uint32_t data[CACHE_LINE_SIZE/4];
@@ -13,110 +23,778 @@ struct CacheLine {
     int tag;
     bool valid;
     bool dirty;
+    bool prefetched;                // brought in by a prefetch and not used yet
     uint8_t replBits;
 };
 
-class Cache {
-    private:
-        std::vector<CacheLine> line;
-        int size;
-        int assoc;
+// log2 of a power of two, also at compile time
+constexpr int ilog2(int n) {
+    return n <= 1 ? 0 : 1 + ilog2(n/2);
+}
+
+// Replacement policies keep one byte of state per line and are inlined into
+// the cache that uses them. Every function sees the state of one set, insert()
+// also its index and the number of sets. A policy with state across the sets (a random number
+// generator, a duel counter) keeps it in its members: each cache has its own
+// instance, and checkpoints copy it as it is. The policies a level can have
+// are listed in cache_policies[] in memory.cpp.
+//
+// LRU: each valid way holds its age rank, assoc-1 is the most recently used.
+struct LRUPolicy {
+    static constexpr const char *name() { return "lru"; }
+
+    // way was just hit
+    static void touch(uint8_t *r, uint64_t valid, int way, int assoc) {
+        uint8_t cur = r[way];
+        for (int w = 0; w < assoc; w++) {
+            if (((valid >> w) & 1) && r[w] > cur)
+                r[w]--;
+        }
+        r[way] = assoc-1;
+    }
+
+    // way was just filled (it is already marked valid), the new line starts as the most recently used
+    static void insert(uint8_t *r, uint64_t valid, int way, int assoc, int, int) {
+        r[way] = 0;
+        touch(r, valid, way, assoc);
+    }
+
+    // way to evict from a set with no invalid way
+    static int victim(uint8_t *r, int assoc) {
+        int v = 0;
+        for (int w = 1; w < assoc; w++) {
+            if (r[w] < r[v])
+                v = w;
+        }
+        return v;
+    }
+
+    static bool isMRU(const uint8_t *r, int way, int assoc) {
+        return r[way] == assoc-1;
+    }
+};
+
+// Tree-PLRU: a binary tree over the ways (their number rounded up to a power of
+// two), each node points to the half that was used less recently. Node n has the
+// children 2n+1 and 2n+2, the bit of node n is bit n%8 of byte n/8 of the set.
+// A touch turns the nodes on the way's path away from it, the victim is where
+// they lead: log2(assoc) steps instead of a pass over the set.
+struct TreePLRUPolicy {
+    static constexpr const char *name() { return "plru"; }
+
+    static int depth(int assoc) {
+        return ilog2(assoc) + ((1 << ilog2(assoc)) < assoc);
+    }
+
+    static void touch(uint8_t *r, uint64_t, int way, int assoc) {
+        for (int d = depth(assoc) - 1, n = 0; d >= 0; d--) {
+            int right = (way >> d) & 1;
+            r[n >> 3] = (r[n >> 3] & ~(1 << (n & 7))) | (!right << (n & 7));
+            n = 2*n + 1 + right;
+        }
+    }
+
+    static void insert(uint8_t *r, uint64_t valid, int way, int assoc, int, int) {
+        touch(r, valid, way, assoc);
+    }
+
+    // never into the ways past assoc of a tree that is not full
+    static int victim(uint8_t *r, int assoc) {
+        int v = 0;
+        for (int d = depth(assoc) - 1, n = 0; d >= 0; d--) {
+            int right = (r[n >> 3] >> (n & 7)) & 1;
+            if (v + (1 << d) >= assoc)
+                right = 0;
+            v += right << d;
+            n = 2*n + 1 + right;
+        }
+        return v;
+    }
+
+    static bool isMRU(const uint8_t *r, int way, int assoc) {
+        for (int d = depth(assoc) - 1, n = 0; d >= 0; d--) {
+            int right = (way >> d) & 1;
+            if (((r[n >> 3] >> (n & 7)) & 1) == right)
+                return false;
+            n = 2*n + 1 + right;
+        }
+        return true;
+    }
+};
+
+// RRIP, re-reference interval prediction: each line holds a 2-bit prediction of
+// how far away its next use is, 0 for a hit. The victim is a line predicted
+// distant (3); if there is none, every line ages until one is. SRRIP inserts new
+// lines at 2, so a scan that is never reused leaves before the lines that were
+// hit; BRRIP inserts at 3 but for one fill in 32 at random, which keeps part of a
+// working set larger than the cache.
+struct RRIP {
+    enum { DISTANT = 3, LONG = 2 };
+
+    static void touch(uint8_t *r, uint64_t, int way, int) {
+        r[way] = 0;
+    }
+
+    static int victim(uint8_t *r, int assoc) {
+        uint8_t oldest = 0;
+        for (int w = 0; w < assoc; w++)
+            oldest = std::max(oldest, r[w]);
+        int v = -1;
+        for (int w = 0; w < assoc; w++) {
+            r[w] += DISTANT - oldest;
+            if (v < 0 && r[w] == DISTANT)
+                v = w;
+        }
+        return v;
+    }
+
+    static bool isMRU(const uint8_t *r, int way, int) {
+        return r[way] == 0;
+    }
+};
+
+struct SRRIPPolicy : RRIP {
+    static constexpr const char *name() { return "srrip"; }
+
+    static void insert(uint8_t *r, uint64_t, int way, int, int, int) {
+        r[way] = LONG;
+    }
+};
+
+// xorshift32 for the policies that pick at random, the same numbers every run
+struct PolicyRandom {
+    uint32_t seed = 1;
+
+    uint32_t random() {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        return seed;
+    }
+};
+
+struct BRRIPPolicy : RRIP, PolicyRandom {
+    static constexpr const char *name() { return "brrip"; }
+
+    void insert(uint8_t *r, uint64_t, int way, int, int, int) {
+        r[way] = random() % 32 ? DISTANT : LONG;
+    }
+};
+
+// DRRIP: set dueling between the two. Sets 0, 32, 64... always insert like SRRIP
+// and sets 31, 63, 95... like BRRIP; their misses move a 10-bit counter one way
+// or the other, and the rest of the sets follow whichever of the two misses less.
+// Below 64 sets they are the first and the last set of each half instead, so
+// both kinds lead from 4 sets up (2 sets are one leader of each, 1 is SRRIP).
+struct DRRIPPolicy : BRRIPPolicy {
+    static constexpr const char *name() { return "drrip"; }
+
+    enum { PSEL_MAX = 1023, LEADER_STEP = 32 };
+    int psel = PSEL_MAX/2;          // above half: BRRIP is ahead
+
+    void insert(uint8_t *r, uint64_t valid, int way, int assoc, int set, int sets) {
+        int step = std::min((int)LEADER_STEP, std::max(2, sets/2));
+        bool brrip;
+        if (set % step == 0) {
+            psel = std::min(psel + 1, (int)PSEL_MAX);
+            brrip = false;
+        } else if (set % step == step-1) {
+            psel = std::max(psel - 1, 0);
+            brrip = true;
+        } else {
+            brrip = psel > PSEL_MAX/2;
+        }
+        if (brrip)
+            BRRIPPolicy::insert(r, valid, way, assoc, set, sets);
+        else
+            SRRIPPolicy::insert(r, valid, way, assoc, set, sets);
+    }
+};
+
+// Random: no state in the lines, the victim is any way
+struct RandomPolicy : PolicyRandom {
+    static constexpr const char *name() { return "random"; }
+
+    static void touch(uint8_t *, uint64_t, int, int) {
+    }
+
+    static void insert(uint8_t *, uint64_t, int, int, int, int) {
+    }
+
+    int victim(uint8_t *, int assoc) {
+        return random() % assoc;
+    }
+
+    static bool isMRU(const uint8_t *, int, int) {
+        return false;
+    }
+};
+
+#define DEFAULT_MSHRS 8
+#define MAX_MSHRS 64
+
+// Stall-on-miss requesters of a cache level: L1I and L1D each have one, the shared
+// levels one for the misses of either, so an instruction and a data miss can be
+// outstanding below L1 at the same time
+#define CACHE_PORTS 2
+#define PORT_DATA 0
+#define PORT_FETCH 1
+
+// How a level of the hierarchy relates to the levels above it
+enum cache_inclusion {
+    INCLUSIVE,                      // holds every line above it, evicting one takes it out of them too
+    NON_INCLUSIVE,                  // filled on misses like an inclusive level, evictions leave the levels above alone
+    EXCLUSIVE                       // holds only lines the level above evicted, a hit moves the line up (a victim cache)
+};
+
+// Miss status holding register: one line fill in flight (demand misses at -O2
+// and up, prefetches from -O1)
+struct MSHR {
+    uint32_t line;                  // line address
+    int countdown;                  // cycles until the line is installed
+    bool fetched;                   // a fetch waits on it, its retries are not new misses
+    bool prefetch;                  // started by the prefetcher...
+    bool demanded;                  // ...and a demand miss caught up with it before it landed
+};
+
+// What Memory needs from one level of the hierarchy, whatever its geometry
+class CacheBase {
+    protected:
         int missPenalty;
-        int missCountdown;
+        int missCountdown[CACHE_PORTS]; // stall-on-miss (-O1): the outstanding miss of each port
         std::string name;
+        cache_inclusion inclusion;
+        bool writeThrough;              // stores are passed on to the level below, lines are never dirty
+
+        // lockup-free (-O2 and up): every line fill in flight and what they did
+        std::vector<MSHR> mshrs;
+        int maxMSHRs;
+        uint64_t demandMisses;          // misses that had to start a fill of their own
+        uint64_t mergedMisses;          // misses to a line already in flight
+        uint64_t blockedMisses;         // misses turned away because every MSHR was busy
+        uint64_t hitsUnderMiss;         // hits while at least one fill was in flight
+
+        // from -O1: demand accesses that found their line, see getMisses() for the others
+        uint64_t hits;
+        uint64_t writebacks;            // dirty lines evicted to the level below
+        uint64_t busyCycles;            // cycles with at least one fill in flight
+        uint64_t fillCycles;            // sum over cycles of the fills in flight
+
+        // prefetching: what became of the lines the prefetcher asked for
+        uint64_t prefetchIssued;
+        uint64_t prefetchUseful;        // landed in time and a demand access hit them
+        uint64_t prefetchLate;          // a demand miss found them still in flight
+        uint64_t prefetchUseless;       // evicted or invalidated before any demand access
+        bool lastHitPrefetched;         // the last isHit() was the first use of a prefetched line
     public:
-        Cache(std::string nm, int sz, int asc, int penalty) {
+        CacheBase(std::string nm, int penalty) {
             name = nm;
-            size = sz;
-            assoc = asc;
-            line.resize(size/CACHE_LINE_SIZE);
-
-            for (int i = 0; i < (size/CACHE_LINE_SIZE); i++) {
-                line[i].valid = false;
-            }
-            
-            missCountdown = 0;
             missPenalty = penalty;
+            missCountdown[PORT_DATA] = missCountdown[PORT_FETCH] = 0;
+            inclusion = INCLUSIVE;
+            writeThrough = false;
+            maxMSHRs = DEFAULT_MSHRS;
+            demandMisses = mergedMisses = blockedMisses = hitsUnderMiss = busyCycles = fillCycles = 0;
+            hits = writebacks = 0;
+            prefetchIssued = prefetchUseful = prefetchLate = prefetchUseless = 0;
+            lastHitPrefetched = false;
         }
+        virtual ~CacheBase() {}
 
-        // offset, index, tag computation
-        int getOffset(uint32_t address) {
-            return address & (CACHE_LINE_SIZE-1);
-        }
-        int getIndex(uint32_t address) {
-            return (address >> (int)log2(CACHE_LINE_SIZE)) & (size/CACHE_LINE_SIZE-1);
-        }
-        int getTag(uint32_t address) {
-            return address >> (int)log2(size);
-        }
+        // Same geometry and contents
+        virtual CacheBase *clone() const = 0;
 
-        // Check if hit in the cache
-        bool isHit(uint32_t address, uint32_t &loc);
+        virtual int getSize() const = 0;
+        virtual int getAssoc() const = 0;
 
-        // Update replacement bits after access
-        void updateReplacementBits(int idx, int way);
+        // Check if hit in the cache
+        virtual bool isHit(uint32_t address, uint32_t &loc) = 0;
 
-        // Read a word from this cache
-        bool read(uint32_t address, uint32_t &read_data);
+        // Read a word from this cache, a miss counts down on the port's outstanding miss
+        virtual bool read(uint32_t address, uint32_t &read_data, int port = PORT_DATA) = 0;
 
         // Write a word to this cache
-        bool write(uint32_t address, uint32_t write_data);
+        virtual bool write(uint32_t address, uint32_t write_data, int port = PORT_DATA) = 0;
 
         // Call this only if you know that a valid line with matching tag exists at that address 
-        CacheLine readLine(uint32_t address);
+        virtual CacheLine readLine(uint32_t address) = 0;
 
         // Call this only if you know that a valid line with matching tag exists at that address 
-        void writeBackLine(CacheLine evictedLine);
+        virtual void writeBackLine(CacheLine evictedLine) = 0;
 
         // Replace a line at the set corresponding this address
-        void replace(uint32_t address, CacheLine newLine, CacheLine &evictedLine);
+        virtual void replace(uint32_t address, CacheLine newLine, CacheLine &evictedLine) = 0;
 
         // Invalidate a line
-        void invalidateLine(uint32_t address);
+        virtual void invalidateLine(uint32_t address) = 0;
+
+        // Check if a valid line holds this address, without touching replacement bits
+        virtual bool contains(uint32_t address) = 0;
+
+        // Check if the line holding this address is the most recently used in its set
+        virtual bool isMRU(uint32_t address) = 0;
+
+        // Reload the data of every valid line from mem and mark it clean, drops any outstanding miss
+        virtual void reload(const uint32_t *mem) = 0;
+
+        // Checkpointing: geometry, miss state and every line including its metadata
+        virtual void save(CheckpointWriter &ckpt) = 0;
+        virtual bool restore(CheckpointReader &ckpt) = 0;
 
         // Print a cache line
-        void printLine(uint32_t address) {
-            int idx = getIndex(address);
-            int tag = getTag(address);
-
-            for (int w=0; w<assoc; w++) {
-                if (line[idx*assoc+w].valid && line[idx*assoc+w].tag == tag) {
-                    std::cout<< "Valid:" << line[idx*assoc+w].valid << "\n";
-                    std::cout<< "Address:" << line[idx*assoc+w].address << "\n";
-                    std::cout<< "Tag:" << line[idx*assoc+w].tag << "\n";
-                    std::cout<< "Dirty:" << line[idx*assoc+w].dirty << "\n";
-                    std::cout<< "Replacement Bits:" << line[idx*assoc+w].replBits << "\n";
-                    for (int i = 0; i < CACHE_LINE_SIZE/4; i++) {
-                        std::cout<< "DATA[" << i << "]: " << line[idx*assoc+w].data[i] << "\n";
-                    }
-                    return;
-                }
+        virtual void printLine(uint32_t address) = 0;
+
+        // Lockup-free access: read or write the word if the line is here and return true,
+        // otherwise return false without changing anything
+        virtual bool probe(uint32_t address, uint32_t &read_data, uint32_t write_data, bool mem_read, bool mem_write) = 0;
+
+        // A demand reached the line holding this address without looking it up (a fill of
+        // the level above): true, and counted as useful, if it is the first use of a prefetch
+        virtual bool claimPrefetch(uint32_t address) = 0;
+
+        int getMissCountdown(int port = PORT_DATA) { return missCountdown[port]; }
+        int getMissPenalty() { return missPenalty; }
+        const std::string &getName() const { return name; }
+
+        void setInclusion(cache_inclusion inc) { inclusion = inc; }
+        bool isExclusive() const { return inclusion == EXCLUSIVE; }
+        bool isInclusive() const { return inclusion == INCLUSIVE; }
+        void setWriteThrough(bool through) { writeThrough = through; }
+        bool isWriteThrough() const { return writeThrough; }
+
+        void setMSHRs(int n) { maxMSHRs = n; }
+
+        // The MSHR filling this line, 0 if it is not in flight
+        MSHR *findMSHR(uint32_t line) {
+            for (size_t i = 0; i < mshrs.size(); i++) {
+                if (mshrs[i].line == line)
+                    return &mshrs[i];
             }
+            return 0;
         }
+
+        // A new line can start filling, otherwise the miss is turned away (and counted).
+        // Prefetches never take the last free MSHR and are dropped quietly.
+        bool freeMSHR(bool prefetch = false) {
+            if ((int)mshrs.size() + prefetch < maxMSHRs)
+                return true;
+            if (!prefetch)
+                blockedMisses++;
+            return false;
+        }
+
+        // Track a miss: a new fill taking countdown cycles (check freeMSHR() first), or a
+        // merge into the fill of the same line, whose remaining cycles are returned in countdown
+        void allocateMSHR(uint32_t line, int &countdown, bool fetch, bool prefetch = false);
+
+        // Count down every fill by one cycle, the ones that land are appended to done
+        void tickMSHRs(std::vector<MSHR> &done);
+
+        int outstanding() { return mshrs.size(); }
+        void countHit(uint64_t n = 1) {
+            hits += n;
+            if (!mshrs.empty())
+                hitsUnderMiss += n;
+        }
+
+        void saveMSHRs(CheckpointWriter &ckpt);
+        bool restoreMSHRs(CheckpointReader &ckpt);
+        void printMSHRStats(std::ostream &out);
+        void printPrefetchStats(std::ostream &out, const char *kind);
+
+        // Advance the outstanding miss of a port by n cycles, n must not exceed the countdown
+        void skipMiss(int n, int port = PORT_DATA) {
+            if (missCountdown[port])
+                missCountdown[port] -= n;
+        }
+
+        // Advance the fills in flight by n cycles, n must not reach nextFill()
+        void skipFills(int n) {
+            if (!mshrs.empty()) {
+                busyCycles += n;
+                fillCycles += (uint64_t)n * mshrs.size();
+            }
+            for (size_t i = 0; i < mshrs.size(); i++)
+                mshrs[i].countdown -= n;
+        }
+
+        // Cycles until the next fill in flight lands, a large number if there is none
+        int nextFill() {
+            int next = 1 << 30;
+            for (size_t i = 0; i < mshrs.size(); i++)
+                next = std::min(next, mshrs[i].countdown);
+            return next;
+        }
+
+        // Stall-on-miss (-O1): the outstanding miss ends early, when a fill in flight lands
+        void shortenMiss(int cycles, int port = PORT_DATA) {
+            if (missCountdown[port] > cycles)
+                missCountdown[port] = cycles;
+        }
+
+        void countDemandMiss() { demandMisses++; }
+        void countWriteback() { writebacks++; }
+
+        // Demand accesses: every miss started a fill, joined one or caught a prefetch in flight
+        uint64_t getHits() { return hits; }
+        uint64_t getMisses() { return demandMisses + mergedMisses + prefetchLate; }
+        uint64_t getWritebacks() { return writebacks; }
+        bool lastPrefetchHit() { return lastHitPrefetched; }
+
+        // A demand miss caught up with a prefetch of the same line
+        void demandPrefetch(MSHR *m) {
+            if (!m->demanded)
+                prefetchLate++;
+            m->demanded = true;
+        }
+};
+
+// A cache whose associativity is fixed at compile time, so every way loop below
+// is a constant the compiler can unroll; the number of sets comes from the
+// hierarchy configuration and only feeds a mask and a shift. The common
+// associativities are instantiated in memory.cpp (see make_cache()), Assoc 0
+// takes any other one up to 64 at run time.
+template <int Assoc, int LineBytes, class Policy>
+class Cache : public CacheBase {
+    private:
+        static_assert(LineBytes == CACHE_LINE_SIZE, "lines move between levels as a CacheLine");
+        static_assert(Assoc >= 0 && Assoc <= 64, "at most 64 ways, the valid and dirty bits of a set are one word");
+
+        enum {
+            Words = LineBytes/4,
+            OffsetBits = ilog2(LineBytes)
+        };
+
+        int runtimeAssoc;                   // the associativity if Assoc is 0
+        int sets;                           // a power of two
+        int tagShift;
+
+        // Lines are kept as a structure of arrays so a lookup only touches the
+        // packed tags of one set; the line data lives in its own array.
+        // Line i is way i%ways() of set i/ways().
+        std::vector<uint32_t> tags;
+        std::vector<uint64_t> validMask;    // one bit per way, per set
+        std::vector<uint64_t> dirtyMask;
+        std::vector<uint64_t> prefetchMask; // prefetched, no demand access yet
+        std::vector<uint8_t> repl;          // replacement state, owned by Policy
+        Policy policy;
+        std::vector<uint32_t> data;
+
+        // offset, index, tag computation
+        static int getOffset(uint32_t address) {
+            return address & (LineBytes-1);
+        }
+        int getIndex(uint32_t address) const {
+            return (address >> OffsetBits) & (sets-1);
+        }
+        uint32_t getTag(uint32_t address) const {
+            return address >> tagShift;
+        }
+
+        int ways() const { return Assoc ? Assoc : runtimeAssoc; }
+        uint64_t wayMask() const { return ways() == 64 ? ~0ull : (1ull << ways()) - 1; }
+
+        // Bit w set if way w of set idx holds a valid line with this tag
+        uint64_t matchWays(int idx, uint32_t tag);
+
+        // Line address rebuilt from where it sits and its tag
+        uint32_t lineAddress(int loc) {
+            return (tags[loc] << tagShift) | ((uint32_t)(loc/ways()) << OffsetBits);
+        }
+
+        // Copy a line out into the exchange format
+        CacheLine getLine(int loc);
+    public:
+        // size must be a power-of-two number of sets of assoc lines (make_cache() checks)
+        Cache(std::string nm, int penalty, int size, int assoc = Assoc) : CacheBase(nm, penalty),
+            runtimeAssoc(assoc), sets(size/LineBytes/ways()), tagShift(ilog2(size/ways())),
+            tags(sets*ways()), validMask(sets), dirtyMask(sets), prefetchMask(sets),
+            repl(sets*ways()), policy(), data(sets*ways()*Words) {
+        }
+
+        CacheBase *clone() const override { return new Cache(*this); }
+        int getSize() const override { return sets*ways()*LineBytes; }
+        int getAssoc() const override { return ways(); }
+
+        bool isHit(uint32_t address, uint32_t &loc) override;
+        bool read(uint32_t address, uint32_t &read_data, int port) override;
+        bool write(uint32_t address, uint32_t write_data, int port) override;
+        CacheLine readLine(uint32_t address) override;
+        void writeBackLine(CacheLine evictedLine) override;
+        void replace(uint32_t address, CacheLine newLine, CacheLine &evictedLine) override;
+        void invalidateLine(uint32_t address) override;
+        bool contains(uint32_t address) override;
+        bool isMRU(uint32_t address) override;
+        void reload(const uint32_t *mem) override;
+        void save(CheckpointWriter &ckpt) override;
+        bool restore(CheckpointReader &ckpt) override;
+        void printLine(uint32_t address) override;
+        bool probe(uint32_t address, uint32_t &read_data, uint32_t write_data, bool mem_read, bool mem_write) override;
+        bool claimPrefetch(uint32_t address) override;
+};
+
+// Outcome of a lockup-free access
+enum mem_status {
+    MEM_HIT,                        // the line was in L1
+    MEM_MISS,                       // the data moved, its line is on the way (see pending())
+    MEM_BLOCKED                     // no MSHR free, nothing happened, retry later
+};
+
+// The touched pages of a memory image, see Memory::saveImage()
+struct mem_image {
+    std::vector<uint32_t> start;            // first byte of every run of touched pages...
+    std::vector<uint32_t> bytes;            // ...its length...
+    std::vector<uint32_t> words;            // ...and the contents of all of them, in order
 };
 
 class Memory {
     private:
-        std::vector<uint32_t> mem;
-        Cache L1 = Cache("L1", 32768, 8, 12);
-        Cache L2 = Cache("L2", 262144, 8, 59);
+        // MEM_BYTES of a memfd mapped with MAP_NORESERVE: nothing is allocated until
+        // a page is touched, and the file knows which ones were (see touchedRuns())
+        uint32_t *mem;
+        int mem_fd;
+        // split L1, instruction fetches go to L1I and loads and stores to L1D, in
+        // front of the levels they share (L2, L3, victim caches...), nearest first
+        CacheBase *L1I;
+        CacheBase *L1D;
+        std::vector<CacheBase *> shared;
         int opt_level;
+        int num_mshrs;
+        StackProfiler *profiler;
+        Prefetcher *prefetcher[2];          // of L1 (trained on both, fills the L1 of the access) and the first shared level, 0 for none
+        uint32_t missLine[2];               // line of the demand miss in progress, data and fetch (1: none)
+        std::vector<uint32_t> proposed;
+
+        // The L1 an access goes to
+        CacheBase *l1(bool fetch) { return fetch ? L1I : L1D; }
+
+        // The hierarchy as one side sees it: level 0 is its L1, the shared levels follow
+        // and numLevels() stands for memory
+        int numLevels() const { return shared.size() + 1; }
+        CacheBase *level(int k, bool fetch) { return k ? shared[k-1] : l1(fetch); }
+
+        // The level a line found at level k (or memory) is brought into: the nearest one
+        // above it that is not exclusive
+        int fillLevel(int k) {
+            do {
+                k--;
+            } while (k > 0 && shared[k-1]->isExclusive());
+            return k;
+        }
+
+        // Bring a line into level k from the first level below that has it, or memory
+        void fill(int k, uint32_t address, bool fetch, bool prefetched = false);
+
+        // Put a line into level k and deal with the line it evicts
+        void install(int k, uint32_t address, CacheLine &line, bool fetch);
+        void evict(int k, CacheLine &line, bool fetch);
+
+        // A dirty line left level k: the first level below that has it takes the data, or memory
+        void writeBelow(int k, const CacheLine &line);
+
+        // A store put this word into level k (numLevels(): memory). An L1I copy of its
+        // line is stale now, and a write-through level passes the word on.
+        void storeDone(int k, uint32_t address, uint32_t word);
+
+        // Start (or join) the fill of a line into level k (L1I if instr), false if an MSHR
+        // it needs is busy; countdown is the fill's remaining cycles. fetch marks a demand
+        // fetch waiting on it.
+        bool startFill(int k, uint32_t line, bool instr, bool fetch, bool prefetch, int &countdown);
+
+        // warm(): put the tag of a line into level k, the evicted one goes where evict() sends it
+        void warmInstall(int k, uint32_t address, bool fetch);
+
+        // A demand access completed (hit) or started a miss: train the prefetchers
+        // and start the fills they ask for
+        void observe(uint32_t address, uint32_t pc, bool fetch, bool hit);
+
+        // idleCycles() before the prefetch fills in flight are taken into account
+        int idleMissCycles(uint32_t address, bool fetch);
+
+        // Map an empty backing store, exits if the host can't provide one
+        void mapMemory();
+
+        // Runs of touched pages as (first byte, bytes), in address order
+        void touchedRuns(std::vector<std::pair<uint64_t, uint64_t> > &runs);
+
+        // Give every page back, the whole image reads as zeros again
+        void clearMemory();
     public:
         Memory() {
-            mem.resize(2097152, 0);
+            mapMemory();
+            L1I = L1D = 0;
+            num_mshrs = DEFAULT_MSHRS;
+            setCacheConfig("default");
             opt_level = 0;
+            profiler = 0;
+            prefetcher[0] = prefetcher[1] = 0;
+            missLine[0] = missLine[1] = 1;
+        }
+        Memory(const Memory &other) {
+            mapMemory();
+            L1I = L1D = 0;
+            prefetcher[0] = prefetcher[1] = 0;
+            *this = other;
         }
+        Memory &operator=(const Memory &other);
+        ~Memory();
+
+        // Prefetcher of cache level 1 or 2 (see make_prefetcher() for the kinds), from -O1 up.
+        // False for an unknown kind.
+        bool setPrefetcher(int level, const std::string &kind);
+
+        void printPrefetchStats(std::ostream &out) {
+            if (prefetcher[0]) {
+                L1I->printPrefetchStats(out, prefetcher[0]->name());
+                L1D->printPrefetchStats(out, prefetcher[0]->name());
+            }
+            if (prefetcher[1] && !shared.empty())
+                shared[0]->printPrefetchStats(out, prefetcher[1]->name());
+        }
+
+        // Build the cache hierarchy, the caches start out empty. config is one of the
+        // compiled-in configurations by name, or the levels themselves: one per line of
+        // the file config names, or separated by ';'. Each level is
+        //   <name> size=<bytes>[K|M] assoc=<1-64|full> latency=<cycles>
+        //          [inclusion=inclusive|non-inclusive|exclusive] [write=back|through]
+        //          [policy=lru|plru|srrip|brrip|drrip|random]
+        // nearest the pipeline first. The first is l1 (split into L1I and L1D of that
+        // geometry) or l1i followed by l1d, and takes no latency, an L1 hit is part of
+        // the MEM stage. The shared levels follow in any number, the last line is
+        //   memory latency=<cycles>
+        // A level's latency is the load-to-use time of a miss above that it serves, the
+        // lookups on the way overlap it, so an L3 hit takes the L3 latency and not that
+        // plus the L2 one. inclusion says how a level relates to the levels above it
+        // (default inclusive), an exclusive level is a victim cache. policy is the
+        // replacement policy (default lru). A full level is one set, so at most 64 lines.
+        // '#' starts a comment.
+        // Returns false (and keeps the current caches) if there is no such configuration or
+        // it is not valid, printing why.
+        bool setCacheConfig(const std::string &config);
+
+        // Whether setCacheConfig() would accept config, without building the caches
+        static bool checkCacheConfig(const std::string &config);
+
+        // config is one of the compiled-in configurations by name
+        static bool isCacheConfigName(const std::string &config);
+
+        // Names and descriptions of the configurations setCacheConfig() accepts
+        static void listCacheConfigs(std::ostream &out);
+
         void setOptLevel(int level) {
             opt_level = level;
         }
+        // raw word storage, used by the functional engines which bypass the caches;
+        // any 32-bit address divided by 4 is a valid index
+        uint32_t *words() { return mem; }
+        uint32_t numWords() { return MEM_BYTES/4; }
+
+        // Program loading: copy file_bytes of a segment to address and zero the rest of
+        // its mem_bytes (.bss), without touching the pages that are zeroed
+        void loadSegment(uint32_t address, const uint8_t *data, uint32_t file_bytes, uint32_t mem_bytes);
+
+        // Copy the touched part of the image out, and put it back exactly: pages
+        // touched since saveImage() read as zeros again (the caches are left alone)
+        void saveImage(mem_image &image);
+        void restoreImage(const mem_image &image);
         // address is the adress which needs to be read or written from
         // read_data the variable into which data is read, it is passed by reference
         // write_data is the data which is written into the memory address provided
         // mem_read specifies whether memory should be read or not
         // mem_write specifies whether memory whould be written to or not
+        // fetch marks instruction fetches (the stack profiler and the prefetchers tell them apart)
+        // pc is the instruction's address, prefetchers index their tables with it
         // returns false if there is a cache miss (O1 and above) 
         // -- currently follows stall-on-miss model, so call every cycle until you see a hit
-        bool access(uint32_t address, uint32_t &read_data, uint32_t write_data, bool mem_read, bool mem_write);
+        bool access(uint32_t address, uint32_t &read_data, uint32_t write_data, bool mem_read, bool mem_write, bool fetch = false, uint32_t pc = 0);
+
+        // -O1 and up: instruction fetch of n consecutive words from one line in a single access, the
+        // first word is fetched like access() does (false on a miss), the others come
+        // along from the same L1 line
+        bool fetchGroup(uint32_t address, uint32_t *words, int n);
+
+        // -O2 and up: lockup-free caches at every level. A miss takes an MSHR and the access completes
+        // at once, reading or writing wherever the newest copy of the word is, while the
+        // line fill runs in the background; later misses to the same line merge into it
+        // and hits to other lines go on as usual. access() at these levels is this call,
+        // returning true only for MEM_HIT (fetches wait for the line).
+        mem_status accessNonBlocking(uint32_t address, uint32_t &read_data, uint32_t write_data, bool mem_read, bool mem_write, bool fetch = false, uint32_t pc = 0);
+
+        // True while the line holding address is being filled into L1D
+        bool pending(uint32_t address) {
+            return L1D->findMSHR(address & ~(CACHE_LINE_SIZE-1)) != 0;
+        }
+
+        // One cycle passes, fills that complete install their lines (-O1 only has
+        // prefetch fills in flight, -O2 and up also the demand misses)
+        void tick();
+
+        // MSHRs per cache level (-O2 and up)
+        void setMSHRs(int n) {
+            num_mshrs = n;
+            L1I->setMSHRs(n);
+            L1D->setMSHRs(n);
+            for (size_t i = 0; i < shared.size(); i++)
+                shared[i]->setMSHRs(n);
+        }
+
+        void printMSHRStats(std::ostream &out) {
+            L1I->printMSHRStats(out);
+            L1D->printMSHRStats(out);
+            for (size_t i = 0; i < shared.size(); i++)
+                shared[i]->printMSHRStats(out);
+        }
+
+        // Every completed read or write is also recorded here (0 to stop). At -O0 that is
+        // exactly the program's address stream, one access per load or store. From -O1 up,
+        // at any width, the pipeline adds its refetches, and every sb and sh is a read of the
+        // word it merges into followed by the write.
+        void setProfiler(StackProfiler *p) {
+            profiler = p;
+        }
+
+        // Number of upcoming access() calls to this address (a fetch or not) that would do
+        // nothing but count down outstanding misses, so a frozen pipeline can skip them in
+        // one step
+        int idleCycles(uint32_t address, bool fetch);
+
+        // Functional cache warming: update tags and replacement state as an access to this
+        // address would, without timing. Line data is not kept coherent, call syncCaches()
+        // before the caches are used for timing again.
+        void warm(uint32_t address, bool fetch);
+
+        // Make every cached line match mem again (mem is authoritative while warming)
+        // and forget outstanding misses and fills
+        void syncCaches() {
+            L1I->reload(mem);
+            L1D->reload(mem);
+            for (size_t i = 0; i < shared.size(); i++)
+                shared[i]->reload(mem);
+            missLine[0] = missLine[1] = 1;
+        }
+
+        // Hits, misses, writebacks and MPKI of each level, after the counter "instructions"
+        void registerStats(StatsRegistry &stats);
+
+        // Checkpointing: every cache and the touched pages of the memory image
+        void save(CheckpointWriter &ckpt);
+        bool restore(CheckpointReader &ckpt);
+
+        // A hit the frozen pipeline repeats every cycle (the fetch it drops and redoes) can
+        // be skipped with the idle cycles if it stays a hit (the miss it waits with may have
+        // evicted its line) and nothing but the hit counter sees it: no L1 prefetcher trains
+        // on it and no profiler records it
+        bool repeatableHit(uint32_t address, bool fetch) {
+            return !prefetcher[0] && !profiler && l1(fetch)->contains(address);
+        }
+
+        // Count the hits of n skipped repeats
+        void skipHits(int n, bool fetch) {
+            l1(fetch)->countHit(n);
+        }
+
+        // Skip n cycles returned by idleCycles() for the same access
+        void skipCycles(int n, uint32_t address, bool fetch);
 
         // given a starting address and number of words from that starting address
         // this function prints int values at the memory
@@ -0,0 +1,432 @@
+#include <iostream>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <functional>
+#include <getopt.h>
+#include "processor.h"
+
+using namespace std;
+
+// Host-side speed of the simulator itself: simulated instructions per host
+// second of every engine on a few synthetic MIPS kernels, and cache lookups
+// per second of the memory hierarchy on its own. Every measurement runs once
+// to warm up and then --reps times; the median, min and max are reported and
+// the simulated cycles must come out the same in every run. Kernels that check
+// their own results must also find no mismatch on any engine. Run with make bench.
+
+#define DATA_BASE 0x10000000        // kernels keep their data here, the code starts at 0
+
+enum { ZERO = 0, T0 = 8, T1, T2, T3, T4, T5, T6, T7, S0, S1, S2, S3, S4, T8 = 24, T9 };
+
+// Just enough of a MIPS assembler for the kernels
+class Asm {
+    public:
+        vector<uint32_t> code;
+
+        uint32_t pc() { return code.size() * 4; }
+
+        void r(int funct, int rd, int rs, int rt, int shamt = 0) {
+            code.push_back(rs << 21 | rt << 16 | rd << 11 | shamt << 6 | funct);
+        }
+        void i(int op, int rt, int rs, uint32_t imm) {
+            code.push_back(op << 26 | rs << 21 | rt << 16 | (imm & 0xffff));
+        }
+
+        void addu(int rd, int rs, int rt) { r(0x21, rd, rs, rt); }
+        void subu(int rd, int rs, int rt) { r(0x23, rd, rs, rt); }
+        void and_(int rd, int rs, int rt) { r(0x24, rd, rs, rt); }
+        void or_(int rd, int rs, int rt) { r(0x25, rd, rs, rt); }
+        void nor(int rd, int rs, int rt) { r(0x27, rd, rs, rt); }
+        void slt(int rd, int rs, int rt) { r(0x2a, rd, rs, rt); }
+        void sll(int rd, int rt, int shamt) { r(0x00, rd, 0, rt, shamt); }
+        void srl(int rd, int rt, int shamt) { r(0x02, rd, 0, rt, shamt); }
+        void addiu(int rt, int rs, int imm) { i(0x9, rt, rs, imm); }
+        void andi(int rt, int rs, int imm) { i(0xc, rt, rs, imm); }
+        void ori(int rt, int rs, int imm) { i(0xd, rt, rs, imm); }
+        void lui(int rt, int imm) { i(0xf, rt, 0, imm); }
+        void lw(int rt, int offset, int base) { i(0x23, rt, base, offset); }
+        void sw(int rt, int offset, int base) { i(0x2b, rt, base, offset); }
+        void sh(int rt, int offset, int base) { i(0x29, rt, base, offset); }
+        void sb(int rt, int offset, int base) { i(0x28, rt, base, offset); }
+
+        void li(int rt, uint32_t v) {
+            lui(rt, v >> 16);
+            ori(rt, rt, v & 0xffff);
+        }
+
+        // no xor in this ISA: (a | b) & ~(a & b), clobbers T8 and T9
+        void xor_(int rd, int rs, int rt) {
+            or_(T8, rs, rt);
+            and_(T9, rs, rt);
+            nor(T9, T9, T9);
+            and_(rd, T8, T9);
+        }
+
+        // beq/bne to a label placed before
+        void beq(int rs, int rt, uint32_t target) { i(0x4, rt, rs, (target - pc() - 4) >> 2); }
+        void bne(int rs, int rt, uint32_t target) { i(0x5, rt, rs, (target - pc() - 4) >> 2); }
+
+        // beq/bne forward: returns the branch to hand to bind() once the target is reached
+        size_t beqForward(int rs, int rt) { i(0x4, rt, rs, 0); return code.size() - 1; }
+        size_t bneForward(int rs, int rt) { i(0x5, rt, rs, 0); return code.size() - 1; }
+        void bind(size_t branch) { code[branch] |= ((pc() - branch*4 - 4) >> 2) & 0xffff; }
+};
+
+// Independent and dependent ALU operations, 10 instructions an iteration
+static void build_alu(Asm &a, vector<uint32_t> &data, uint32_t n) {
+    a.li(T0, n);
+    uint32_t loop = a.pc();
+    a.addu(T1, T1, T2);
+    a.addiu(T2, T2, 3);
+    a.or_(T3, T1, T2);
+    a.sll(T4, T3, 2);
+    a.subu(T5, T4, T1);
+    a.and_(T6, T5, T3);
+    a.slt(T7, T6, T4);
+    a.nor(S0, T7, T5);
+    a.addiu(T0, T0, -1);
+    a.bne(T0, ZERO, loop);
+}
+
+// Dependent loads through a random cycle of 16K lines (1 MB, past L2), 3 instructions an iteration
+static void build_chase(Asm &a, vector<uint32_t> &data, uint32_t n) {
+    const int lines = 16384, words = CACHE_LINE_SIZE / 4;
+    vector<uint32_t> order(lines);
+    for (int i = 0; i < lines; i++)
+        order[i] = i;
+    mt19937 rng(1);
+    for (int i = lines - 1; i > 0; i--)
+        swap(order[i], order[rng() % (i + 1)]);
+    data.assign(lines * words, 0);
+    for (int i = 0; i < lines; i++)
+        data[order[i] * words] = DATA_BASE + order[(i + 1) % lines] * CACHE_LINE_SIZE;
+
+    a.li(T1, DATA_BASE + order[0] * CACHE_LINE_SIZE);
+    a.li(T0, n);
+    uint32_t loop = a.pc();
+    a.lw(T1, 0, T1);
+    a.addiu(T0, T0, -1);
+    a.bne(T0, ZERO, loop);
+}
+
+// Sequential stores, 16 bytes and 8 instructions an iteration
+static void build_stream(Asm &a, vector<uint32_t> &data, uint32_t n) {
+    a.li(T1, DATA_BASE);
+    a.li(T0, n);
+    uint32_t loop = a.pc();
+    a.sw(T2, 0, T1);
+    a.sw(T2, 4, T1);
+    a.sw(T2, 8, T1);
+    a.sw(T2, 12, T1);
+    a.addiu(T1, T1, 16);
+    a.addiu(T2, T2, 1);
+    a.addiu(T0, T0, -1);
+    a.bne(T0, ZERO, loop);
+}
+
+// Three branches on the bits of a xorshift32 sequence, 24 to 27 instructions an iteration
+static void build_branchy(Asm &a, vector<uint32_t> &data, uint32_t n) {
+    a.li(S0, 2463534242u);
+    a.li(T0, n);
+    uint32_t loop = a.pc();
+    a.sll(T1, S0, 13);
+    a.xor_(S0, S0, T1);
+    a.srl(T1, S0, 17);
+    a.xor_(S0, S0, T1);
+    a.sll(T1, S0, 5);
+    a.xor_(S0, S0, T1);
+    a.andi(T2, S0, 1);
+    size_t skip = a.beqForward(T2, ZERO);
+    a.addiu(S1, S1, 1);
+    a.bind(skip);
+    a.andi(T2, S0, 2);
+    skip = a.bneForward(T2, ZERO);
+    a.addiu(S2, S2, 1);
+    a.bind(skip);
+    a.andi(T2, S0, 4);
+    skip = a.beqForward(T2, ZERO);
+    a.addiu(S3, S3, 1);
+    a.bind(skip);
+    a.addiu(T0, T0, -1);
+    a.bne(T0, ZERO, loop);
+}
+
+// sh and sb over a 64 KB buffer, each checked by a lw of the word against the merge
+// of its old value, mismatches counted in S2; 19 instructions an iteration
+static void build_partial(Asm &a, vector<uint32_t> &data, uint32_t n) {
+    data.resize(16384);
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (uint32_t)i * 2654435761u;
+
+    a.li(T6, DATA_BASE);
+    a.or_(T1, T6, ZERO);
+    a.li(S3, 0xffff0000);
+    a.li(S4, 0xffffff00);
+    a.li(T0, n);
+    uint32_t loop = a.pc();
+    a.lw(T7, 0, T1);
+    a.sh(T0, 0, T1);
+    a.lw(T3, 0, T1);
+    a.and_(T4, T7, S3);
+    a.andi(T2, T0, 0xffff);
+    a.or_(T4, T4, T2);
+    size_t ok = a.beqForward(T3, T4);
+    a.addiu(S2, S2, 1);
+    a.bind(ok);
+    a.lw(T7, 4, T1);
+    a.sb(T0, 4, T1);
+    a.lw(T3, 4, T1);
+    a.and_(T4, T7, S4);
+    a.andi(T2, T0, 0xff);
+    a.or_(T4, T4, T2);
+    ok = a.beqForward(T3, T4);
+    a.addiu(S2, S2, 1);
+    a.bind(ok);
+    a.addiu(T5, T5, 8);
+    a.andi(T5, T5, 0xfff8);
+    a.addu(T1, T5, T6);
+    a.addiu(T0, T0, -1);
+    a.bne(T0, ZERO, loop);
+}
+
+struct kernel {
+    const char *name;
+    void (*build)(Asm &a, vector<uint32_t> &data, uint32_t iterations);
+    int insts;                      // per iteration, to size the runs
+    int timed_scale;                // the engines with caches run 1/this of the instructions
+    int check_reg;                  // holds the number of mismatches the kernel found, or ZERO
+};
+
+static const kernel kernels[] = {
+    {"alu", build_alu, 10, 1, ZERO},
+    {"pointer-chase", build_chase, 3, 20, ZERO},
+    {"stream-store", build_stream, 8, 1, ZERO},
+    {"branchy", build_branchy, 25, 1, ZERO},
+    {"partial-store", build_partial, 19, 1, S2},
+};
+
+struct engine {
+    const char *name;
+    int level;
+    int width;
+    bool fast;
+    bool jit;
+    uint64_t insts;                 // simulated per run, a tenth of a second or so
+};
+
+static const engine engines[] = {
+    {"single-cycle", 0, 1, false, false, 4000000},
+    {"fast", 0, 1, true, false, 40000000},
+    {"jit", 0, 1, true, true, 200000000},
+    {"pipelined-O1", 1, 1, false, false, 1000000},
+    {"pipelined-O2", 2, 1, false, false, 1000000},
+    {"4-wide-O2", 2, 4, false, false, 500000},
+    {"ooo-O3", 3, 4, false, false, 500000},
+};
+
+// Address streams for the caches on their own
+enum { STREAM_L1, STREAM_RANDOM };
+static const char *streams[] = { "l1-resident", "random-1mb" };
+static const uint64_t stream_lookups[] = { 4000000, 100000 };
+
+struct result {
+    uint64_t work;                  // instructions or lookups
+    uint64_t cycles;
+    double seconds;
+    bool correct;                   // the kernel found no mismatch
+};
+
+static result run_kernel(const engine &e, const kernel &k) {
+    Memory memory;
+    Processor processor(&memory);
+    Asm a;
+    vector<uint32_t> data;
+    k.build(a, data, e.insts / k.insts / (e.level ? k.timed_scale : 1));
+    memory.loadSegment(0, (const uint8_t *)a.code.data(), a.pc(), a.pc());
+    if (!data.empty())
+        memory.loadSegment(DATA_BASE, (const uint8_t *)data.data(), data.size() * 4, data.size() * 4);
+    uint32_t end_pc = a.pc();
+
+    processor.set_width(e.width);
+    processor.set_window(DEFAULT_ROB_SIZE, DEFAULT_IQ_SIZE);
+    processor.set_entry(0);
+    processor.initialize(e.level);
+    memory.setOptLevel(e.level);
+    if (e.jit)
+        processor.enable_jit();
+
+    result r;
+    r.cycles = 0;
+    auto start = chrono::steady_clock::now();
+    if (e.fast) {
+        processor.load_program(0, end_pc);
+        r.cycles = processor.fast_forward(UINT64_MAX);
+        r.work = r.cycles;
+    } else {
+        while (processor.getPC() <= end_pc) {
+            processor.advance();
+            r.cycles++;
+            r.cycles += processor.skip_idle_cycles();
+        }
+        r.work = processor.get_retired();
+    }
+    r.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    r.correct = processor.get_regs()[k.check_reg].value == 0;
+    return r;
+}
+
+// Word loads through access() at -O1 (retried until they complete, every call is a
+// cycle) or accessNonBlocking() at -O2 (one tick a call)
+static result run_cache(int level, int stream, uint64_t lookups) {
+    Memory memory;
+    memory.setOptLevel(level);
+    uint32_t x = 1;
+    result r;
+    r.cycles = 0;
+    auto start = chrono::steady_clock::now();
+    for (uint64_t i = 0; i < lookups; i++) {
+        uint32_t address;
+        if (stream == STREAM_L1) {
+            address = DATA_BASE + (i * 4) % 16384;
+        } else {
+            x = x * 1664525 + 1013904223;
+            address = DATA_BASE + (x >> 12) * CACHE_LINE_SIZE % (1 << 20);
+        }
+        uint32_t read_data;
+        if (level == 1) {
+            do {
+                r.cycles++;
+            } while (!memory.access(address, read_data, 0, true, false));
+        } else {
+            do {
+                r.cycles++;
+                memory.tick();
+            } while (memory.accessNonBlocking(address, read_data, 0, true, false) == MEM_BLOCKED);
+        }
+    }
+    r.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    r.work = lookups;
+    r.correct = true;
+    return r;
+}
+
+static bool csv = false;
+
+// Runs one measurement reps times after a warm-up and prints a line of the report
+static void measure(const string &engine_name, const string &workload, int reps, function<result()> run) {
+    run();
+    vector<double> rates;
+    result first = run();
+    bool repeatable = true, correct = first.correct;
+    rates.push_back(first.work / first.seconds / 1e6);
+    for (int i = 1; i < reps; i++) {
+        result r = run();
+        repeatable &= r.work == first.work && r.cycles == first.cycles;
+        correct &= r.correct;
+        rates.push_back(r.work / r.seconds / 1e6);
+    }
+    sort(rates.begin(), rates.end());
+    double median = rates.size() % 2 ? rates[rates.size()/2] : (rates[rates.size()/2 - 1] + rates[rates.size()/2]) / 2;
+    if (csv) {
+        printf("%s,%s,%llu,%llu,%.3f,%.3f,%.3f,%d,%d\n", engine_name.c_str(), workload.c_str(),
+               (unsigned long long)first.work, (unsigned long long)first.cycles, median, rates.front(), rates.back(), repeatable, correct);
+    } else {
+        printf("%-14s %-14s %11llu %12llu %10.2f %10.2f %10.2f %6.1f%%%s%s\n", engine_name.c_str(), workload.c_str(),
+               (unsigned long long)first.work, (unsigned long long)first.cycles, median, rates.front(), rates.back(),
+               median ? (rates.back() - rates.front()) / median * 100 : 0.0, repeatable ? "" : "  NOT REPEATABLE",
+               correct ? "" : "  WRONG RESULT");
+    }
+    fflush(stdout);
+}
+
+static void print_help() {
+    cout << "Usage: microbench [options]\n"
+            "--reps <n>                           Measured runs of each benchmark, after one warm-up\n"
+            "                                     (default 5)\n"
+            "--engine <name>                      Only engines whose name contains this\n"
+            "--kernel <name>                      Only kernels (and cache streams) whose name contains this\n"
+            "--csv                                engine,workload,work,cycles,median,min,max,repeatable,\n"
+            "                                     correct\n"
+            "The work is simulated instructions, lookups for the cache engines; the rates are\n"
+            "millions of them per host second.\n"
+            "Engines:";
+    for (size_t i = 0; i < sizeof(engines)/sizeof(engines[0]); i++)
+        cout << " " << engines[i].name;
+    cout << " cache-O1 cache-O2\nKernels:";
+    for (size_t i = 0; i < sizeof(kernels)/sizeof(kernels[0]); i++)
+        cout << " " << kernels[i].name;
+    cout << "\nCache streams: " << streams[0] << " " << streams[1] << "\n";
+}
+
+int main(int argc, char *argv[]) {
+    static struct option long_options[] = {
+        {"reps", required_argument, 0, 'r'},
+        {"engine", required_argument, 0, 'e'},
+        {"kernel", required_argument, 0, 'k'},
+        {"csv", no_argument, 0, 'c'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+    int reps = 5;
+    string only_engine, only_kernel;
+    int c;
+    while ((c = getopt_long(argc, argv, "r:e:k:ch", long_options, 0)) != -1) {
+        switch (c) {
+            case 'r':
+                reps = atoi(optarg);
+                break;
+            case 'e':
+                only_engine = optarg;
+                break;
+            case 'k':
+                only_kernel = optarg;
+                break;
+            case 'c':
+                csv = true;
+                break;
+            default:
+                print_help();
+                return c == 'h' ? 0 : 1;
+        }
+    }
+    if (reps < 1) {
+        cout << "--reps must be positive\n";
+        return 1;
+    }
+
+    if (csv) {
+        printf("engine,workload,work,cycles,median,min,max,repeatable,correct\n");
+    } else {
+        printf("%-14s %-14s %11s %12s %10s %10s %10s %7s\n", "engine", "workload", "work", "sim cycles",
+               "M/s med", "min", "max", "spread");
+    }
+    for (size_t i = 0; i < sizeof(engines)/sizeof(engines[0]); i++) {
+        if (string(engines[i].name).find(only_engine) == string::npos)
+            continue;
+        for (size_t j = 0; j < sizeof(kernels)/sizeof(kernels[0]); j++) {
+            if (string(kernels[j].name).find(only_kernel) == string::npos)
+                continue;
+            const engine &e = engines[i];
+            const kernel &k = kernels[j];
+            measure(e.name, k.name, reps, [&] { return run_kernel(e, k); });
+        }
+    }
+    for (int level = 1; level <= 2; level++) {
+        string name = "cache-O" + to_string(level);
+        if (name.find(only_engine) == string::npos)
+            continue;
+        for (int s = STREAM_L1; s <= STREAM_RANDOM; s++) {
+            if (string(streams[s]).find(only_kernel) == string::npos)
+                continue;
+            measure(name, streams[s], reps, [=] { return run_cache(level, s, stream_lookups[s]); });
+        }
+    }
+    return 0;
+}
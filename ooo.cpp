@@ -0,0 +1,361 @@
+#include <cstdint>
+#include <iostream>
+#include <algorithm>
+#include "processor.h"
+#include "control.h"
+using namespace std;
+
+#ifdef ENABLE_DEBUG
+#define DEBUG(x) x
+#else
+#define DEBUG(x)
+#endif
+
+//Out-of-order core of -O3 and up. The stages run from commit back to fetch so an
+//instruction moves at most one stage per cycle: fetched in one cycle, it is renamed
+//and dispatched in the next, issues once its operands are there, completes after
+//its latency (a load that missed: when its line arrives) and commits in order.
+//An ALU result wakes up its users in time to issue the cycle after their producer.
+//
+//Stores write memory at commit; an issued load takes its data from the youngest
+//older store to the same word or else from the cache. At -O3 a load waits until
+//every older store knows its address, at -O4 it goes ahead and a store that finds
+//a younger load to its word already done squashes from that load.
+
+void Processor::ooo_reset(){
+	rob.assign(rob_size, rob_entry());
+	rob_head = rob_count = 0;
+	iq.clear();
+	fetch_queue.clear();
+	regfile.initRename(rob_size); //one destination per ROB entry at most
+	ooo_cycle = 0;
+	rob_occupancy = rob_full_cycles = iq_full_cycles = head_miss_cycles = 0;
+	branch_squashes = order_squashes = 0;
+}
+
+void Processor::ooo_processor_advance(){
+	memory->tick();
+	rob_occupancy += rob_count;
+
+	ooo_commit();
+	ooo_complete();
+	ooo_issue();
+	ooo_dispatch();
+	ooo_fetch();
+	ooo_cycle++;
+}
+
+void Processor::ooo_fetch(){
+	if ((int)fetch_queue.size() + width > FETCH_QUEUE_SIZE)
+		return;
+
+	//like wide_fetch(): the rest of an aligned group, up to a predicted taken branch
+	uint32_t words[MAX_WIDTH];
+	int n = width - (processor_pc / 4) % width;
+	if (!memory->fetchGroup(processor_pc, words, n))
+		return;
+	for (int i = 0; i < n; i++){
+		IF_ID f = IF_ID();
+		f.instruction = words[i];
+		f.pc = processor_pc;
+		f.valid = true;
+		processor_pc = bpu.predict(processor_pc, f.branch);
+		fetch_queue.push_back(f);
+		if (processor_pc != f.pc + 4)
+			break;
+	}
+}
+
+void Processor::ooo_dispatch(){
+	int n = 0;
+	for (; n < width && !fetch_queue.empty(); n++){
+		if (rob_count == rob_size){
+			rob_full_cycles++;
+			break;
+		}
+		if ((int)iq.size() == iq_size){
+			iq_full_cycles++;
+			break;
+		}
+
+		IF_ID f = fetch_queue.front();
+		fetch_queue.erase(fetch_queue.begin());
+		int i = rob_index(rob_count++);
+		rob_entry &e = rob[i];
+		e = rob_entry();
+		uint32_t instruction = f.instruction;
+		e.pc = f.pc;
+		e.branch = f.branch;
+		e.control.decode(instruction);
+		e.opcode = (instruction >> 26) & 0x3f;
+		e.rs = (instruction >> 21) & 0x1f;
+		e.rt = (instruction >> 16) & 0x1f;
+		e.rd = (instruction >> 11) & 0x1f;
+		e.shamt = (instruction >> 6) & 0x1f;
+		e.funct = instruction & 0x3f;
+		e.imm = instruction & 0xffff;
+		e.addr = instruction & 0x3ffffff;
+		const control_t &ctrl = e.control;
+
+		//sources before the destination is renamed, an instruction may read what it writes
+		bool reads[2] = { !ctrl.shift && !(ctrl.jump && !ctrl.jump_reg), !ctrl.ALU_src || ctrl.mem_write };
+		int regs[2] = { e.rs, e.rt };
+		for (int k = 0; k < 2; k++){
+			e.src[k] = -1;
+			e.value[k] = 0;
+			if (!reads[k] || !regs[k])
+				continue;
+			int p = regfile.mapping(regs[k]);
+			if (p < 0)
+				e.value[k] = regfile.data()[regs[k]].value;
+			else if (regfile.physReg(p).ready)
+				e.value[k] = regfile.physReg(p).value;
+			else
+				e.src[k] = p;
+		}
+		e.dest = ctrl.reg_write ? (ctrl.link ? 31 : ctrl.reg_dest ? e.rd : e.rt) : 0;
+		e.phys = e.dest ? regfile.rename(e.dest) : -1;
+		iq.push_back(i);
+
+		//j and jal go where they go, a wrong guess only loses the fetch queue
+		branch_record &br = e.branch;
+		if (ctrl.branch || ctrl.bne)
+			br.kind = BR_COND;
+		if (ctrl.jump){
+			br.kind = ctrl.jump_reg ? (e.rs == 31 ? BR_RETURN : BR_INDIRECT) : ctrl.link ? BR_CALL : BR_JUMP;
+			br.taken = true;
+			if (!ctrl.jump_reg){
+				br.target = ((e.pc + 4) & 0xf0000000) | (e.addr << 2);
+				if (br.target != br.predicted_pc){
+					fetch_queue.clear();
+					processor_pc = br.target;
+					bpu.recover(e.pc, br);
+					branch_flushes++;
+					DEBUG(cout << "Jump redirects fetch to 0x" << hex << processor_pc << dec << "\n");
+					n++;
+					break;
+				}
+			}
+		}
+	}
+}
+
+void Processor::ooo_execute(rob_entry &e){
+	const control_t &ctrl = e.control;
+	uint32_t imm = ctrl.zero_extend ? e.imm : (e.imm >> 15) ? 0xffff0000 | e.imm : e.imm;
+	uint32_t operand_1 = ctrl.shift ? e.shamt : e.value[0];
+	uint32_t operand_2 = ctrl.ALU_src ? imm : e.value[1];
+	uint32_t alu_zero = 0;
+	e.result = alu.execute(ctrl.ALU_operation, operand_1, operand_2, alu_zero);
+	//jal writes its return address to $31
+	if (ctrl.link)
+		e.result = e.pc + 8;
+
+	branch_record &br = e.branch;
+	if (ctrl.branch || ctrl.bne){
+		br.taken = ctrl.bne ? alu_zero == 0 : alu_zero == 1;
+		br.target = e.pc + 4 + (imm << 2);
+	}
+	if (ctrl.jump_reg)
+		br.target = e.value[0];
+	e.ready_cycle = ooo_cycle + 1;
+}
+
+bool Processor::ooo_execute_mem(int i){
+	rob_entry &e = rob[i];
+	const control_t &ctrl = e.control;
+	uint32_t imm = (e.imm >> 15) ? 0xffff0000 | e.imm : e.imm;
+	uint32_t address = e.value[0] + imm;
+	uint32_t word = address & ~3u;
+	int age = rob_age(i);
+
+	if (ctrl.mem_write){
+		e.address = address;
+		e.result = e.value[1];
+		e.ready_cycle = ooo_cycle + 1;
+		//-O4: a younger load to this word went ahead of us and read stale data
+		if (opt_level >= 4){
+			for (int n = age + 1; n < rob_count; n++){
+				const rob_entry &l = rob[rob_index(n)];
+				if (l.control.mem_read && l.issued && (l.address & ~3u) == word){
+					order_squashes++;
+					DEBUG(cout << "Load at 0x" << hex << l.pc << dec << " issued before an older store, squashing\n");
+					ooo_squash(n, l.pc);
+					bpu.recover(l.pc, l.branch);
+					break;
+				}
+			}
+		}
+		return true;
+	}
+
+	//the youngest older store to this word has the data, if it is a full word for a
+	//full word load; anything else waits until that store has written memory
+	bool partial = ctrl.halfword || ctrl.byte;
+	for (int n = age - 1; n >= 0; n--){
+		rob_entry &s = rob[rob_index(n)];
+		if (!s.control.mem_write)
+			continue;
+		if (!s.issued){
+			if (opt_level >= 4)
+				continue;
+			return false;
+		}
+		if ((s.address & ~3u) != word)
+			continue;
+		if (partial || s.control.halfword || s.control.byte)
+			return false;
+		e.address = address;
+		e.result = s.result;
+		e.ready_cycle = ooo_cycle + LOAD_HIT_LATENCY;
+		return true;
+	}
+
+	uint32_t read_data = 0;
+	mem_status status = memory->accessNonBlocking(address, read_data, 0, 1, 0, false, e.pc);
+	if (status == MEM_BLOCKED)
+		return false;
+	e.address = address;
+	e.result = read_data & (ctrl.halfword ? 0xffff : ctrl.byte ? 0xff : 0xffffffff);
+	e.miss = status == MEM_MISS;
+	e.ready_cycle = ooo_cycle + LOAD_HIT_LATENCY;
+	return true;
+}
+
+void Processor::ooo_issue(){
+	int issued = 0;
+	bool mem_issued = false;
+	for (size_t k = 0; k < iq.size() && issued < width; ){
+		int i = iq[k];
+		rob_entry &e = rob[i];
+		bool mem = e.control.mem_read || e.control.mem_write;
+		//select: oldest first, operands captured, one load/store unit
+		if (e.src[0] >= 0 || e.src[1] >= 0 || (mem && mem_issued)){
+			k++;
+			continue;
+		}
+		if (mem){
+			//a store may squash younger instructions, the issue queue with them
+			size_t before = iq.size();
+			iq.erase(iq.begin() + k);
+			if (!ooo_execute_mem(i)){
+				iq.insert(iq.begin() + k, i);
+				k++;
+				continue;
+			}
+			mem_issued = true;
+			e.issued = true;
+			issued++;
+			if (iq.size() != before - 1)
+				break;
+			continue;
+		}
+		ooo_execute(e);
+		e.issued = true;
+		issued++;
+		iq.erase(iq.begin() + k);
+	}
+}
+
+void Processor::ooo_complete(){
+	for (int n = 0; n < rob_count; n++){
+		int i = rob_index(n);
+		rob_entry &e = rob[i];
+		if (!e.issued || e.done)
+			continue;
+		if (e.miss ? memory->pending(e.address) : e.ready_cycle > ooo_cycle)
+			continue;
+		e.done = true;
+
+		//wakeup: users waiting in the issue queue capture the value
+		if (e.phys >= 0){
+			PhysReg &p = regfile.physReg(e.phys);
+			p.value = e.result;
+			p.ready = true;
+			for (size_t k = 0; k < iq.size(); k++){
+				rob_entry &u = rob[iq[k]];
+				for (int s = 0; s < 2; s++){
+					if (u.src[s] == e.phys){
+						u.src[s] = -1;
+						u.value[s] = e.result;
+					}
+				}
+			}
+		}
+
+		//branches and jr resolve here, fetch went the wrong way: everything younger goes
+		const branch_record &br = e.branch;
+		if (!e.control.branch && !e.control.bne && !e.control.jump_reg)
+			continue;
+		uint32_t next_pc = br.taken ? br.target : e.pc + 4;
+		if (next_pc != br.predicted_pc){
+			branch_squashes++;
+			DEBUG(cout << "Mispredicted branch, redirecting to " << next_pc << "\n");
+			ooo_squash(n + 1, next_pc);
+			bpu.recover(e.pc, br);
+			branch_flushes++;
+			break;
+		}
+	}
+}
+
+void Processor::ooo_squash(int keep, uint32_t pc){
+	for (int n = keep; n < rob_count; n++){
+		const rob_entry &e = rob[rob_index(n)];
+		if (e.phys >= 0)
+			regfile.release(e.phys);
+	}
+	iq.erase(remove_if(iq.begin(), iq.end(), [&](int i){ return rob_age(i) >= keep; }), iq.end());
+	rob_count = keep;
+	regfile.clearMap();
+	for (int n = 0; n < rob_count; n++){
+		const rob_entry &e = rob[rob_index(n)];
+		if (e.phys >= 0)
+			regfile.remap(e.dest, e.phys);
+	}
+	fetch_queue.clear();
+	processor_pc = pc;
+}
+
+void Processor::ooo_commit(){
+	for (int n = 0; n < width && rob_count; n++){
+		rob_entry &e = rob[rob_head];
+		const control_t &ctrl = e.control;
+		if (!e.done){
+			head_miss_cycles += e.miss;
+			break;
+		}
+
+		if (ctrl.mem_write){
+			//sb and sh first read the word they merge into
+			uint32_t read_data = 0;
+			if ((ctrl.halfword || ctrl.byte) &&
+					memory->accessNonBlocking(e.address, read_data, 0, 1, 0, false, e.pc) == MEM_BLOCKED)
+				break;
+			uint32_t write_data = ctrl.halfword ? (read_data & 0xffff0000) | (e.result & 0xffff) :
+							ctrl.byte ? (read_data & 0xffffff00) | (e.result & 0xff) : e.result;
+			if (memory->accessNonBlocking(e.address, read_data, write_data, 0, 1, false, e.pc) == MEM_BLOCKED)
+				break;
+		}
+
+		if (e.phys >= 0)
+			regfile.commit(e.dest, e.phys);
+		retired++;
+		if (tracer)
+			tracer->commit(e.pc, e.dest ? e.dest : -1, e.result);
+		if (ctrl.branch || ctrl.bne || ctrl.jump)
+			bpu.resolve(e.pc, e.branch);
+		regfile.pc = e.pc;
+		rob_head = (rob_head + 1) % rob_size;
+		rob_count--;
+	}
+}
+
+void Processor::print_ooo_stats(ostream &out){
+	out << "Out-of-order core: " << rob_size << " ROB entries, " << iq_size << " issue queue entries, width " << width << "\n"
+	    << "Average ROB occupancy " << (ooo_cycle ? (double)rob_occupancy / ooo_cycle : 0.0)
+	    << ", dispatch stalled on a full ROB " << rob_full_cycles << " cycles, on a full issue queue "
+	    << iq_full_cycles << " cycles\n"
+	    << "Commit waited on a load miss " << head_miss_cycles << " cycles, squashed "
+	    << branch_squashes << " times for branches and " << order_squashes << " for loads ahead of stores\n";
+}
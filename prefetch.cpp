@@ -0,0 +1,131 @@
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "prefetch.h"
+#include "memory.h"
+
+using namespace std;
+
+const char *prefetcher_kinds = "none, next-line, stride, stream";
+
+bool make_prefetcher(const string &kind, Prefetcher *&pf) {
+    pf = 0;
+    if (kind == "none")
+        return true;
+    if (kind == "next-line")
+        pf = new NextLinePrefetcher();
+    else if (kind == "stride")
+        pf = new StridePrefetcher();
+    else if (kind == "stream")
+        pf = new StreamPrefetcher();
+    return pf != 0;
+}
+
+void NextLinePrefetcher::observe(const prefetch_event &e, vector<uint32_t> &lines) {
+    if (e.hit && !e.prefetch_hit)
+        return;
+    uint32_t line = e.address & ~(CACHE_LINE_SIZE-1);
+    for (int d = 1; d <= PREFETCH_DEGREE; d++)
+        lines.push_back(line + d*CACHE_LINE_SIZE);
+}
+
+void StridePrefetcher::observe(const prefetch_event &e, vector<uint32_t> &lines) {
+    if (e.fetch)
+        return;
+    entry &t = table[(e.pc >> 2) % STRIDE_TABLE_SIZE];
+    if (t.pc != e.pc) {
+        t.pc = e.pc;
+        t.last = e.address;
+        t.stride = 0;
+        t.confidence = 0;
+        return;
+    }
+    int32_t delta = e.address - t.last;
+    if (delta == t.stride && delta != 0) {
+        if (t.confidence < 3)
+            t.confidence++;
+    } else if (t.confidence > 0) {
+        t.confidence--;
+    } else {
+        t.stride = delta;
+    }
+    t.last = e.address;
+    if (t.confidence < 2)
+        return;
+
+    // strides below a line ask for the same line several times, the first is enough
+    uint32_t line = e.address & ~(CACHE_LINE_SIZE-1);
+    for (int d = 1; d <= PREFETCH_DEGREE; d++) {
+        uint32_t next = (e.address + d*t.stride) & ~(CACHE_LINE_SIZE-1);
+        if (next != line) {
+            lines.push_back(next);
+            line = next;
+        }
+    }
+}
+
+void StridePrefetcher::save(CheckpointWriter &ckpt) {
+    ckpt.put(table.data(), table.size()*sizeof(entry));
+}
+
+bool StridePrefetcher::restore(CheckpointReader &ckpt) {
+    return ckpt.get(table.data(), table.size()*sizeof(entry));
+}
+
+void StreamPrefetcher::observe(const prefetch_event &e, vector<uint32_t> &lines) {
+    if (e.hit && !e.prefetch_hit)
+        return;
+    uint32_t line = e.address / CACHE_LINE_SIZE;
+    now++;
+
+    stream *s = 0;
+    for (int i = 0; i < STREAM_COUNT && !s; i++) {
+        stream &c = streams[i];
+        if (!c.valid)
+            continue;
+        int32_t ahead = (int32_t)(line - c.last);
+        if (c.dir ? ahead * c.dir > 0 && ahead * c.dir <= STREAM_DISTANCE + PREFETCH_DEGREE
+                  : ahead == 1 || ahead == -1) {
+            s = &c;
+        }
+    }
+    if (!s) {
+        // a new stream starts training on this line, replacing the least recently used
+        stream *victim = &streams[0];
+        for (int i = 0; i < STREAM_COUNT; i++) {
+            if (!streams[i].valid || streams[i].used < victim->used)
+                victim = &streams[i];
+            if (!streams[i].valid)
+                break;
+        }
+        victim->valid = true;
+        victim->last = line;
+        victim->dir = 0;
+        victim->used = now;
+        return;
+    }
+
+    if (!s->dir) {
+        s->dir = (int32_t)(line - s->last);
+        s->next = line + s->dir;
+    }
+    s->last = line;
+    s->used = now;
+    // stay STREAM_DISTANCE lines ahead, never behind the demand stream
+    if ((int32_t)(s->next - line) * s->dir <= 0)
+        s->next = line + s->dir;
+    for (int d = 0; d < PREFETCH_DEGREE && (int32_t)(s->next - line) * s->dir <= STREAM_DISTANCE; d++) {
+        lines.push_back(s->next * CACHE_LINE_SIZE);
+        s->next += s->dir;
+    }
+}
+
+void StreamPrefetcher::save(CheckpointWriter &ckpt) {
+    ckpt.put(streams.data(), streams.size()*sizeof(stream));
+    ckpt.put(&now, sizeof(now));
+}
+
+bool StreamPrefetcher::restore(CheckpointReader &ckpt) {
+    return ckpt.get(streams.data(), streams.size()*sizeof(stream)) &&
+           ckpt.get(&now, sizeof(now));
+}
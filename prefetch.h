@@ -0,0 +1,104 @@
+#ifndef PREFETCH_CLASS
+#define PREFETCH_CLASS
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "checkpoint.h"
+
+#define PREFETCH_DEGREE 2           // lines requested per trigger
+#define STRIDE_TABLE_SIZE 256       // entries of the PC-indexed stride table
+#define STREAM_COUNT 8              // streams tracked at once
+#define STREAM_DISTANCE 4           // lines a confirmed stream runs ahead of the demand stream
+
+// One demand access to a cache level, as its prefetcher sees it
+struct prefetch_event {
+    uint32_t address;
+    uint32_t pc;                    // of the load or store, the address itself for fetches
+    bool fetch;
+    bool hit;
+    bool prefetch_hit;              // the first demand hit on a line a prefetch brought in
+};
+
+// A prefetcher watches the demand accesses of one cache level and proposes
+// lines for it. Memory drops the proposals that are already cached or in
+// flight and fills the rest through the MSHRs, so they land via Cache::replace
+// like any other fill.
+class Prefetcher {
+    public:
+        virtual ~Prefetcher() {}
+
+        virtual Prefetcher *clone() const = 0;
+
+        virtual const char *name() const = 0;
+
+        // Byte addresses of the lines worth fetching after this access are appended to lines
+        virtual void observe(const prefetch_event &e, std::vector<uint32_t> &lines) = 0;
+
+        // Training state, for checkpoints
+        virtual void save(CheckpointWriter &ckpt) = 0;
+        virtual bool restore(CheckpointReader &ckpt) = 0;
+};
+
+// Tagged next-line: a miss, or the first hit on a prefetched line, asks for the
+// next PREFETCH_DEGREE lines
+class NextLinePrefetcher : public Prefetcher {
+    public:
+        Prefetcher *clone() const override { return new NextLinePrefetcher(*this); }
+        const char *name() const override { return "next-line"; }
+        void observe(const prefetch_event &e, std::vector<uint32_t> &lines) override;
+        void save(CheckpointWriter &ckpt) override {}
+        bool restore(CheckpointReader &ckpt) override { return true; }
+};
+
+// Reference prediction table indexed by the pc of the load or store. Once the
+// same stride has been seen three times in a row (the fourth access of the pc)
+// the next PREFETCH_DEGREE addresses along it are fetched: the first stride is
+// learned, the next two build up the confidence. Instruction fetches are ignored.
+class StridePrefetcher : public Prefetcher {
+    private:
+        struct entry {
+            uint32_t pc;
+            uint32_t last;          // last address this pc accessed
+            int32_t stride;
+            int confidence;         // 0-3, prefetches from 2 up
+        };
+        std::vector<entry> table;
+    public:
+        StridePrefetcher() : table(STRIDE_TABLE_SIZE, entry()) {}
+        Prefetcher *clone() const override { return new StridePrefetcher(*this); }
+        const char *name() const override { return "stride"; }
+        void observe(const prefetch_event &e, std::vector<uint32_t> &lines) override;
+        void save(CheckpointWriter &ckpt) override;
+        bool restore(CheckpointReader &ckpt) override;
+};
+
+// Stream prefetcher: misses to neighbouring lines train a stream in their
+// direction, a confirmed stream then keeps STREAM_DISTANCE lines ahead of the
+// misses and prefetch hits that advance it, PREFETCH_DEGREE lines at a time.
+class StreamPrefetcher : public Prefetcher {
+    private:
+        struct stream {
+            uint32_t last;          // last line (number) the stream saw
+            uint32_t next;          // next line it will prefetch
+            int dir;                // +1 or -1, 0 while training
+            uint64_t used;          // for LRU replacement of streams
+            bool valid;
+        };
+        std::vector<stream> streams;
+        uint64_t now;
+    public:
+        StreamPrefetcher() : streams(STREAM_COUNT, stream()), now(0) {}
+        Prefetcher *clone() const override { return new StreamPrefetcher(*this); }
+        const char *name() const override { return "stream"; }
+        void observe(const prefetch_event &e, std::vector<uint32_t> &lines) override;
+        void save(CheckpointWriter &ckpt) override;
+        bool restore(CheckpointReader &ckpt) override;
+};
+
+// The prefetcher called kind, pf is 0 for "none". False if there is no such kind.
+bool make_prefetcher(const std::string &kind, Prefetcher *&pf);
+
+// The kinds make_prefetcher() accepts, for help texts
+extern const char *prefetcher_kinds;
+
+#endif
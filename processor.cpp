@@ -11,7 +11,7 @@ using namespace std;
 #endif
 
 void Processor::initialize(int level) {
-	processor_pc = 0;
+	processor_pc = regfile.pc;
 	//Initialize control_t
 	control = {.reg_dest = 0, 
 				.jump = 0,
@@ -32,50 +32,11 @@ void Processor::initialize(int level) {
 	
 	opt_level = level;
 
-	state.fetchDecode = {
-		.instruction = 0,
-		.pc = 0
-	};
-
-	state.decExe = {
-		.opcode = 0,
-		.rs = 0,
-		.rt = 0,
-		.rd = 0,
-		.shamt = 0,
-		.funct = 0,
-		.imm = 0,
-		.addr = 0,
-		.read_data_1 = 0,
-		.read_data_2 = 0,
-		.pc = 0
-	};
-
-	state.exeMem = {
-		.imm = 0,
-		.read_data_1 = 0,
-		.read_data_2 = 0,
-		.rd = 0,
-		.rt = 0,
-		.write_data = 0,
-		.alu_zero = 0,
-		.alu_result = 0,
-		.pc = 0
-	};
-
-	state.memWrite = {
-		.write_reg = 0,
-		.write_data = 0,
-		.imm = 0,
-		//.addr = 0,
-		.alu_zero = 0,
-		//.read_data_1 = 0,
-		//.read_data_2 = 0
-		.pc = 0
-	};
-
-	//Initialize prevState to same values
-	prevState = state;
+	//both banks of every latch empty
+	state.reset();
+	wide.reset();
+	ooo_reset();
+	pending_regs = 0;
 	//Optimization level-specific initialization
 }
 
@@ -83,7 +44,11 @@ void Processor::advance() {
 	switch (opt_level) {
 		case 0: single_cycle_processor_advance();
 				break;
-		case 1: pipelined_processor_advance();
+		case 1:
+		case 2: pipelined_processor_advance();
+				break;
+		case 3:
+		case 4: ooo_processor_advance();
 				break;
 		//other optimization levels go here
 		default: break;
@@ -93,20 +58,19 @@ void Processor::advance() {
 void Processor::single_cycle_processor_advance() {
 	//fetch
 	uint32_t instruction;
-	memory->access(regfile.pc, instruction, 0, 1, 0);
+	uint32_t inst_pc = regfile.pc;
+	memory->access(regfile.pc, instruction, 0, 1, 0, true);
 	DEBUG(cout << "\nPC: 0x" << std::hex << regfile.pc << std::dec << "\n");
 	//increment pc
 	regfile.pc += 4;
 	
 	//decode into contol signals
 	control.decode(instruction);
-	//extract rs, rt, rd, imm, funct 
-	int opcode = (instruction >> 26) & 0x3f;
+	//extract rs, rt, rd, imm
 	int rs = (instruction >> 21) & 0x1f;
 	int rt = (instruction >> 16) & 0x1f;
 	int rd = (instruction >> 11) & 0x1f;
 	int shamt = (instruction >> 6) & 0x1f;
-	int funct = instruction & 0x3f;
 	uint32_t imm = (instruction & 0xffff);
 	int addr = instruction & 0x3ffffff;
 	//Variables to read data into
@@ -116,8 +80,7 @@ void Processor::single_cycle_processor_advance() {
 	//Read from reg file
 	regfile.access(rs, rt, read_data_1, read_data_2, 0, 0, 0);
 	
-	//Execution 
-	alu.generate_control_inputs(control.ALU_op, funct, opcode);
+	//Execution, decode picked the ALU operation
 	
 	//Sign Extend Or Zero Extend the immediate
 	//Using Arithmetic right shift in order to replicate 1 
@@ -130,48 +93,53 @@ void Processor::single_cycle_processor_advance() {
 	uint32_t operand_2 = control.ALU_src ? imm : read_data_2;
 	uint32_t alu_zero = 0;
 
-	uint32_t alu_result = alu.execute(operand_1, operand_2, alu_zero);
+	uint32_t alu_result = alu.execute(control.ALU_operation, operand_1, operand_2, alu_zero);
 	
 	
 	uint32_t read_data_mem = 0;
 	uint32_t write_data_mem = 0;
 
 	//Memory
-	//First read no matter whether it is a load or a store
-	memory->access(alu_result, read_data_mem, 0, control.mem_read | control.mem_write, 0);
+	//sb and sh first read the word they merge into, straight from memory: it is part
+	//of the store, not an access of its own for the profiler
+	if (control.mem_write && (control.halfword || control.byte))
+		read_data_mem = memory->words()[alu_result/4];
 	//Stores: sb or sh mask and preserve original leftmost bits
 	write_data_mem = control.halfword ? (read_data_mem & 0xffff0000) | (read_data_2 & 0xffff) : 
 					control.byte ? (read_data_mem & 0xffffff00) | (read_data_2 & 0xff): read_data_2;
 	//Write to memory only if mem_write is 1, i.e store
 	memory->access(alu_result, read_data_mem, write_data_mem, control.mem_read, control.mem_write);
+	//Keep the functional engine's predecoded text coherent
+	if (control.mem_write)
+		functional.invalidate(alu_result);
 	//Loads: lbu or lhu modify read data by masking
 	read_data_mem &= control.halfword ? 0xffff : control.byte ? 0xff : 0xffffffff;
 
 	int write_reg = control.link ? 31 : control.reg_dest ? rd : rt;
 
-	uint32_t write_data = control.link ? regfile.pc+8 : control.mem_to_reg ? read_data_mem : alu_result;  
+	//jal links past the delay slot, which this model does not execute
+	uint32_t write_data = control.link ? inst_pc+8 : control.mem_to_reg ? read_data_mem : alu_result;  
 
 	//Write Back
 	regfile.access(0, 0, read_data_2, read_data_2, write_reg, control.reg_write, write_data);
+	retired++;
+	if (tracer)
+		tracer->commit(inst_pc, control.reg_write ? write_reg : -1, write_data);
 	
 	//Update PC
 	regfile.pc += (control.branch && !control.bne && alu_zero) || (control.bne && !alu_zero) ? imm << 2 : 0; 
-	regfile.pc = control.jump_reg ? read_data_1 : control.jump ? (regfile.pc & 0xf0000000) & (addr << 2): regfile.pc;
+	regfile.pc = control.jump_reg ? read_data_1 : control.jump ? (regfile.pc & 0xf0000000) | (addr << 2): regfile.pc;
 }
 
 void Processor::pipelined_fetch(){
-	cout << "pc: " << processor_pc << "\n";
+	DEBUG(cout << "pc: " << processor_pc << "\n");
 
 	if (stall){
+		state.fetchDecode.hold();
 		return;	
 	}
 	
-	if (cache_penalty_mem > 0) {
-		//state.fetchDecode.instruction = 0;  // NOP
-		return;
-	}
-
-	bool fetch = memory->access(processor_pc, state.fetchDecode.instruction, 0, 1, 0);
+	bool fetch = stage_access(processor_pc, state.fetchDecode.in().instruction, 0, 1, 0, true, processor_pc);
 	if (!fetch){
 		clear_IF_ID();
 		return;
@@ -180,25 +148,19 @@ void Processor::pipelined_fetch(){
 	DEBUG(cout << "\nPC: 0x" << std::hex << regfile.pc << std::dec << "\n");
 	
 	//increment pc
-	state.fetchDecode.pc = processor_pc;
-	processor_pc += 4; //standard increment
+	state.fetchDecode.in().pc = processor_pc;
+	state.fetchDecode.in().valid = true;
+	processor_pc = bpu.predict(processor_pc, state.fetchDecode.in().branch); //pc+4 unless a taken branch is predicted
 }
 
 void Processor::pipelined_decode(){
-	if (cache_penalty_mem){
-		state.fetchDecode = prevState.fetchDecode;
-		clear_ID_EX(); //flush state.decExe if hazard detected
-
-		return;
-	}
-	
 	//decode into contol signals (see below)
-	uint32_t instruction = prevState.fetchDecode.instruction;
+	uint32_t instruction = state.fetchDecode.out().instruction;
 	//DEBUG(control.print());
 
 	control_t new_control;
 	new_control.decode(instruction);
-	state.decExe.control = new_control; //push generated control signals to next pipeline reg
+	state.decExe.in().control = new_control; //push generated control signals to next pipeline reg
 
 /*	*	*	*	*	*	*	*	*	*	*	*	*\
 *	bool reg_dest;			//0 if rt, 1 if rd
@@ -221,28 +183,43 @@ void Processor::pipelined_decode(){
 \*	*	*	*	*	*	*	*	*	*	*	*	*/
 
 	//extract rs, rt, rd, imm, funct 
-	int rs = state.decExe.rs = (instruction >> 21) & 0x1f; //store source (important for hazards)
-	int rt = state.decExe.rt = (instruction >> 16) & 0x1f; //store target
-	state.decExe.rd = (instruction >> 11) & 0x1f; //store destination
+	int rs = state.decExe.in().rs = (instruction >> 21) & 0x1f; //store source (important for hazards)
+	int rt = state.decExe.in().rt = (instruction >> 16) & 0x1f; //store target
+	state.decExe.in().rd = (instruction >> 11) & 0x1f; //store destination
 
 	
 	if (stall){
 		stall = false;
-		//state.fetchDecode = prevState.fetchDecode;
-		clear_ID_EX(); //flush state.decExe if hazard detected
+		//state.fetchDecode.hold();
+		clear_ID_EX(); //flush state.decExe.in() if hazard detected
 		return;
 	}
 
 	detect_data_hazard(); //use the new rs, rt, rd vals to check for data hazard
-
+	//jr reads rs here, it waits until the value can be forwarded from WB
+	if (new_control.jump_reg && (writes_reg(state.decExe.out().control, state.decExe.out().rd, state.decExe.out().rt, rs) ||
+			writes_reg(state.exeMem.out().control, state.exeMem.out().rd, state.exeMem.out().rt, rs)))
+		stall = true;
+	//-O2: a load that missed in L1 holds back its users until the line arrives
+	if (opt_level >= 2 && (reg_pending(rs) || (reads_reg(state.decExe.in(), rt) && reg_pending(rt))))
+		stall = true;
+	if (stall){
+		//load/use: keep this instruction in IF/ID, undo this cycle's fetch and
+		//send a bubble so the load reaches WB before we execute
+		stall = false;
+		state.fetchDecode.hold();
+		refetch();
+		clear_ID_EX();
+		return;
+	}
 	
 	//do not push anything to next register unless data hazard is cleared
 
-	state.decExe.opcode = (instruction >> 26) & 0x3f; //store opcode
-	state.decExe.shamt = (instruction >> 6) & 0x1f; //?
-	state.decExe.funct = instruction & 0x3f; //potential funct bits
-	state.decExe.imm = (instruction & 0xffff); //potential immediate bits
-	state.decExe.addr = instruction & 0x3ffffff; //address 
+	state.decExe.in().opcode = (instruction >> 26) & 0x3f; //store opcode
+	state.decExe.in().shamt = (instruction >> 6) & 0x1f; //?
+	state.decExe.in().funct = instruction & 0x3f; //potential funct bits
+	state.decExe.in().imm = (instruction & 0xffff); //potential immediate bits
+	state.decExe.in().addr = instruction & 0x3ffffff; //address 
 	
 	//Variables to read data into
 	uint32_t read_data_1 = 0;
@@ -251,58 +228,72 @@ void Processor::pipelined_decode(){
 	//Read from reg file
 	regfile.access(rs, rt, read_data_1, read_data_2, 0, 0, 0);
 	// Forward data from writeback stage to decode stage when needed
-	if(prevState.memWrite.control.reg_write && prevState.memWrite.write_reg != 0){
+	if(state.memWrite.out().control.reg_write && state.memWrite.out().write_reg != 0){
     		// Forward to rs if it matches the destination register
-    		if (prevState.memWrite.write_reg == rs && rs != 0)
-        		read_data_1 = prevState.memWrite.write_data;
+    		if (state.memWrite.out().write_reg == rs && rs != 0)
+        		read_data_1 = state.memWrite.out().write_data;
     
     		// Forward to rt if it matches the destination register
     		// Only do this for R-type instructions or other instructions that need rt
-    		if (prevState.memWrite.write_reg == rt && rt != 0 && !state.decExe.control.ALU_src)
-        		read_data_2 = prevState.memWrite.write_data;
+    		if (state.memWrite.out().write_reg == rt && rt != 0 && (!state.decExe.in().control.ALU_src || state.decExe.in().control.mem_write))
+        		read_data_2 = state.memWrite.out().write_data;
 	}
 
 /*
-	if(prevState.memWrite.write_reg){
-		if (prevState.memWrite.write_reg == rs)
-			read_data_1 = prevState.memWrite.write_data;
-		if (prevState.memWrite.write_reg == rt)
-			read_data_2 = prevState.memWrite.write_data;
+	if(state.memWrite.out().write_reg){
+		if (state.memWrite.out().write_reg == rs)
+			read_data_1 = state.memWrite.out().write_data;
+		if (state.memWrite.out().write_reg == rt)
+			read_data_2 = state.memWrite.out().write_data;
 	}
 */
 
-	state.decExe.read_data_1 = read_data_1;
-	state.decExe.read_data_2 = read_data_2; //both of these should have been populated from the reg read
-	state.decExe.pc = prevState.fetchDecode.pc;
+	state.decExe.in().read_data_1 = read_data_1;
+	state.decExe.in().read_data_2 = read_data_2; //both of these should have been populated from the reg read
+	state.decExe.in().pc = state.fetchDecode.out().pc;
+	state.decExe.in().valid = state.fetchDecode.out().valid;
+	state.decExe.in().branch = state.fetchDecode.out().branch;
+
+	//jumps are resolved here: j/jal from the instruction, jr from rs. If fetch did not
+	//go to the target only the instruction fetched this cycle is lost.
+	branch_record &br = state.decExe.in().branch;
+	if (new_control.branch || new_control.bne)
+		br.kind = BR_COND;
+	if (new_control.jump && state.decExe.in().valid){
+		uint32_t pc = state.decExe.in().pc;
+		br.kind = new_control.jump_reg ? (rs == 31 ? BR_RETURN : BR_INDIRECT) : new_control.link ? BR_CALL : BR_JUMP;
+		br.taken = true;
+		br.target = new_control.jump_reg ? read_data_1 : ((pc + 4) & 0xf0000000) | (state.decExe.in().addr << 2);
+		if (br.target != br.predicted_pc){
+			clear_IF_ID();
+			processor_pc = br.target;
+			bpu.recover(pc, br);
+			branch_flushes++;
+			DEBUG(cout << "Jump redirects fetch to 0x" << hex << processor_pc << dec << "\n");
+		}
+	}
 }
 
 void Processor::pipelined_execute(){
-	if (cache_penalty_mem){
-		state.decExe = prevState.decExe;
-		state.exeMem.control.reset();
-		return;
-	}
-
-	control_t &ctrl = prevState.decExe.control; //pull control signals from last reg
-	state.exeMem.control = ctrl; //...and pass them along
+	control_t &ctrl = state.decExe.out().control; //pull control signals from last reg
+	state.exeMem.in().control = ctrl; //...and pass them along
 
-	//Execution 
-	alu.generate_control_inputs(ctrl.ALU_op, prevState.decExe.funct, prevState.decExe.opcode);
+	//Execution, decode picked the ALU operation
 	
 	//Sign Extend Or Zero Extend the immediate
 	//Using Arithmetic right shift in order to replicate 1 
 
 	//pull immediate from previous pipeline register, update, either use or send along
-	uint32_t imm = prevState.decExe.imm;
-	state.exeMem.imm = imm = ctrl.zero_extend ? imm : (imm >> 15) ? 0xffff0000 | imm : imm;
+	uint32_t imm = state.decExe.out().imm;
+	state.exeMem.in().imm = imm = ctrl.zero_extend ? imm : (imm >> 15) ? 0xffff0000 | imm : imm;
 	
 	//Find operands for the ALU Execution
 	//Operand 1 is always R[rs] -> read_data_1, except sll and srl
 	//Operand 2 is immediate if ALU_src = 1, for I-type
-	uint32_t read_data_1 = prevState.decExe.read_data_1;
-	uint32_t read_data_2 = prevState.decExe.read_data_2;
+	uint32_t read_data_1 = state.decExe.out().read_data_1;
+	uint32_t read_data_2 = state.decExe.out().read_data_2;
 
-	//prevState.decExe.forward_a = prevState.decExe.forward_b = 0;
+	//state.decExe.out().forward_a = state.decExe.out().forward_b = 0;
 	//detect_data_hazard();
 
 	uint32_t operand_1 = 0;
@@ -317,15 +308,15 @@ void Processor::pipelined_execute(){
 	switch(get_forwarding_a()){
 		case(0): //raw read data_1, no forwarding
 			operand_1 = ctrl.shift ? 
-				prevState.decExe.shamt : read_data_1;
+				state.decExe.out().shamt : read_data_1;
 			break;
 		case(1): //read previous mem data
-			//operand_1 = prevState.exeMem.alu_result; 
-			operand_1 = prevState.memWrite.write_data; 
+			//operand_1 = state.exeMem.out().alu_result; 
+			operand_1 = state.memWrite.out().write_data; 
 			break;
 		case(2): //read previous alu_result
-			operand_1 = prevState.exeMem.alu_result; 
-			//operand_1 = prevState.memWrite.write_data;
+			operand_1 = state.exeMem.out().alu_result; 
+			//operand_1 = state.memWrite.out().write_data;
 			break;
 	}
 	
@@ -335,14 +326,14 @@ void Processor::pipelined_execute(){
 			//operand_2 = ctrl.ALU_src ? imm : read_data_2;
 			break;	
 		case(1):
-			operand_2 = prevState.memWrite.write_data;	
+			operand_2 = state.memWrite.out().write_data;	
 			break;
 		case(2):
-			operand_2 = prevState.exeMem.alu_result; 
+			operand_2 = state.exeMem.out().alu_result; 
 			break;
 	}
 
-	state.exeMem.write_data = operand_2;
+	state.exeMem.in().write_data = operand_2;
 	//operand_2 needs to become write_data unconditionally
 
 	if (ctrl.ALU_src) //mux for I type
@@ -350,7 +341,10 @@ void Processor::pipelined_execute(){
 	
 	uint32_t alu_zero = 0;
 
-	state.exeMem.alu_result = alu.execute(operand_1, operand_2, alu_zero);
+	state.exeMem.in().alu_result = alu.execute(ctrl.ALU_operation, operand_1, operand_2, alu_zero);
+	//jal writes its return address to $31
+	if (ctrl.link)
+		state.exeMem.in().alu_result = state.decExe.out().pc + 8;
 
 
 	//logic to take care of updating values read from register in case of forwarding
@@ -358,95 +352,326 @@ void Processor::pipelined_execute(){
 
 
 	//send updated values down the pipeline
-	state.exeMem.rd = prevState.decExe.rd;
-	state.exeMem.rt = prevState.decExe.rt;
-	state.exeMem.alu_zero = alu_zero;
-	state.exeMem.pc = prevState.decExe.pc;
+	state.exeMem.in().rd = state.decExe.out().rd;
+	state.exeMem.in().rt = state.decExe.out().rt;
+	state.exeMem.in().alu_zero = alu_zero;
+	state.exeMem.in().pc = state.decExe.out().pc;
+	state.exeMem.in().valid = state.decExe.out().valid;
+	state.exeMem.in().branch = state.decExe.out().branch;
 	
 	detect_control_hazard(ctrl);
 }
 
 
 void Processor::pipelined_mem(){
-	control_t &ctrl = prevState.exeMem.control;
-	state.memWrite.control = ctrl; //same as last time
+	control_t &ctrl = state.exeMem.out().control;
+	state.memWrite.in().control = ctrl; //same as last time
 
 	uint32_t read_data_mem = 0;
 	uint32_t write_data_mem = 0;
 
-	if (ctrl.mem_read){
-		bool read = memory->access(prevState.exeMem.alu_result, read_data_mem, write_data_mem, ctrl.mem_read, ctrl.mem_write);
+	if (opt_level >= 2 && !nonblocking_mem_access(ctrl, read_data_mem))
+		return;
+
+	//sb and sh first read the word they merge into
+	if ((ctrl.mem_read || ctrl.halfword || ctrl.byte) && opt_level < 2){
+		bool read = stage_access(state.exeMem.out().alu_result, read_data_mem, 0, 1, 0, false, state.exeMem.out().pc);
 		if (stall > 1){
 			stall--;
-			state = prevState;
+			state.hold();
+			refetch(); //the instruction fetched this cycle is dropped with IF/ID
+			mem_stalled = true;
 			return;
 		}
 		if (!read){
 			stall = 60;
-			state = prevState;
+			state.hold();
+			refetch(); //the instruction fetched this cycle is dropped with IF/ID
+			mem_stalled = true;
 			return;
 		}
 	}
 	
-	//while(!memory->access(prevState.exeMem.alu_result, read_data_mem, 0, ctrl.mem_read | ctrl.mem_write, 0)){}
+	//while(!memory->access(state.exeMem.out().alu_result, read_data_mem, 0, ctrl.mem_read | ctrl.mem_write, 0)){}
 	
 	//Stores: sb or sh mask and preserve original leftmost bits
 
 
-	write_data_mem = ctrl.halfword ? (read_data_mem & 0xffff0000) | (prevState.exeMem.write_data & 0xffff) : 
-					ctrl.byte ? (read_data_mem & 0xffffff00) | (prevState.exeMem.write_data & 0xff): 
-					prevState.exeMem.write_data;  //not populating correctly
+	write_data_mem = ctrl.halfword ? (read_data_mem & 0xffff0000) | (state.exeMem.out().write_data & 0xffff) : 
+					ctrl.byte ? (read_data_mem & 0xffffff00) | (state.exeMem.out().write_data & 0xff): 
+					state.exeMem.out().write_data;  //not populating correctly
 	
 	//Write to memory only if mem_write is 1, i.e store
-	if (ctrl.mem_write){
-		bool write = memory->access(prevState.exeMem.alu_result, read_data_mem, write_data_mem, ctrl.mem_read, ctrl.mem_write);
+	if (ctrl.mem_write && opt_level < 2){
+		bool write = stage_access(state.exeMem.out().alu_result, read_data_mem, write_data_mem, ctrl.mem_read, ctrl.mem_write, false, state.exeMem.out().pc);
 		if (stall > 1){
 			stall--;
-			state = prevState;
+			state.hold();
+			refetch(); //the instruction fetched this cycle is dropped with IF/ID
+			mem_stalled = true;
 			return;
 		}
 		if (!write){
 			stall = 60;
-			state = prevState;
+			state.hold();
+			refetch(); //the instruction fetched this cycle is dropped with IF/ID
+			mem_stalled = true;
 			return;
 		}
 	}
 	//Loads: lbu or lhu modify read data by masking
 	read_data_mem &= ctrl.halfword ? 0xffff : ctrl.byte ? 0xff : 0xffffffff;
 
-	state.memWrite.write_reg = ctrl.link ? 31 : ctrl.reg_dest ? prevState.exeMem.rd : prevState.exeMem.rt;
+	state.memWrite.in().write_reg = ctrl.link ? 31 : ctrl.reg_dest ? state.exeMem.out().rd : state.exeMem.out().rt;
 
-	//state.memWrite.write_data = control.link ? regfile.pc+8 : ctrl.mem_to_reg ? read_data_mem : prevState.exeMem.alu_result;  
+	//state.memWrite.in().write_data = control.link ? regfile.pc+8 : ctrl.mem_to_reg ? read_data_mem : state.exeMem.out().alu_result;  
 
 	switch(ctrl.mem_read){
 		case(false): //standard instruction, no mem access
-			state.memWrite.write_data = prevState.exeMem.alu_result; //raw alu result, just normal instruction
+			state.memWrite.in().write_data = state.exeMem.out().alu_result; //raw alu result, just normal instruction
 			break;
 		case(true):
-			state.memWrite.write_data = read_data_mem; //memory was accessed
+			state.memWrite.in().write_data = read_data_mem; //memory was accessed
 			break;
 	}
 	
-	state.memWrite.pc = prevState.exeMem.pc;
+	state.memWrite.in().pc = state.exeMem.out().pc;
+	state.memWrite.in().valid = state.exeMem.out().valid;
+	state.memWrite.in().branch = state.exeMem.out().branch;
+}
+
+bool Processor::nonblocking_mem_access(control_t &ctrl, uint32_t &read_data_mem){
+	if (!ctrl.mem_read && !ctrl.mem_write)
+		return true;
+
+	uint32_t address = state.exeMem.out().alu_result;
+	mem_status status = MEM_HIT;
+	//sb and sh first read the word they merge into
+	if (ctrl.mem_read || ctrl.halfword || ctrl.byte)
+		status = memory->accessNonBlocking(address, read_data_mem, 0, 1, 0, false, state.exeMem.out().pc);
+	if (status != MEM_BLOCKED && ctrl.mem_write){
+		uint32_t write_data_mem = ctrl.halfword ? (read_data_mem & 0xffff0000) | (state.exeMem.out().write_data & 0xffff) : 
+						ctrl.byte ? (read_data_mem & 0xffffff00) | (state.exeMem.out().write_data & 0xff): 
+						state.exeMem.out().write_data;
+		//after a pre-read the line is here or on its way, so only a plain store can be turned away
+		mem_status write = memory->accessNonBlocking(address, read_data_mem, write_data_mem, 0, 1, false, state.exeMem.out().pc);
+		if (write != MEM_HIT)
+			status = write;
+	}
+	if (status == MEM_BLOCKED){
+		//every MSHR is busy: hold MEM and everything behind it, like a stall-on-miss
+		state.hold();
+		refetch();
+		mem_stalled = true;
+		return false;
+	}
+	if (status == MEM_MISS && ctrl.mem_read){
+		int dest = ctrl.reg_dest ? state.exeMem.out().rd : state.exeMem.out().rt;
+		pending_regs |= 1u << dest;
+		pending_addr[dest] = address;
+		//the instruction decoded this cycle already read the register, send it back
+		if (state.decExe.in().valid && reads_reg(state.decExe.in(), dest)){
+			state.fetchDecode.hold();
+			refetch();
+			clear_ID_EX();
+		}
+	}
+	return true;
 }
 
 void Processor::pipelined_wb(){
-	control_t &ctrl = prevState.memWrite.control; //nothing to pass forward this time
+	control_t &ctrl = state.memWrite.out().control; //nothing to pass forward this time
 
 	//Write Back
 	//imm doesnt do anything, could probably be 0
-	regfile.access(0, 0, prevState.memWrite.imm, prevState.memWrite.imm, prevState.memWrite.write_reg, 
-			ctrl.reg_write, prevState.memWrite.write_data);
+	regfile.access(0, 0, state.memWrite.out().imm, state.memWrite.out().imm, state.memWrite.out().write_reg, 
+			ctrl.reg_write, state.memWrite.out().write_data);
+	if (state.memWrite.out().valid && !wb_repeat){
+		retired++;
+		if (tracer)
+			tracer->commit(state.memWrite.out().pc, ctrl.reg_write ? state.memWrite.out().write_reg : -1,
+					state.memWrite.out().write_data);
+		if (ctrl.branch || ctrl.bne || ctrl.jump)
+			bpu.resolve(state.memWrite.out().pc, state.memWrite.out().branch);
+	}
+
+	regfile.pc = state.memWrite.out().pc;
+}
 
-	regfile.pc = prevState.memWrite.pc;
+void Processor::register_stats(StatsRegistry &stats){
+	stats.add("load_use_stalls", &load_use_stalls);
+	stats.add("branch_flushes", &branch_flushes);
+	bpu.registerStats(stats);
+	stats.add("rob_full_cycles", &rob_full_cycles);
+	stats.add("iq_full_cycles", &iq_full_cycles);
+	stats.add("order_squashes", &order_squashes);
 }
 
 void Processor::pipelined_processor_advance(){
-	prevState = state;
+	state.clock();
+	wide.clock();
+
+	start_pc = processor_pc;
+	start_stall = stall;
+	for (int i = 0; i < 32; i++)
+		start_regs[i] = regfile.data()[i].value;
+	cycle_accesses = 0;
+	cycle_fetch_hit = false;
+	cycle_missed = false;
+	wb_repeat = mem_stalled;
+	mem_stalled = false;
+	bpu.startCycle();
+	//fills in flight land: prefetches from -O1, every miss from -O2
+	memory->tick();
+	uint64_t start_load_use = load_use_stalls;
+	uint64_t start_flushes = branch_flushes;
+
+	if (width > 1){
+		wide_fetch();
+		wide_decode();
+		wide_execute();
+		wide_mem();
+		wide_wb();
+	} else {
+		pipelined_fetch();
+		pipelined_decode();
+		pipelined_execute();
+		pipelined_mem();	
+		pipelined_wb();
+	}
+
+	//mem held its latches: the cycle is redone, what decode and execute counted did not happen
+	if (mem_stalled){
+		load_use_stalls = start_load_use;
+		branch_flushes = start_flushes;
+	}
+}
+
+uint64_t Processor::skip_idle_cycles(){
+	//one access waited on the miss, besides it there can only be a fetch hit (the wide
+	//pipeline fetches while MEM is blocked and drops the group), repeated every cycle
+	if (opt_level != 1 || !cycle_missed || cycle_accesses - cycle_fetch_hit != 1)
+		return 0;
+	if (cycle_fetch_hit && !memory->repeatableHit(start_pc, true))
+		return 0;
+
+	//the cycle must have ended where it started, apart from the cache countdowns
+	if (processor_pc != start_pc || stall != start_stall)
+		return 0;
+	if (!state.unchanged() || !wide.unchanged())
+		return 0;
+	for (int i = 0; i < 32; i++){
+		if (regfile.data()[i].value != start_regs[i])
+			return 0;
+	}
+
+	int idle = memory->idleCycles(miss_address, miss_fetch);
+	memory->skipCycles(idle, miss_address, miss_fetch);
+	if (cycle_fetch_hit)
+		memory->skipHits(idle, true);
+	DEBUG(cout << "Skipped " << idle << " idle cycles waiting on 0x" << hex << miss_address << dec << "\n");
+	return idle;
+}
+
+void Processor::save(CheckpointWriter &ckpt){
+	ckpt.begin(CKPT_CPU);
+	regfile.save(ckpt);
+	ckpt.put(&opt_level, sizeof(opt_level));
+	ckpt.put(&width, sizeof(width));
+	ckpt.put(&processor_pc, sizeof(processor_pc));
+	ckpt.put(&stall, sizeof(stall));
+	ckpt.put(&flag, sizeof(flag));
+	ckpt.put(&mem_stalled, sizeof(mem_stalled));
+	ckpt.put(&control, sizeof(control));
+	ckpt.put(&state, sizeof(state));
+	ckpt.put(&wide, sizeof(wide));
+	ckpt.put(&pending_regs, sizeof(pending_regs));
+	ckpt.put(pending_addr, sizeof(pending_addr));
+	bpu.save(ckpt);
+	//the out-of-order window, its sizes first
+	uint32_t iq_count = iq.size(), fetched = fetch_queue.size();
+	ckpt.put(&rob_size, sizeof(rob_size));
+	ckpt.put(&iq_size, sizeof(iq_size));
+	ckpt.put(rob.data(), rob.size()*sizeof(rob_entry));
+	ckpt.put(&rob_head, sizeof(rob_head));
+	ckpt.put(&rob_count, sizeof(rob_count));
+	ckpt.put(&iq_count, sizeof(iq_count));
+	ckpt.put(iq.data(), iq_count*sizeof(int));
+	ckpt.put(&fetched, sizeof(fetched));
+	ckpt.put(fetch_queue.data(), fetched*sizeof(IF_ID));
+	ckpt.put(&ooo_cycle, sizeof(ooo_cycle));
+	regfile.saveRename(ckpt);
+}
+
+bool Processor::restore(CheckpointReader &ckpt, int level){
+	int saved_level, saved_width;
+	ckpt.begin(CKPT_CPU);
+	if (!regfile.restore(ckpt) || !ckpt.get(&saved_level, sizeof(saved_level)) ||
+			!ckpt.get(&saved_width, sizeof(saved_width)))
+		return false;
+
+	if (saved_level != level){
+		if (saved_level != 0){
+			cout << "Only -O0 checkpoints can be continued at another level\n";
+			return false;
+		}
+		//nothing in flight at -O0, start an empty pipeline at the checkpoint pc
+		start_level(level);
+		return true;
+	}
 
-	pipelined_fetch();
-	pipelined_decode();
-	pipelined_execute();
-	pipelined_mem();	
-	pipelined_wb();
+	if (saved_width != width){
+		cout << "The checkpoint was taken with --width " << saved_width << "\n";
+		return false;
+	}
+
+	opt_level = level;
+	return ckpt.get(&processor_pc, sizeof(processor_pc)) &&
+		ckpt.get(&stall, sizeof(stall)) &&
+		ckpt.get(&flag, sizeof(flag)) &&
+		ckpt.get(&mem_stalled, sizeof(mem_stalled)) &&
+		ckpt.get(&control, sizeof(control)) &&
+		ckpt.get(&state, sizeof(state)) &&
+		ckpt.get(&wide, sizeof(wide)) &&
+		ckpt.get(&pending_regs, sizeof(pending_regs)) &&
+		ckpt.get(pending_addr, sizeof(pending_addr)) &&
+		bpu.restore(ckpt) &&
+		restore_window(ckpt);
+}
+
+bool Processor::restore_window(CheckpointReader &ckpt){
+	int saved_rob, saved_iq;
+	uint32_t iq_count, fetched;
+	if (!ckpt.get(&saved_rob, sizeof(saved_rob)) || !ckpt.get(&saved_iq, sizeof(saved_iq)))
+		return false;
+	if (saved_rob != rob_size || saved_iq != iq_size){
+		cout << "The checkpoint was taken with --rob " << saved_rob << " --iq " << saved_iq << "\n";
+		return false;
+	}
+	if (!ckpt.get(rob.data(), rob.size()*sizeof(rob_entry)) ||
+			!ckpt.get(&rob_head, sizeof(rob_head)) ||
+			!ckpt.get(&rob_count, sizeof(rob_count)) ||
+			!ckpt.get(&iq_count, sizeof(iq_count)) || iq_count > (uint32_t)iq_size)
+		return false;
+	iq.resize(iq_count);
+	if (!ckpt.get(iq.data(), iq_count*sizeof(int)) ||
+			!ckpt.get(&fetched, sizeof(fetched)) || fetched > FETCH_QUEUE_SIZE)
+		return false;
+	fetch_queue.resize(fetched);
+	return ckpt.get(fetch_queue.data(), fetched*sizeof(IF_ID)) &&
+		ckpt.get(&ooo_cycle, sizeof(ooo_cycle)) &&
+		regfile.restoreRename(ckpt);
+}
+
+uint64_t Processor::warm_caches(uint64_t max_insts){
+	uint64_t n = 0;
+	PhysReg *R = regfile.data();
+	while (n < max_insts && functional.inText(regfile.pc)){
+		const decoded_op &op = functional.lookup(regfile.pc);
+		memory->warm(regfile.pc, true);
+		if (op.kind >= OP_LW && op.kind <= OP_SB)
+			memory->warm(R[op.rs].value + op.imm, false);
+		n += functional.run(1);
+	}
+	return n;
 }
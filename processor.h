@@ -2,6 +2,11 @@
 #include "regfile.h"
 #include "ALU.h"
 #include "control.h"
+#include "functional.h"
+#include "jit.h"
+#include "trace.h"
+#include "bpred.h"
+#include "latch.h"
 
 #ifdef ENABLE_DEBUG
 #define DEBUG(x) x
@@ -9,14 +14,18 @@
 #define DEBUG(x) 
 #endif
 
+#define MAX_WIDTH 4 //widest in-order pipeline, see set_width()
+#define DEFAULT_ROB_SIZE 64 //-O3 and up, see set_window()
+#define DEFAULT_IQ_SIZE 32
+#define MAX_ROB_SIZE 1024
+#define FETCH_QUEUE_SIZE (4*MAX_WIDTH) //fetched instructions waiting for dispatch
+#define LOAD_HIT_LATENCY 2 //cycles from issue until a load that hit in L1 can wake up its users
 
 class Processor{
 	//forwarding unit
 					
 	private:
 	uint32_t stall = 0; 
-	unsigned int cache_penalty_mem = 0;
-	unsigned int cache_penalty_fetch = 0;
 
 	bool flag = false;
 	int opt_level;
@@ -24,6 +33,17 @@ class Processor{
 	control_t control;
 	Memory *memory;
 	Registers regfile;
+	FunctionalCore functional; //predecoded -O0 engine
+	JIT *jit = 0; //x86-64 translator on top of the functional engine, created by enable_jit()
+	Tracer *tracer = 0; //commit records go here when tracing
+	bool mem_stalled = false; //mem stage held its latches this cycle
+	bool wb_repeat = false; //wb sees the same MEM/WB latch as last cycle
+	uint64_t retired = 0; //instructions completed
+	uint64_t load_use_stalls = 0; //cycles decode held an instruction for a load in EX
+	uint64_t branch_flushes = 0; //fetch redirects after a mispredicted branch or jump
+	uint32_t pending_regs = 0; //-O2: one bit per register whose load missed in L1...
+	uint32_t pending_addr[32]; //...and the address it waits for
+	BranchUnit bpu; //pipelined fetch: direction predictor and BTB
 
 	uint32_t processor_pc = 0;
 	//add other structures as needed
@@ -32,6 +52,12 @@ class Processor{
 	struct IF_ID{
 		uint32_t instruction; //obvious
 		uint32_t pc;
+		bool valid; //false for bubbles
+		branch_record branch; //where fetch went next, checked in execute
+
+		bool operator==(const IF_ID &o) const {
+			return instruction == o.instruction && pc == o.pc && valid == o.valid && branch == o.branch;
+		}
 	};
 	
 	struct ID_EX{
@@ -50,6 +76,15 @@ class Processor{
 	
 		control_t control; //preserve control across signals cycles
 		uint32_t pc;
+		bool valid; //false for bubbles
+		branch_record branch;
+
+		bool operator==(const ID_EX &o) const {
+			return opcode == o.opcode && rs == o.rs && rt == o.rt && rd == o.rd && shamt == o.shamt &&
+				funct == o.funct && imm == o.imm && addr == o.addr && read_data_1 == o.read_data_1 &&
+				read_data_2 == o.read_data_2 && control == o.control && pc == o.pc && valid == o.valid &&
+				branch == o.branch;
+		}
 	};
 	
 
@@ -67,6 +102,15 @@ class Processor{
 			
 		control_t control; //preserve control across signals cycles
 		uint32_t pc;
+		bool valid; //false for bubbles
+		branch_record branch; //outcome filled in by execute
+
+		bool operator==(const EX_MEM &o) const {
+			return imm == o.imm && read_data_1 == o.read_data_1 && read_data_2 == o.read_data_2 &&
+				rd == o.rd && rt == o.rt && write_data == o.write_data && alu_zero == o.alu_zero &&
+				alu_result == o.alu_result && control == o.control && pc == o.pc && valid == o.valid &&
+				branch == o.branch;
+		}
 	};
 	
 	struct MEM_WB{
@@ -80,35 +124,216 @@ class Processor{
 		
 		control_t control; //preserve control across signals cycles
 		uint32_t pc;	
+		bool valid; //false for bubbles
+		branch_record branch; //the predictor trains on it at writeback
+
+		bool operator==(const MEM_WB &o) const {
+			return write_reg == o.write_reg && write_data == o.write_data && imm == o.imm &&
+				alu_zero == o.alu_zero && control == o.control && pc == o.pc && valid == o.valid &&
+				branch == o.branch;
+		}
 	};
 	
 	//allow access to correct pipeline registers across
-	//function contexts
+	//function contexts. A stage reads out() of the latch behind it, what was
+	//written there last cycle, and writes in() of the one in front (see latch.h)
+	template <class IF, class ID, class EX, class WB> struct pipelineLatches{
+		Latch<IF> fetchDecode;
+		Latch<ID> decExe;
+		Latch<EX> exeMem;
+		Latch<WB> memWrite;
+
+		//start of a cycle: last cycle's in() becomes out()
+		void clock(){
+			fetchDecode.clock();
+			decExe.clock();
+			exeMem.clock();
+			memWrite.clock();
+		}
+
+		//mem stalled: every latch keeps the value it had at the start of the cycle
+		void hold(){
+			fetchDecode.hold();
+			decExe.hold();
+			exeMem.hold();
+			memWrite.hold();
+		}
 
-	struct pipelineState{
-		IF_ID fetchDecode;
-		ID_EX decExe;
-		EX_MEM exeMem;
-		MEM_WB memWrite;
+		void reset(){
+			fetchDecode.reset();
+			decExe.reset();
+			exeMem.reset();
+			memWrite.reset();
+		}
+
+		bool unchanged() const {
+			return fetchDecode.unchanged() && decExe.unchanged() && exeMem.unchanged() && memWrite.unchanged();
+		}
 	};
 
+	typedef pipelineLatches<IF_ID, ID_EX, EX_MEM, MEM_WB> pipelineState;
 	pipelineState state;
-	pipelineState prevState; //store the previous state so we can simulate shared state across contexts
+
+	//the same latches width times over for the superscalar pipeline (superscalar.cpp),
+	//slot 0 holds the oldest instruction of a group, bubbles are cleared slots
+	typedef pipelineLatches<IF_ID[MAX_WIDTH], ID_EX[MAX_WIDTH], EX_MEM[MAX_WIDTH], MEM_WB[MAX_WIDTH]> widePipelineState;
+
+	int width = 1; //instructions per pipeline stage, 1 runs the scalar pipeline above
+	widePipelineState wide;
+
+	//-O3 and up: out-of-order core (ooo.cpp). Fetch fills the fetch queue, dispatch
+	//renames in order into the reorder buffer and the issue queue, issue picks the
+	//oldest ready instructions, completion wakes up their users and resolves branches,
+	//commit retires in order from the ROB head.
+	struct rob_entry{
+		uint32_t pc;
+		control_t control;
+		int opcode, rs, rt, rd;
+		uint32_t shamt, funct, imm, addr;
+		int dest; //architectural destination, 0 for none...
+		int phys; //...and the physical register renamed to it
+		int src[2]; //physical registers rs and rt wait for, -1 once value[] holds them
+		uint32_t value[2];
+		uint32_t result; //ALU result, loaded data, or the data a store writes
+		uint32_t address; //loads and stores
+		bool issued;
+		bool done;
+		bool miss; //an issued load that missed completes when its line is in L1...
+		uint64_t ready_cycle; //...anything else in this cycle
+		branch_record branch;
+	};
+
+	int rob_size = DEFAULT_ROB_SIZE;
+	int iq_size = DEFAULT_IQ_SIZE;
+	std::vector<rob_entry> rob; //circular
+	int rob_head = 0;
+	int rob_count = 0;
+	std::vector<int> iq; //ROB indices of the instructions waiting to issue, oldest first
+	std::vector<IF_ID> fetch_queue;
+	uint64_t ooo_cycle = 0;
+
+	//where the window fills up and how often it is thrown away, see print_ooo_stats()
+	uint64_t rob_occupancy = 0;
+	uint64_t rob_full_cycles = 0;
+	uint64_t iq_full_cycles = 0;
+	uint64_t head_miss_cycles = 0;
+	uint64_t branch_squashes = 0;
+	uint64_t order_squashes = 0;
+
+	//what the current cycle started with and which memory accesses it made, see skip_idle_cycles()
+	uint32_t start_pc = 0;
+	uint32_t start_stall = 0;
+	int32_t start_regs[32];
+	int cycle_accesses = 0;
+	bool cycle_fetch_hit = false;
+	bool cycle_missed = false;
+	uint32_t miss_address = 0;
+	bool miss_fetch = false;
+
+	//this cycle's fetch is dropped and redone next cycle, so is what it did to the RAS
+	void refetch(){
+		processor_pc = start_pc;
+		bpu.undoCycle();
+	}
+
+	//an instruction with these control signals and fields writes register r
+	static bool writes_reg(const control_t &ctrl, int rd, int rt, int r){
+		return r && ctrl.reg_write && (ctrl.link ? 31 : ctrl.reg_dest ? rd : rt) == r;
+	}
+
+	//memory access from a pipeline stage, remembers misses for skip_idle_cycles()
+	//pc is the accessing instruction's, for the prefetchers
+	bool stage_access(uint32_t address, uint32_t &read_data, uint32_t write_data, bool mem_read, bool mem_write, bool fetch, uint32_t pc){
+		cycle_accesses++;
+		bool hit = memory->access(address, read_data, write_data, mem_read, mem_write, fetch, pc);
+		cycle_fetch_hit |= fetch && hit;
+		if (!hit){
+			cycle_missed = true;
+			miss_address = address;
+			miss_fetch = fetch;
+		}
+		return hit;
+	}
 	
 		//add private functions
 	void single_cycle_processor_advance();
 	void pipelined_processor_advance();
 
+	//superscalar pipeline stages, the counterparts of pipelined_fetch() etc. for width > 1
+	void wide_fetch();
+	void wide_decode();
+	void wide_execute();
+	void wide_mem();
+	void wide_wb();
+
+	//an instruction of the group in decode can go on together with the older ones
+	//(slot of them already issued this cycle, mem_ops of those access memory)
+	bool wide_can_issue(const ID_EX &inst, int slot, int mem_ops);
+
+	//forwarding unit of the superscalar pipeline: value of register r for execute,
+	//from the youngest producer in EX/MEM, then MEM/WB, else the value read in decode
+	uint32_t wide_forward(int r, uint32_t value);
+
+	//load or store of a MEM slot, false if the pipeline has to hold
+	bool wide_mem_access(const EX_MEM &inst, uint32_t &read_data_mem);
+
+	void ooo_processor_advance();
+	void ooo_fetch();
+	void ooo_dispatch();
+	void ooo_issue();
+	void ooo_complete();
+	void ooo_commit();
+
+	//ROB entries from the head: position of index i, and the index of position n
+	int rob_age(int i){ return (i - rob_head + rob_size) % rob_size; }
+	int rob_index(int n){ return (rob_head + n) % rob_size; }
+
+	//ALU, branch condition and jal link of an issued instruction
+	void ooo_execute(rob_entry &e);
+
+	//address, disambiguation and cache access of an issued load or store, false if the
+	//load has to wait in the issue queue
+	bool ooo_execute_mem(int i);
+
+	//the ROB keeps its keep oldest instructions, the rest, their issue queue entries
+	//and the fetch queue go; fetch restarts at pc (the caller repairs the RAS)
+	void ooo_squash(int keep, uint32_t pc);
+
+	//empty window with the renaming tables reset, for initialize() and the size setters
+	void ooo_reset();
+
+	//the out-of-order part of restore()
+	bool restore_window(CheckpointReader &ckpt);
+
+	//-O2: load/store through the lockup-free caches, false if the stage has to hold
+	bool nonblocking_mem_access(control_t &ctrl, uint32_t &read_data_mem);
+
+	//-O2: register r is the destination of a load whose line has not arrived yet
+	bool reg_pending(int r){
+		if (!r || !((pending_regs >> r) & 1))
+			return false;
+		if (memory->pending(pending_addr[r]))
+			return true;
+		pending_regs &= ~(1u << r);
+		return false;
+	}
+
+	//the instruction in this ID/EX latch reads register r
+	bool reads_reg(const ID_EX &inst, int r){
+		return r && (inst.rs == r || ((!inst.control.ALU_src || inst.control.mem_write) && inst.rt == r));
+	}
+
 void detect_data_hazard(){
 	// Detect load/use hazard
-	if (prevState.decExe.control.reg_write && prevState.decExe.control.mem_read){
+	if (state.decExe.out().control.reg_write && state.decExe.out().control.mem_read){
 		// Check if any source register in the current instruction (in ID stage) 
 		// matches the destination register of the previous instruction (in EX stage)
-		int dest_reg_prev = prevState.decExe.control.reg_dest ? prevState.decExe.rd : prevState.decExe.rt;
+		int dest_reg_prev = state.decExe.out().control.reg_dest ? state.decExe.out().rd : state.decExe.out().rt;
 		
-		if (state.decExe.rs == dest_reg_prev || 
-			(!state.decExe.control.ALU_src && state.decExe.rt == dest_reg_prev)) {
+		if (state.decExe.in().rs == dest_reg_prev || 
+			(!state.decExe.in().control.ALU_src && state.decExe.in().rt == dest_reg_prev)) {
 			stall = true;
+			load_use_stalls++;
 			return;
 		}
 	}
@@ -118,15 +343,15 @@ void detect_data_hazard(){
 	void detect_data_hazard(){
 		
 		//detect load/use hazard
-		if (prevState.decExe.control.reg_write && prevState.decExe.control.mem_read){
+		if (state.decExe.out().control.reg_write && state.decExe.out().control.mem_read){
 			//For I-type instructions - check if source register in decode matches destination in execute
-		  	if (state.decExe.rs == prevState.decExe.rt){
+		  	if (state.decExe.in().rs == state.decExe.out().rt){
 				stall = true;
 				return;
 			}
 		  
 		  	//For R-type instructions - check both source registers
-		  	if (state.decExe.rt == prevState.decExe.rt){
+		  	if (state.decExe.in().rt == state.decExe.out().rt){
 				stall = true;
 				return;
 			}
@@ -135,140 +360,209 @@ void detect_data_hazard(){
 	}
 */
 	//possible forwarding unit inputs:
-	//prevState.exeDec.rd
-	//prevState.memWrite.write_reg
-	//prevState.decExe.rs
-	//prevState.decExe.rt
-	//prevState.exeMem.control.reg_write
-	//prevState.memWrite.control.regWrite
+	//state.exeMem.out().rd
+	//state.memWrite.out().write_reg
+	//state.decExe.out().rs
+	//state.decExe.out().rt
+	//state.exeMem.out().control.reg_write
+	//state.memWrite.out().control.regWrite
 
 	//forwarding notes:
-	//control signal regdest picks between prevState rd and rt, not tied to forwarding
+	//control signal regdest picks between the out() rd and rt, not tied to forwarding
 	//alu_src needs to pick between inputs in exe
 
 	int get_forwarding_a(){
-		if (!prevState.decExe.rs)
+		if (!state.decExe.out().rs)
 			return 0;  //use read_data_1
 
-		if (prevState.exeMem.control.reg_write){
+		if (state.exeMem.out().control.reg_write){
 				//Check instruction type in EX/MEM stage
-			bool is_rtype = (prevState.exeMem.control.ALU_op == 2 && prevState.exeMem.control.reg_dest);
+			bool is_rtype = (state.exeMem.out().control.ALU_op == 2 && state.exeMem.out().control.reg_dest);
 				
-			if (is_rtype){
+			if (state.exeMem.out().control.link){
+					//jal writes $31
+				if (state.decExe.out().rs == 31)
+					return 2;
+			}else if (is_rtype){
 					//For R-type, check rd matches rt
-				if (prevState.exeMem.rd == prevState.decExe.rs)
+				if (state.exeMem.out().rd == state.decExe.out().rs)
 					return 2;
 			}else{
 					//For I-type, check rt matches rt
-				if (prevState.exeMem.rt == prevState.decExe.rs)
+				if (state.exeMem.out().rt == state.decExe.out().rs)
 					return 2;
 			}
 		}
 		//Forward from MEM stage
 /*
-		if (prevState.exeMem.control.reg_write &&  //reg_write signal set
-			((prevState.exeMem.rt ==  prevState.decExe.rs) || //I type	
-			//prevState.exeMem.rd != 0 && 
-			(prevState.exeMem.rd == prevState.decExe.rs))){  //R type
+		if (state.exeMem.out().control.reg_write &&  //reg_write signal set
+			((state.exeMem.out().rt ==  state.decExe.out().rs) || //I type	
+			//state.exeMem.out().rd != 0 && 
+			(state.exeMem.out().rd == state.decExe.out().rs))){  //R type
 				return 2; //forward from mem
 		}*/ 
-		if (prevState.memWrite.control.reg_write &&
-			(prevState.memWrite.write_reg == prevState.decExe.rs))
+		if (state.memWrite.out().control.reg_write &&
+			(state.memWrite.out().write_reg == state.decExe.out().rs))
 				return 1;
 
 		return 0; //base case, no forwarding required
 	}
 
 	int get_forwarding_b(){
-		if (!prevState.decExe.rt) //rt changed to rd
+		if (!state.decExe.out().rt) //rt changed to rd
 			return 0; //use read_data_2
 
-		if (prevState.exeMem.control.reg_write){
+		if (state.exeMem.out().control.reg_write){
 				//Check instruction type in EX/MEM stage
-			bool is_rtype = (prevState.exeMem.control.ALU_op == 2 && prevState.exeMem.control.reg_dest);
+			bool is_rtype = (state.exeMem.out().control.ALU_op == 2 && state.exeMem.out().control.reg_dest);
 				
-			if (is_rtype){
+			if (state.exeMem.out().control.link){
+					//jal writes $31
+				if (state.decExe.out().rt == 31)
+					return 2;
+			}else if (is_rtype){
 					//For R-type, check rd matches rt
-				if (prevState.exeMem.rd == prevState.decExe.rt)
+				if (state.exeMem.out().rd == state.decExe.out().rt)
 					return 2;
 			}else{
 					//For I-type, check rt matches rt
-				if (prevState.exeMem.rt == prevState.decExe.rt)
+				if (state.exeMem.out().rt == state.decExe.out().rt)
 					return 2;
 			}
 		}
 
 		//Forward from WB stage
-		if (prevState.memWrite.control.reg_write &&
-			(prevState.memWrite.write_reg == prevState.decExe.rt))
+		if (state.memWrite.out().control.reg_write &&
+			(state.memWrite.out().write_reg == state.decExe.out().rt))
 				return 1;
 		return 0;
 	}
 
 	void detect_control_hazard(control_t control){
 
-		if (prevState.decExe.control.mem_read && prevState.exeMem.control.mem_write){  //detect read after write
+		//only full words can be forwarded, sb/sh merge into the word in memory and lbu/lhu mask it
+		bool partial = state.decExe.out().control.halfword || state.decExe.out().control.byte ||
+				state.exeMem.out().control.halfword || state.exeMem.out().control.byte;
+		if (state.decExe.out().control.mem_read && state.exeMem.out().control.mem_write && !partial){  //detect read after write
 			// Get the destination register of the load (could be rt for I-type)
-			if (prevState.exeMem.alu_result == state.exeMem.alu_result){
+			if (state.exeMem.out().alu_result == state.exeMem.in().alu_result){
 
 		
-				state.exeMem.alu_result = prevState.exeMem.write_data;
-				state.exeMem.control.mem_read = 0;
+				state.exeMem.in().alu_result = state.exeMem.out().write_data;
+				state.exeMem.in().control.mem_read = 0;
 			}
 		}
 
+		branch_record &br = state.exeMem.in().branch;
 		if (control.branch || control.bne){
 			//Explicit branch condition check
 			bool branch_taken = false;
 		
 			if (control.branch && !control.bne){
 				//BEQ (Branch if Equal)
-				branch_taken = (state.exeMem.alu_zero == 1);
+				branch_taken = (state.exeMem.in().alu_zero == 1);
 			} else if (control.bne){
 				//BNE (Branch if Not Equal)
-				branch_taken = (state.exeMem.alu_zero == 0);
+				branch_taken = (state.exeMem.in().alu_zero == 0);
 			}
 		
-			if (branch_taken){
-				//Clear fetch/decode and decode/execute pipeline registers
-				//PROBABLY DOESNT WORK, FIX
-				//clear_ifid_idex();	
-				clear_IF_ID();
-				clear_ID_EX();	
-				//processor_pc += state.exeMem.imm << 2; 
-				processor_pc = state.exeMem.pc + 4 + (state.exeMem.imm << 2); 
-				cout << "Detected branch, branching to " << processor_pc << "\n";
-
-				//regfile.pc -= 8; //account for pc increments in the past two cycles which will be flushed
-			}
+			br.taken = branch_taken;
+			br.target = state.exeMem.in().pc + 4 + (state.exeMem.in().imm << 2);
 		}
-/*
-		if (control.jump){
+
+		//fetch went the wrong way after this instruction: flush what it fetched since and
+		//redirect (jumps were already redirected in decode, anything but a taken branch
+		//goes on to pc+4)
+		uint32_t next_pc = br.taken ? br.target : state.exeMem.in().pc + 4;
+		if (state.exeMem.in().valid && !control.jump && next_pc != br.predicted_pc){
+			//Clear fetch/decode and decode/execute pipeline registers
 			clear_IF_ID();
-			clear_ID_EX();
-		
-			if (control.jump_reg){
-				//jr instruction - jump to register value
-				processor_pc = prevState.decExe.read_data_1;
-			} else{
-				//j/jal instruction - construct target address
-				//IMPORTANT: Use OR (|) not AND (&) to combine the high bits with address
-				processor_pc = (prevState.decExe.pc & 0xf0000000) | (prevState.decExe.addr << 2);
-			}
-		
-			//Debug the new PC value
-			DEBUG(cout << "JUMP TARGET: PC=0x" << hex << processor_pc << dec << endl);
-		}	
-*/
+			clear_ID_EX();	
+			processor_pc = next_pc;
+			bpu.recover(state.exeMem.in().pc, br);
+			branch_flushes++;
+			DEBUG(cout << "Mispredicted branch, redirecting to " << processor_pc << "\n");
+		}
 	}
 
 	public:
-		Processor(Memory *mem){ regfile.pc = 0; memory = mem;}
+		Processor(Memory *mem) : functional(&regfile, mem) { regfile.pc = 0; memory = mem;}
+		~Processor(){ delete jit; }
+		Processor(const Processor &) = delete;
+		Processor &operator=(const Processor &) = delete;
 
 		uint32_t getPC(){ return regfile.pc;}
 
+		//Execution starts at pc, for the loader
+		void set_entry(uint32_t pc){ regfile.pc = processor_pc = pc; }
+
+		//Instructions completed so far by advance()
+		uint64_t get_retired(){ return retired;}
+
 		//Prints the Register File
 		void printRegFile(){ regfile.print(); }
+
+		PhysReg *get_regs(){ return regfile.data(); }
+
+		Registers &get_regfile(){ return regfile; }
+
+		FunctionalCore &get_functional(){ return functional; }
+
+		//Switches to another level keeping only the architectural state:
+		//the pipeline starts empty, fetching from the current pc
+		void start_level(int level){
+			initialize(level);
+			processor_pc = regfile.pc;
+		}
+
+		//Like fast_forward(), but also feeds every fetch and data address to
+		//Memory::warm() so the caches are warm when detailed simulation starts
+		uint64_t warm_caches(uint64_t max_insts);
+
+		//Direction predictor of the pipelined core (see make_branch_predictor()), false
+		//for an unknown kind
+		bool set_branch_predictor(const std::string &kind){ return bpu.setPredictor(kind); }
+
+		void print_branch_stats(){ bpu.printStats(std::cout); }
+
+		//Pipeline, branch prediction and out-of-order window counters
+		void register_stats(StatsRegistry &stats);
+
+		//Reorder buffer and issue queue entries of the out-of-order core (1 to
+		//MAX_ROB_SIZE), false if either is out of range. Also empties the window.
+		bool set_window(int rob_entries, int iq_entries){
+			if (rob_entries < 1 || rob_entries > MAX_ROB_SIZE || iq_entries < 1 || iq_entries > MAX_ROB_SIZE)
+				return false;
+			rob_size = rob_entries;
+			iq_size = iq_entries;
+			ooo_reset();
+			return true;
+		}
+
+		int get_rob_size(){ return rob_size; }
+		int get_iq_size(){ return iq_size; }
+
+		void print_ooo_stats(std::ostream &out);
+
+		//Instructions fetched, issued and retired per cycle by the pipelined core (1, 2
+		//or 4; 1 is the scalar pipeline), false for another width. A group is fetched
+		//with one I-cache access from an aligned block of width words, issues in order
+		//up to the first instruction that depends on an older one in the group or
+		//would stall, with at most one load or store and a branch or jump last.
+		//The out-of-order core fetches, dispatches, issues and commits width per cycle.
+		bool set_width(int w){
+			if (w < 1 || w > MAX_WIDTH || (w & (w-1)))
+				return false;
+			width = w;
+			return true;
+		}
+
+		//Checkpointing: registers, latches, stall/penalty counters and control
+		void save(CheckpointWriter &ckpt);
+
+		//Restores a checkpoint taken at the same level, or only the architectural
+		//state of a -O0 checkpoint when continuing at another level
+		bool restore(CheckpointReader &ckpt, int level);
 		
 		//Initializes the processor appropriately based on the optimization level
 		void initialize(int opt_level);
@@ -276,6 +570,38 @@ void detect_data_hazard(){
 		//Advances the processor to an appropriate state every cycle
 		void advance(); 
 
+		//Call after advance(): if that cycle only waited on a cache miss and left every
+		//latch, register and the pc untouched, the next cycles would repeat it exactly.
+		//Skips as many of them as the caches allow and returns how many were skipped.
+		uint64_t skip_idle_cycles();
+
+		//Predecodes [text_base, end_pc] for the functional engine, call after the binary is loaded
+		void load_program(uint32_t text_base, uint32_t end_pc){
+			functional.load(text_base, end_pc);
+			if (jit)
+				jit->flush();
+		}
+
+		//Runs up to max_insts instructions on the functional engine (-O0 semantics),
+		//returns the number executed
+		uint64_t fast_forward(uint64_t max_insts){
+			return jit ? jit->run(max_insts) : functional.run(max_insts);
+		}
+
+		//Sends a commit record for every retired instruction to t (0 to stop)
+		void set_tracer(Tracer *t){ tracer = t; }
+
+		//Lets fast_forward() translate hot blocks to native code (maps the code buffer)
+		void enable_jit(){
+			if (!jit)
+				jit = new JIT(&functional, &regfile, memory);
+		}
+
+		void print_jit_stats(){
+			if (jit)
+				jit->printStats();
+		}
+
 		//Pipeline stages as functions, should be self explanatory
 
 		void pipelined_fetch();
@@ -292,22 +618,26 @@ void detect_data_hazard(){
 
 		
 		void clear_ID_EX(){
-			state.decExe.opcode = 0;
-			state.decExe.rs = 0;
-			state.decExe.rt = 0;
-			state.decExe.rd = 0;
-			state.decExe.shamt = 0;
-			state.decExe.funct = 0;
-			state.decExe.imm = 0;
-			state.decExe.addr = 0;
-			state.decExe.read_data_1 = 0;
-			state.decExe.read_data_2 = 0;
+			state.decExe.in().opcode = 0;
+			state.decExe.in().rs = 0;
+			state.decExe.in().rt = 0;
+			state.decExe.in().rd = 0;
+			state.decExe.in().shamt = 0;
+			state.decExe.in().funct = 0;
+			state.decExe.in().imm = 0;
+			state.decExe.in().addr = 0;
+			state.decExe.in().read_data_1 = 0;
+			state.decExe.in().read_data_2 = 0;
 			
-			state.decExe.pc = 0;	
-			state.decExe.control.reset();
+			state.decExe.in().pc = 0;	
+			state.decExe.in().valid = false;
+			state.decExe.in().branch = branch_record();
+			state.decExe.in().control.reset();
 		}
 	
 		void clear_IF_ID(){ 
-			state.fetchDecode.pc = 0;
-			state.fetchDecode.instruction = 0; }
+			state.fetchDecode.in().pc = 0;
+			state.fetchDecode.in().instruction = 0;
+			state.fetchDecode.in().valid = false;
+			state.fetchDecode.in().branch = branch_record(); }
 };
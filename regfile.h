@@ -3,6 +3,7 @@
 #include <vector>
 #include <cstdint>
 #include <iostream>
+#include "checkpoint.h"
 
 struct PhysReg {
     int32_t value;
@@ -13,6 +14,7 @@ class Registers {
 
     private:
         std::vector<PhysReg> R;
+        std::vector<PhysReg> phys;
         std::vector<int> regmap;
         std::vector<int> rename_pool;
     public:
@@ -39,10 +41,100 @@ class Registers {
             }
         }
 
+        // direct access to the register array, used by the functional engines
+        PhysReg *data() { return R.data(); }
+
         bool ready(int reg) {
             return R[reg].ready;
         }
 
+        // Register renaming for the out-of-order core (-O3 and up). R only takes
+        // committed values; n physical registers hold the results in flight, regmap
+        // points every architectural register at its newest one (-1: the value is in R)
+        // and rename_pool has the free ones.
+        void initRename(int n) {
+            phys.assign(n, PhysReg());
+            regmap.assign(32, -1);
+            rename_pool.clear();
+            for (int p = n-1; p >= 0; p--) {
+                rename_pool.push_back(p);
+            }
+        }
+
+        // Physical register now holding reg, -1 if R has its value
+        int mapping(int reg) {
+            return regmap[reg];
+        }
+
+        PhysReg &physReg(int p) {
+            return phys[p];
+        }
+
+        bool canRename() {
+            return !rename_pool.empty();
+        }
+
+        // A new physical register for the next value of reg, not ready yet
+        int rename(int reg) {
+            int p = rename_pool.back();
+            rename_pool.pop_back();
+            phys[p].ready = false;
+            regmap[reg] = p;
+            return p;
+        }
+
+        // The instruction that renamed reg to p retires: its value becomes architectural
+        void commit(int reg, int p) {
+            R[reg].value = phys[p].value;
+            if (regmap[reg] == p) {
+                regmap[reg] = -1;
+            }
+            rename_pool.push_back(p);
+        }
+
+        // A squashed instruction gives p back, remap() the survivors afterwards
+        void release(int p) {
+            rename_pool.push_back(p);
+        }
+
+        // Rebuild the map after a squash: clearMap(), then remap() what is still in
+        // flight from the oldest instruction on
+        void clearMap() {
+            regmap.assign(32, -1);
+        }
+        void remap(int reg, int p) {
+            regmap[reg] = p;
+        }
+
+        // Checkpointing: pc and the register array
+        void save(CheckpointWriter &ckpt) {
+            ckpt.put(&pc, sizeof(pc));
+            ckpt.put(R.data(), R.size()*sizeof(PhysReg));
+        }
+        bool restore(CheckpointReader &ckpt) {
+            return ckpt.get(&pc, sizeof(pc)) && ckpt.get(R.data(), R.size()*sizeof(PhysReg));
+        }
+
+        // The renaming state, after save()/restore() when the out-of-order core runs
+        void saveRename(CheckpointWriter &ckpt) {
+            uint32_t n = phys.size(), free = rename_pool.size();
+            ckpt.put(&n, sizeof(n));
+            ckpt.put(&free, sizeof(free));
+            ckpt.put(phys.data(), n*sizeof(PhysReg));
+            ckpt.put(regmap.data(), regmap.size()*sizeof(int));
+            ckpt.put(rename_pool.data(), free*sizeof(int));
+        }
+        bool restoreRename(CheckpointReader &ckpt) {
+            uint32_t n, free;
+            if (!ckpt.get(&n, sizeof(n)) || !ckpt.get(&free, sizeof(free)) || n != phys.size() || free > n) {
+                return false;
+            }
+            rename_pool.resize(free);
+            return ckpt.get(phys.data(), n*sizeof(PhysReg)) &&
+                   ckpt.get(regmap.data(), regmap.size()*sizeof(int)) &&
+                   ckpt.get(rename_pool.data(), free*sizeof(int));
+        }
+
         // Prints the contents of all the registers
         void print() {
             for(int i = 0; i < 32; ++i) {
@@ -0,0 +1,316 @@
+#include <iostream>
+#include <cmath>
+#include <cfloat>
+#include <random>
+#include <algorithm>
+#include <cstdint>
+#include "processor.h"
+#include "sampler.h"
+
+using namespace std;
+
+// Random projection coefficient in [-1, 1] of basic block pc onto dimension d
+static double projection(uint32_t pc, int d) {
+    uint64_t x = ((uint64_t)pc << 8 | d) + 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    x = x ^ (x >> 31);
+    return (double)(x >> 11) / (double)(1ull << 52) - 1.0;
+}
+
+static double distance2(const vector<double> &a, const vector<double> &b) {
+    double d = 0;
+    for (int i = 0; i < BBV_DIMS; i++)
+        d += (a[i] - b[i]) * (a[i] - b[i]);
+    return d;
+}
+
+// Functional run over the whole program collecting the basic block vectors
+void Sampler::profile() {
+    FunctionalCore &functional = processor->get_functional();
+    Registers &regfile = processor->get_regfile();
+    vector<uint64_t> count((end_pc - text_base)/4 + 1, 0);     // instructions run per block
+    vector<uint32_t> touched;
+    uint64_t in_interval = 0;
+
+    while (true) {
+        uint32_t pc = regfile.pc;
+        uint64_t done = 0;
+        if (functional.inText(pc)) {
+            uint64_t left = cfg.interval - in_interval;
+            done = functional.run(functional.block_length(pc, left < 0xffffffff ? left : 0xffffffff));
+            if (done) {
+                // blocks are keyed by their last instruction, so entering one in the
+                // middle (at the start of an interval) still counts as the same block
+                uint32_t last = pc + 4*(done - 1);
+                if (!count[(last - text_base)/4])
+                    touched.push_back(last);
+                count[(last - text_base)/4] += done;
+                in_interval += done;
+            }
+        }
+        if (in_interval == cfg.interval || (!done && in_interval)) {
+            vector<double> v(BBV_DIMS, 0.0);
+            for (size_t i = 0; i < touched.size(); i++) {
+                double f = (double)count[(touched[i] - text_base)/4] / in_interval;
+                for (int d = 0; d < BBV_DIMS; d++)
+                    v[d] += f * projection(touched[i], d);
+                count[(touched[i] - text_base)/4] = 0;
+            }
+            touched.clear();
+            bbv.push_back(v);
+            length.push_back(in_interval);
+            in_interval = 0;
+        }
+        if (!done)
+            break;
+    }
+}
+
+// k-means with k clusters, returns the sum of squared distances to the centroids
+double Sampler::kmeans(int k, vector<int> &assign, vector<vector<double> > &centroid) {
+    size_t n = bbv.size();
+    mt19937 rng(k);
+
+    // k-means++ seeding
+    centroid.assign(1, bbv[rng() % n]);
+    vector<double> best(n);
+    while ((int)centroid.size() < k) {
+        double total = 0;
+        for (size_t i = 0; i < n; i++) {
+            best[i] = DBL_MAX;
+            for (size_t c = 0; c < centroid.size(); c++)
+                best[i] = min(best[i], distance2(bbv[i], centroid[c]));
+            total += best[i];
+        }
+        size_t pick = rng() % n;
+        if (total > 0) {
+            double r = uniform_real_distribution<double>(0, total)(rng);
+            for (pick = 0; pick < n - 1 && r >= best[pick]; pick++)
+                r -= best[pick];
+        }
+        centroid.push_back(bbv[pick]);
+    }
+
+    assign.assign(n, -1);
+    double distortion = 0;
+    for (int iter = 0; iter < 100; iter++) {
+        bool changed = false;
+        distortion = 0;
+        for (size_t i = 0; i < n; i++) {
+            int c_best = 0;
+            double d_best = DBL_MAX;
+            for (int c = 0; c < k; c++) {
+                double d = distance2(bbv[i], centroid[c]);
+                if (d < d_best) {
+                    d_best = d;
+                    c_best = c;
+                }
+            }
+            if (assign[i] != c_best)
+                changed = true;
+            assign[i] = c_best;
+            distortion += d_best;
+        }
+        if (!changed)
+            break;
+        vector<int> members(k, 0);
+        for (int c = 0; c < k; c++)
+            centroid[c].assign(BBV_DIMS, 0.0);
+        for (size_t i = 0; i < n; i++) {
+            members[assign[i]]++;
+            for (int d = 0; d < BBV_DIMS; d++)
+                centroid[assign[i]][d] += bbv[i][d];
+        }
+        for (int c = 0; c < k; c++)
+            for (int d = 0; d < BBV_DIMS && members[c]; d++)
+                centroid[c][d] /= members[c];
+    }
+    return distortion;
+}
+
+// Bayesian information criterion of a clustering (Pelleg and Moore, as used by SimPoint)
+double Sampler::bic(int k, const vector<int> &assign, double distortion) {
+    double n = bbv.size();
+    double variance = n > k ? distortion / (n - k) : 0;
+    if (variance < 1e-12)
+        variance = 1e-12;
+    vector<int> members(k, 0);
+    for (size_t i = 0; i < assign.size(); i++)
+        members[assign[i]]++;
+
+    double likelihood = 0;
+    for (int c = 0; c < k; c++) {
+        double r = members[c];
+        if (!r)
+            continue;
+        likelihood += r * log(r) - r * log(n) - r / 2 * log(2 * M_PI)
+                    - r * BBV_DIMS / 2 * log(variance) - (r - k) / 2;
+    }
+    double params = (k - 1) + k * BBV_DIMS + 1;
+    return likelihood - params / 2 * log(n);
+}
+
+// Run interval i on the detailed core from the current functional state
+double Sampler::simulate(uint64_t i, int level) {
+    Registers saved_regs = processor->get_regfile();
+    mem_image saved_image;
+    memory->saveImage(saved_image);
+
+    memory->syncCaches();
+    memory->setOptLevel(level);
+    processor->start_level(level);
+
+    uint64_t start = processor->get_retired();
+    uint64_t cycles = 0;
+    uint64_t cap = length[i] * 1000 + 100000;
+    while (processor->get_retired() - start < length[i] && processor->getPC() <= end_pc && cycles < cap) {
+        processor->advance();
+        cycles++;
+        cycles += processor->skip_idle_cycles();
+    }
+    uint64_t retired = processor->get_retired() - start;
+    // the last interval ends with the program, so this also catches a detailed core leaving early
+    bool finished = retired == length[i];
+
+    // the caches stay warm, syncCaches() makes their data valid again before the next sample
+    memory->restoreImage(saved_image);
+    processor->get_regfile() = saved_regs;
+    processor->start_level(0);
+    processor->load_program(text_base, end_pc);
+
+    if (!finished)
+        return -1;
+    return (double)cycles / retired;
+}
+
+// Profile, cluster and simulate the samples at level (>= 1)
+bool Sampler::run(int level, uint64_t &est_cycles) {
+    Registers pristine_regs = processor->get_regfile();
+    Memory pristine_mem = *memory;
+
+    processor->load_program(text_base, end_pc);
+    profile();
+    size_t n = bbv.size();
+    if (!n) {
+        *out << "Sampling: the program ran no instructions\n";
+        return false;
+    }
+    uint64_t total = 0;
+    for (size_t i = 0; i < n; i++)
+        total += length[i];
+
+    // pick k by BIC: the smallest k scoring at least 90% of the best improvement
+    int max_k = min<size_t>(cfg.max_k, n);
+    vector<vector<int> > assigns(max_k + 1);
+    vector<double> scores(max_k + 1);
+    double lo = DBL_MAX, hi = -DBL_MAX;
+    for (int c = 1; c <= max_k; c++) {
+        vector<vector<double> > centroid;
+        double distortion = kmeans(c, assigns[c], centroid);
+        scores[c] = bic(c, assigns[c], distortion);
+        lo = min(lo, scores[c]);
+        hi = max(hi, scores[c]);
+    }
+    for (k = 1; k < max_k && scores[k] < lo + 0.9 * (hi - lo); k++)
+        ;
+    cluster = assigns[k];
+
+    // samples: the interval closest to each centroid plus one more random member
+    // so every cluster with more than one interval gets a variance estimate
+    vector<vector<double> > centroid(k, vector<double>(BBV_DIMS, 0.0));
+    vector<uint64_t> weight(k, 0);
+    vector<int> members(k, 0);
+    for (size_t i = 0; i < n; i++) {
+        members[cluster[i]]++;
+        weight[cluster[i]] += length[i];
+        for (int d = 0; d < BBV_DIMS; d++)
+            centroid[cluster[i]][d] += bbv[i][d];
+    }
+    vector<int> rep(k, -1);
+    for (int c = 0; c < k; c++)
+        for (int d = 0; d < BBV_DIMS && members[c]; d++)
+            centroid[c][d] /= members[c];
+    for (size_t i = 0; i < n; i++) {
+        int c = cluster[i];
+        if (rep[c] < 0 || distance2(bbv[i], centroid[c]) < distance2(bbv[rep[c]], centroid[c]))
+            rep[c] = i;
+    }
+    mt19937 rng(1);
+    vector<int> samples;
+    for (int c = 0; c < k; c++) {
+        if (rep[c] < 0)
+            continue;
+        samples.push_back(rep[c]);
+        if (members[c] > 1) {
+            int skip = rng() % (members[c] - 1);
+            for (size_t i = 0; i < n; i++) {
+                if (cluster[i] == c && (int)i != rep[c] && skip-- == 0) {
+                    samples.push_back(i);
+                    break;
+                }
+            }
+        }
+    }
+    sort(samples.begin(), samples.end());
+
+    // simulation pass: fast-forward, warm, simulate each sample in program order
+    *memory = pristine_mem;
+    processor->get_regfile() = pristine_regs;
+    processor->load_program(text_base, end_pc);
+    vector<vector<double> > cpi(k);
+    uint64_t pos = 0;
+    for (size_t s = 0; s < samples.size(); s++) {
+        uint64_t start = (uint64_t)samples[s] * cfg.interval;
+        uint64_t warm_start = start > pos + cfg.warmup ? start - cfg.warmup : pos;
+        pos += processor->fast_forward(warm_start - pos);
+        pos += processor->warm_caches(start - pos);
+        double c = simulate(samples[s], level);
+        if (c < 0) {
+            *out << "Sampling: interval " << samples[s] << " did not complete on the detailed core\n";
+            continue;
+        }
+        cpi[cluster[samples[s]]].push_back(c);
+    }
+    processor->fast_forward(UINT64_MAX);
+
+    // stratified estimate: per cluster mean CPI weighted by the cluster's share of instructions
+    double est = 0, var = 0, covered = 0;
+    for (int c = 0; c < k; c++) {
+        if (cpi[c].empty())
+            continue;
+        double w = (double)weight[c] / total;
+        double mean = 0;
+        for (size_t j = 0; j < cpi[c].size(); j++)
+            mean += cpi[c][j];
+        mean /= cpi[c].size();
+        double s2 = 0;
+        for (size_t j = 0; j < cpi[c].size(); j++)
+            s2 += (cpi[c][j] - mean) * (cpi[c][j] - mean);
+        if (cpi[c].size() > 1)
+            var += w * w * s2 / (cpi[c].size() - 1) / cpi[c].size();
+        est += w * mean;
+        covered += w;
+    }
+    if (covered == 0) {
+        *out << "Sampling: no sample completed\n";
+        return false;
+    }
+    // clusters without a completed sample are assumed to run at the average CPI
+    est /= covered;
+    double err = 1.96 * sqrt(var) / covered;
+    est_cycles = (uint64_t)(est * total + 0.5);
+
+    *out << "Sampled " << samples.size() << " of " << n << " intervals of " << cfg.interval
+         << " instructions (" << k << " clusters, " << total << " instructions)\n";
+    for (int c = 0; c < k; c++) {
+        *out << "  cluster " << c << ": " << members[c] << " intervals, weight "
+             << (double)weight[c] / total << ", CPI";
+        for (size_t j = 0; j < cpi[c].size(); j++)
+            *out << " " << cpi[c][j];
+        *out << "\n";
+    }
+    *out << "Estimated CPI " << est << " +/- " << err << " (95%)\n";
+    *out << "Estimated cycles " << est_cycles << " +/- " << (uint64_t)(err * total + 0.5) << "\n";
+    return true;
+}
@@ -0,0 +1,79 @@
+#ifndef SAMPLER_CLASS
+#define SAMPLER_CLASS
+#include <vector>
+#include <cstdint>
+#include <iostream>
+#include "memory.h"
+
+class Processor;
+
+#define BBV_DIMS 15                 // basic block vectors are projected down to this many dimensions
+
+// SimPoint-style sampled simulation.
+//
+// A profile pass runs the whole program on the functional engine and cuts it
+// into fixed-size intervals, recording a basic block vector (how often each
+// basic block ran, weighted by its length) per interval. The vectors are
+// clustered with k-means, choosing k by the BIC score. A simulation pass then
+// fast-forwards functionally to a few intervals of every cluster, warms the
+// caches over the instructions right before each one and runs it on the
+// detailed pipeline. The per cluster CPIs, weighted by cluster size, give the
+// estimated CPI of the whole run with a stratified sampling error bound.
+struct sampler_config {
+    uint64_t interval;              // instructions per interval
+    uint64_t warmup;                // instructions of cache warming before each sample
+    int max_k;                      // largest number of clusters tried
+};
+
+class Sampler {
+    private:
+        Processor *processor;
+        Memory *memory;
+        uint32_t text_base, end_pc;                 // the program, as for Processor::load_program()
+        sampler_config cfg;
+        std::ostream *out;                          // the report goes here
+
+        std::vector<std::vector<double> > bbv;      // one projected vector per interval
+        std::vector<uint64_t> length;               // instructions in each interval
+        std::vector<int> cluster;                   // cluster of each interval
+        int k;
+
+        // Functional run over the whole program collecting the basic block vectors
+        void profile();
+
+        // k-means with k clusters, returns the sum of squared distances to the centroids
+        double kmeans(int k, std::vector<int> &assign, std::vector<std::vector<double> > &centroid);
+
+        // Bayesian information criterion of a clustering
+        double bic(int k, const std::vector<int> &assign, double distortion);
+
+        // Run interval i on the detailed core from the current functional state,
+        // returns its CPI or a negative value if it did not finish. All state is
+        // put back the way it was, except that the caches keep their warm tags.
+        double simulate(uint64_t i, int level);
+    public:
+        Sampler(Processor *proc, Memory *mem, uint32_t base, uint32_t end, sampler_config config, std::ostream &report = std::cout) {
+            processor = proc;
+            memory = mem;
+            text_base = base;
+            end_pc = end;
+            cfg = config;
+            out = &report;
+            k = 0;
+        }
+
+        // Instructions in the whole run, known once run() has profiled it
+        uint64_t instructions() {
+            uint64_t total = 0;
+            for (size_t i = 0; i < length.size(); i++)
+                total += length[i];
+            return total;
+        }
+
+        // Profile, cluster and simulate the samples at level (>= 1). On return the
+        // functional engine has run the program to the end, est_cycles is the
+        // estimated number of cycles a full run at that level would take.
+        bool run(int level, uint64_t &est_cycles);
+};
+
+#endif
@@ -0,0 +1,118 @@
+#include <algorithm>
+#include <iomanip>
+#include "stackdist.h"
+
+using namespace std;
+
+StackDistance::StackDistance() {
+    tree.assign(1 << 16, 0);
+    now = 0;
+    accesses = 0;
+    set_stack.resize(STACK_MAX_SETS_LOG2 + 1);
+    set_hist.resize(STACK_MAX_SETS_LOG2 + 1);
+    for (int s = 0; s <= STACK_MAX_SETS_LOG2; s++) {
+        set_stack[s].assign((1 << s) * STACK_MAX_WAYS, UINT32_MAX);
+        set_hist[s].assign(STACK_MAX_WAYS + 1, 0);
+    }
+}
+
+// Renumber the live times 1..n so the tree has room again
+void StackDistance::compact() {
+    vector<pair<uint32_t, uint32_t> > live;
+    live.reserve(last.size());
+    for (unordered_map<uint32_t, uint32_t>::iterator it = last.begin(); it != last.end(); ++it)
+        live.push_back(make_pair(it->second, it->first));
+    sort(live.begin(), live.end());
+
+    size_t size = tree.size();
+    while (size < 2 * live.size() + 2)
+        size *= 2;
+    tree.assign(size, 0);
+    for (size_t i = 0; i < live.size(); i++) {
+        last[live[i].second] = i + 1;
+        add(i + 1, 1);
+    }
+    now = live.size();
+}
+
+void StackDistance::access(uint32_t line) {
+    accesses++;
+
+    // fully associative: live lines touched after this line's last access
+    if (now + 1 >= tree.size())
+        compact();
+    now++;
+    unordered_map<uint32_t, uint32_t>::iterator it = last.find(line);
+    if (it != last.end()) {
+        uint32_t distance = sum(now - 1) - sum(it->second);
+        if (distance >= hist.size())
+            hist.resize(distance + 1, 0);
+        hist[distance]++;
+        add(it->second, -1);
+        it->second = now;
+    } else {
+        last[line] = now;
+    }
+    add(now, 1);
+
+    // set-associative: position in this line's set, move it to the front
+    for (int s = 0; s <= STACK_MAX_SETS_LOG2; s++) {
+        uint32_t *set = &set_stack[s][(line & ((1 << s) - 1)) * STACK_MAX_WAYS];
+        int way = 0;
+        while (way < STACK_MAX_WAYS && set[way] != line)
+            way++;
+        set_hist[s][way]++;
+        for (int w = min(way, STACK_MAX_WAYS - 1); w > 0; w--)
+            set[w] = set[w - 1];
+        set[0] = line;
+    }
+}
+
+// Misses of a fully associative LRU cache holding this many lines
+uint64_t StackDistance::misses(uint64_t lines) {
+    uint64_t hits = 0;
+    for (size_t d = 0; d < hist.size() && d < lines; d++)
+        hits += hist[d];
+    return accesses - hits;
+}
+
+// Misses of an LRU cache with 2^sets_log2 sets of ways lines each
+uint64_t StackDistance::misses(int sets_log2, int ways) {
+    uint64_t hits = 0;
+    for (int d = 0; d < ways; d++)
+        hits += set_hist[sets_log2][d];
+    return accesses - hits;
+}
+
+// Miss ratio tables for all capacities and associativities
+void StackDistance::print(ostream &out, const char *stream) {
+    out << "\nLRU stack distance profile, " << stream << " stream: " << accesses << " accesses, "
+        << coldMisses() << " distinct " << CACHE_LINE_SIZE << "B lines\n";
+    if (!accesses)
+        return;
+
+    out << setw(10) << "capacity";
+    for (int ways = 1; ways <= STACK_MAX_WAYS; ways *= 2)
+        out << setw(9) << (to_string(ways) + "-way");
+    out << setw(9) << "full" << "\n";
+
+    out << fixed << setprecision(5);
+    for (uint64_t capacity = STACK_MIN_CAPACITY; capacity <= STACK_MAX_CAPACITY; capacity *= 2) {
+        uint64_t lines = capacity / CACHE_LINE_SIZE;
+        string label = capacity >= (1 << 20) ? to_string(capacity >> 20) + "MB" : to_string(capacity >> 10) + "KB";
+        out << setw(10) << label;
+        for (uint64_t ways = 1; ways <= STACK_MAX_WAYS; ways *= 2) {
+            uint64_t sets = lines / ways;
+            int sets_log2 = 0;
+            while ((1ull << sets_log2) < sets)
+                sets_log2++;
+            if (sets == 0 || sets_log2 > STACK_MAX_SETS_LOG2)
+                out << setw(9) << "-";
+            else
+                out << setw(9) << (double)misses(sets_log2, ways) / accesses;
+        }
+        out << setw(9) << (double)misses(lines) / accesses << "\n";
+    }
+    out.unsetf(ios::fixed);
+    out << setprecision(6);
+}
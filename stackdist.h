@@ -0,0 +1,92 @@
+#ifndef STACK_DISTANCE
+#define STACK_DISTANCE
+#include <vector>
+#include <cstdint>
+#include <iostream>
+#include <unordered_map>
+#include "memory.h"
+
+#define STACK_MAX_WAYS 32           // deepest per-set distance told apart, anything below misses in every modeled cache
+#define STACK_MAX_SETS_LOG2 14      // set-associative geometries are profiled up to this many sets
+#define STACK_MIN_CAPACITY 1024     // smallest and largest capacity in the report, bytes
+#define STACK_MAX_CAPACITY (16 << 20)
+
+// Mattson's LRU stack algorithm over cache line addresses. The distance of
+// an access is the number of distinct lines touched since the last access to
+// the same line; a fully associative LRU cache of C lines misses exactly on
+// the accesses with distance >= C, so one pass gives the miss ratio of every
+// capacity.
+//
+// The fully associative distances are counted with a Fenwick tree over access
+// times holding a 1 at each line's most recent access, so an access costs
+// O(log n). The time axis is compacted whenever it fills up.
+//
+// For set-associative caches the distance only counts lines of the same set.
+// Those are kept per set count (1 to 2^STACK_MAX_SETS_LOG2 sets) in small
+// per-set LRU stacks of STACK_MAX_WAYS entries, which is enough to tell apart
+// every associativity up to STACK_MAX_WAYS.
+class StackDistance {
+    private:
+        std::unordered_map<uint32_t, uint32_t> last;    // line -> time of its last access
+        std::vector<int32_t> tree;                      // Fenwick tree over times 1..tree.size()-1
+        uint32_t now;
+        std::vector<uint64_t> hist;                     // fully associative distance histogram
+        uint64_t accesses;
+
+        std::vector<std::vector<uint32_t> > set_stack;  // [sets_log2][set*STACK_MAX_WAYS + way], MRU first
+        std::vector<std::vector<uint64_t> > set_hist;   // [sets_log2][distance], STACK_MAX_WAYS for deeper or cold
+
+        void add(uint32_t t, int32_t v) {
+            for (; t < tree.size(); t += t & -t)
+                tree[t] += v;
+        }
+        int32_t sum(uint32_t t) {
+            int32_t s = 0;
+            for (; t; t -= t & -t)
+                s += tree[t];
+            return s;
+        }
+
+        // Renumber the live times 1..n so the tree has room again
+        void compact();
+    public:
+        StackDistance();
+
+        void access(uint32_t line);
+
+        uint64_t getAccesses() { return accesses; }
+
+        // Accesses to lines never seen before
+        uint64_t coldMisses() { return last.size(); }
+
+        // Misses of a fully associative LRU cache holding this many lines
+        uint64_t misses(uint64_t lines);
+
+        // Misses of an LRU cache with 2^sets_log2 sets of ways lines each
+        uint64_t misses(int sets_log2, int ways);
+
+        // Miss ratio tables for all capacities and associativities
+        void print(std::ostream &out, const char *stream);
+};
+
+// Address streams seen by Memory::access, split by kind
+class StackProfiler {
+    private:
+        StackDistance inst;
+        StackDistance data;
+        StackDistance unified;
+    public:
+        void record(uint32_t address, bool fetch) {
+            uint32_t line = address / CACHE_LINE_SIZE;
+            (fetch ? inst : data).access(line);
+            unified.access(line);
+        }
+
+        void print(std::ostream &out) {
+            inst.print(out, "instruction");
+            data.print(out, "data");
+            unified.print(out, "unified");
+        }
+};
+
+#endif
@@ -0,0 +1,95 @@
+#include <iostream>
+#include <cstring>
+#include "stats.h"
+
+using namespace std;
+
+bool parse_stats_format(const char *name, stats_format &fmt) {
+    if (!strcmp(name, "json"))
+        fmt = STATS_JSON;
+    else if (!strcmp(name, "csv"))
+        fmt = STATS_CSV;
+    else
+        return false;
+    return true;
+}
+
+int StatsRegistry::find(const string &name) {
+    for (size_t i = 0; i < counters.size(); i++) {
+        if (counters[i].name == name)
+            return i;
+    }
+    return -1;
+}
+
+void StatsRegistry::add(const string &name, function<uint64_t()> read) {
+    counter c = { name, read };
+    counters.push_back(c);
+}
+
+void StatsRegistry::addRatio(const string &name, const string &num, const string &den, double scale) {
+    ratio r = { name, find(num), find(den), scale };
+    if (r.num < 0 || r.den < 0) {
+        cout << "Stats: " << name << " needs the counters " << num << " and " << den << "\n";
+        return;
+    }
+    ratios.push_back(r);
+}
+
+bool StatsRegistry::open(const char *path, stats_format fmt) {
+    out = fopen(path, "w");
+    if (!out) {
+        cout << "Failed to open stats file: " << path << "\n";
+        return false;
+    }
+    format = fmt;
+    records = 0;
+    return true;
+}
+
+void StatsRegistry::write(const char *kind) {
+    if (!out)
+        return;
+    vector<uint64_t> values(counters.size());
+    for (size_t i = 0; i < counters.size(); i++)
+        values[i] = counters[i].read();
+
+    if (format == STATS_CSV) {
+        if (!records) {
+            fprintf(out, "record");
+            for (size_t i = 0; i < counters.size(); i++)
+                fprintf(out, ",%s", counters[i].name.c_str());
+            for (size_t i = 0; i < ratios.size(); i++)
+                fprintf(out, ",%s", ratios[i].name.c_str());
+            fprintf(out, "\n");
+        }
+        fprintf(out, "%s", kind);
+    } else {
+        fprintf(out, "%s  {\"record\": \"%s\"", records ? ",\n" : "[\n", kind);
+    }
+    for (size_t i = 0; i < counters.size(); i++) {
+        if (format == STATS_CSV)
+            fprintf(out, ",%llu", (unsigned long long)values[i]);
+        else
+            fprintf(out, ", \"%s\": %llu", counters[i].name.c_str(), (unsigned long long)values[i]);
+    }
+    for (size_t i = 0; i < ratios.size(); i++) {
+        const ratio &r = ratios[i];
+        double v = values[r.den] ? values[r.num] * r.scale / values[r.den] : 0.0;
+        if (format == STATS_CSV)
+            fprintf(out, ",%.6g", v);
+        else
+            fprintf(out, ", \"%s\": %.6g", r.name.c_str(), v);
+    }
+    fprintf(out, format == STATS_CSV ? "\n" : "}");
+    records++;
+}
+
+void StatsRegistry::close() {
+    if (!out)
+        return;
+    if (format == STATS_JSON)
+        fprintf(out, records ? "\n]\n" : "[]\n");
+    fclose(out);
+    out = 0;
+}
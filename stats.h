@@ -0,0 +1,62 @@
+#ifndef STATS_REGISTRY
+#define STATS_REGISTRY
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <functional>
+
+enum stats_format { STATS_JSON, STATS_CSV };
+
+// Named counters of a run, written to a file as JSON or CSV records: one every
+// --stats-interval cycles and a final one at exit. The components keep counting
+// in their own plain uint64_t members and register how to read them, so the
+// registry costs nothing until a record is written. Every record holds every
+// counter, cumulative since the start of the run, followed by the ratios
+// (IPC, MPKI) computed from them at that point.
+//
+// JSON: an array of objects, {"record": "interval", "cycles": 1000, ...}
+// CSV:  a header line, then one line per record, the record kind first
+class StatsRegistry {
+    private:
+        struct counter {
+            std::string name;
+            std::function<uint64_t()> read;
+        };
+        struct ratio {
+            std::string name;
+            int num, den;               // counter indexes
+            double scale;
+        };
+        std::vector<counter> counters;
+        std::vector<ratio> ratios;
+        FILE *out;
+        stats_format format;
+        uint64_t records;
+
+        int find(const std::string &name);
+    public:
+        StatsRegistry() { out = 0; format = STATS_JSON; records = 0; }
+        ~StatsRegistry() { close(); }
+
+        void add(const std::string &name, std::function<uint64_t()> read);
+        void add(const std::string &name, const uint64_t *value) {
+            add(name, [value] { return *value; });
+        }
+
+        // num * scale / den of two counters added before, 0 while den is 0
+        void addRatio(const std::string &name, const std::string &num, const std::string &den, double scale = 1);
+
+        bool open(const char *path, stats_format fmt);
+        bool enabled() { return out != 0; }
+
+        // Append a record of the current values, kind is "interval" or "final"
+        void write(const char *kind);
+
+        void close();
+};
+
+// "json" or "csv", false for anything else
+bool parse_stats_format(const char *name, stats_format &fmt);
+
+#endif
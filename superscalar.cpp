@@ -0,0 +1,343 @@
+#include <cstdint>
+#include <iostream>
+#include "processor.h"
+#include "control.h"
+using namespace std;
+
+#ifdef ENABLE_DEBUG
+#define DEBUG(x) x
+#else
+#define DEBUG(x)
+#endif
+
+//In-order superscalar version of the -O1/-O2 pipeline: the same five stages, each
+//holding a group of up to width instructions (see set_width()). Groups move down
+//the pipeline together; an instruction that can't issue with its group stays in
+//IF/ID with everything behind it and fetch waits until IF/ID has drained.
+
+//register an instruction with these control signals and fields writes, 0 for none
+static int dest_reg(const control_t &ctrl, int rd, int rt){
+	return ctrl.reg_write ? (ctrl.link ? 31 : ctrl.reg_dest ? rd : rt) : 0;
+}
+
+void Processor::wide_fetch(){
+	IF_ID *fetched = wide.fetchDecode.in();
+	for (int i = 0; i < MAX_WIDTH; i++)
+		fetched[i] = IF_ID();
+
+	//the rest of the aligned group processor_pc is in, one I-cache access for all of it
+	uint32_t words[MAX_WIDTH];
+	int n = width - (processor_pc / 4) % width;
+	cycle_accesses++;
+	if (!memory->fetchGroup(processor_pc, words, n)){
+		cycle_missed = true;
+		miss_address = processor_pc;
+		miss_fetch = true;
+		return;
+	}
+	cycle_fetch_hit = true;
+
+	//a predicted taken branch or jump ends the group
+	for (int i = 0; i < n; i++){
+		IF_ID &f = fetched[i];
+		f.instruction = words[i];
+		f.pc = processor_pc;
+		f.valid = true;
+		processor_pc = bpu.predict(processor_pc, f.branch);
+		if (processor_pc != f.pc + 4)
+			break;
+	}
+}
+
+bool Processor::wide_can_issue(const ID_EX &inst, int slot, int mem_ops){
+	const control_t &ctrl = inst.control;
+
+	//one load/store unit
+	if ((ctrl.mem_read || ctrl.mem_write) && mem_ops)
+		return false;
+
+	//an older instruction of the same group computes one of the operands: no forwarding
+	//within a group, it goes with the next one
+	const ID_EX *group = wide.decExe.in();
+	for (int j = 0; j < slot; j++){
+		const ID_EX &older = group[j];
+		if (reads_reg(inst, dest_reg(older.control, older.rd, older.rt)))
+			return false;
+	}
+
+	const ID_EX *in_ex = wide.decExe.out();
+	const EX_MEM *in_mem = wide.exeMem.out();
+	for (int k = 0; k < width; k++){
+		//load/use: a load in EX has its data at the end of MEM, one cycle late for us
+		const ID_EX &ex = in_ex[k];
+		if (ex.valid && ex.control.mem_read && reads_reg(inst, dest_reg(ex.control, ex.rd, ex.rt))){
+			load_use_stalls++;
+			return false;
+		}
+		//jr reads rs here, it waits until the value can be forwarded from WB
+		const EX_MEM &mem = in_mem[k];
+		if (ctrl.jump_reg && ((ex.valid && writes_reg(ex.control, ex.rd, ex.rt, inst.rs)) ||
+				(mem.valid && writes_reg(mem.control, mem.rd, mem.rt, inst.rs))))
+			return false;
+	}
+
+	//-O2: a load that missed in L1 holds back its users until the line arrives
+	if (opt_level >= 2 && (reg_pending(inst.rs) || (reads_reg(inst, inst.rt) && reg_pending(inst.rt))))
+		return false;
+	return true;
+}
+
+void Processor::wide_decode(){
+	const IF_ID *fetched = wide.fetchDecode.out();
+	ID_EX *decoded = wide.decExe.in();
+	const MEM_WB *in_wb = wide.memWrite.out();
+	for (int i = 0; i < MAX_WIDTH; i++)
+		decoded[i] = ID_EX();
+
+	int n = 0;
+	int mem_ops = 0;
+	bool redirected = false;
+	for (; n < width && fetched[n].valid; n++){
+		const IF_ID &f = fetched[n];
+		ID_EX &d = decoded[n];
+		uint32_t instruction = f.instruction;
+
+		d.control.decode(instruction);
+		d.rs = (instruction >> 21) & 0x1f;
+		d.rt = (instruction >> 16) & 0x1f;
+		d.rd = (instruction >> 11) & 0x1f;
+		if (!wide_can_issue(d, n, mem_ops)){
+			d = ID_EX();
+			break;
+		}
+
+		d.opcode = (instruction >> 26) & 0x3f;
+		d.shamt = (instruction >> 6) & 0x1f;
+		d.funct = instruction & 0x3f;
+		d.imm = instruction & 0xffff;
+		d.addr = instruction & 0x3ffffff;
+
+		//the group in WB writes its registers this cycle, forward them (the youngest last)
+		regfile.access(d.rs, d.rt, d.read_data_1, d.read_data_2, 0, 0, 0);
+		for (int k = 0; k < width; k++){
+			const MEM_WB &wb = in_wb[k];
+			if (!wb.valid || !wb.control.reg_write || !wb.write_reg)
+				continue;
+			if (wb.write_reg == d.rs)
+				d.read_data_1 = wb.write_data;
+			if (wb.write_reg == d.rt)
+				d.read_data_2 = wb.write_data;
+		}
+
+		d.pc = f.pc;
+		d.valid = true;
+		d.branch = f.branch;
+		mem_ops += d.control.mem_read || d.control.mem_write;
+
+		//jumps are resolved here like in pipelined_decode(), a wrong guess only loses IF/ID
+		branch_record &br = d.branch;
+		if (d.control.branch || d.control.bne)
+			br.kind = BR_COND;
+		if (d.control.jump){
+			br.kind = d.control.jump_reg ? (d.rs == 31 ? BR_RETURN : BR_INDIRECT) : d.control.link ? BR_CALL : BR_JUMP;
+			br.taken = true;
+			br.target = d.control.jump_reg ? d.read_data_1 : ((d.pc + 4) & 0xf0000000) | (d.addr << 2);
+			if (br.target != br.predicted_pc){
+				for (int i = 0; i < MAX_WIDTH; i++)
+					wide.fetchDecode.in()[i] = IF_ID();
+				processor_pc = br.target;
+				bpu.recover(d.pc, br);
+				branch_flushes++;
+				redirected = true;
+				DEBUG(cout << "Jump redirects fetch to 0x" << hex << processor_pc << dec << "\n");
+			}
+		}
+		//a branch or jump is the last of its group, a misprediction flushes all behind it
+		if (d.control.branch || d.control.bne || d.control.jump){
+			n++;
+			break;
+		}
+	}
+
+	//what did not issue moves to the front of IF/ID and this cycle's fetch is redone later
+	if (!redirected && n < width && fetched[n].valid){
+		IF_ID *waiting = wide.fetchDecode.in();
+		for (int i = 0; i < MAX_WIDTH; i++)
+			waiting[i] = i + n < MAX_WIDTH ? fetched[i + n] : IF_ID();
+		refetch();
+	}
+}
+
+uint32_t Processor::wide_forward(int r, uint32_t value){
+	if (!r)
+		return value;
+	//within a group the later slot is the younger instruction
+	const EX_MEM *in_mem = wide.exeMem.out();
+	const MEM_WB *in_wb = wide.memWrite.out();
+	for (int k = width-1; k >= 0; k--){
+		const EX_MEM &mem = in_mem[k];
+		if (mem.valid && writes_reg(mem.control, mem.rd, mem.rt, r))
+			return mem.alu_result;
+	}
+	for (int k = width-1; k >= 0; k--){
+		const MEM_WB &wb = in_wb[k];
+		if (wb.valid && wb.control.reg_write && wb.write_reg == r)
+			return wb.write_data;
+	}
+	return value;
+}
+
+void Processor::wide_execute(){
+	const ID_EX *decoded = wide.decExe.out();
+	EX_MEM *executed = wide.exeMem.in();
+	for (int i = 0; i < MAX_WIDTH; i++)
+		executed[i] = EX_MEM();
+
+	for (int k = 0; k < width; k++){
+		const ID_EX &d = decoded[k];
+		if (!d.valid)
+			continue;
+		const control_t &ctrl = d.control;
+		EX_MEM &e = executed[k];
+		e.control = ctrl;
+
+		uint32_t imm = d.imm;
+		e.imm = imm = ctrl.zero_extend ? imm : (imm >> 15) ? 0xffff0000 | imm : imm;
+
+		uint32_t operand_1 = ctrl.shift ? d.shamt : wide_forward(d.rs, d.read_data_1);
+		uint32_t operand_2 = wide_forward(d.rt, d.read_data_2);
+		e.write_data = operand_2;
+		if (ctrl.ALU_src)
+			operand_2 = imm;
+
+		uint32_t alu_zero = 0;
+		e.alu_result = alu.execute(ctrl.ALU_operation, operand_1, operand_2, alu_zero);
+		//jal writes its return address to $31
+		if (ctrl.link)
+			e.alu_result = d.pc + 8;
+
+		e.rd = d.rd;
+		e.rt = d.rt;
+		e.alu_zero = alu_zero;
+		e.pc = d.pc;
+		e.valid = true;
+		e.branch = d.branch;
+
+		branch_record &br = e.branch;
+		if (ctrl.branch || ctrl.bne){
+			br.taken = ctrl.bne ? alu_zero == 0 : alu_zero == 1;
+			br.target = d.pc + 4 + (imm << 2);
+		}
+
+		//fetch went the wrong way after this instruction, the last of its group: flush
+		//the younger groups in IF/ID and ID/EX and redirect
+		uint32_t next_pc = br.taken ? br.target : d.pc + 4;
+		if (!ctrl.jump && next_pc != br.predicted_pc){
+			for (int i = 0; i < MAX_WIDTH; i++){
+				wide.fetchDecode.in()[i] = IF_ID();
+				wide.decExe.in()[i] = ID_EX();
+			}
+			processor_pc = next_pc;
+			bpu.recover(d.pc, br);
+			branch_flushes++;
+			DEBUG(cout << "Mispredicted branch, redirecting to " << processor_pc << "\n");
+		}
+	}
+}
+
+bool Processor::wide_mem_access(const EX_MEM &inst, uint32_t &read_data_mem){
+	const control_t &ctrl = inst.control;
+	if (!ctrl.mem_read && !ctrl.mem_write)
+		return true;
+
+	//-O1 stall-on-miss is a -O2 access that always finds the MSHRs busy
+	uint32_t address = inst.alu_result;
+	mem_status status = MEM_HIT;
+	//sb and sh first read the word they merge into
+	if (ctrl.mem_read || ctrl.halfword || ctrl.byte){
+		status = opt_level >= 2 ? memory->accessNonBlocking(address, read_data_mem, 0, 1, 0, false, inst.pc) :
+			stage_access(address, read_data_mem, 0, 1, 0, false, inst.pc) ? MEM_HIT : MEM_BLOCKED;
+	}
+	if (status != MEM_BLOCKED && ctrl.mem_write){
+		uint32_t write_data_mem = ctrl.halfword ? (read_data_mem & 0xffff0000) | (inst.write_data & 0xffff) :
+						ctrl.byte ? (read_data_mem & 0xffffff00) | (inst.write_data & 0xff) :
+						inst.write_data;
+		mem_status write = opt_level >= 2 ? memory->accessNonBlocking(address, read_data_mem, write_data_mem, 0, 1, false, inst.pc) :
+			stage_access(address, read_data_mem, write_data_mem, 0, 1, false, inst.pc) ? MEM_HIT : MEM_BLOCKED;
+		if (write != MEM_HIT)
+			status = write;
+	}
+	if (status == MEM_BLOCKED){
+		//hold MEM and everything behind it
+		wide.hold();
+		refetch();
+		mem_stalled = true;
+		return false;
+	}
+	if (status == MEM_MISS && ctrl.mem_read){
+		int dest = dest_reg(ctrl, inst.rd, inst.rt);
+		pending_regs |= 1u << dest;
+		pending_addr[dest] = address;
+		//the group decoded this cycle already read the register, send it back
+		for (int k = 0; k < width; k++){
+			if (wide.decExe.in()[k].valid && reads_reg(wide.decExe.in()[k], dest)){
+				wide.fetchDecode.hold();
+				for (int i = 0; i < MAX_WIDTH; i++)
+					wide.decExe.in()[i] = ID_EX();
+				refetch();
+				break;
+			}
+		}
+	}
+	return true;
+}
+
+void Processor::wide_mem(){
+	const EX_MEM *executed = wide.exeMem.out();
+	MEM_WB *done = wide.memWrite.in();
+	for (int i = 0; i < MAX_WIDTH; i++)
+		done[i] = MEM_WB();
+
+	for (int k = 0; k < width; k++){
+		const EX_MEM &e = executed[k];
+		if (!e.valid)
+			continue;
+		const control_t &ctrl = e.control;
+		uint32_t read_data_mem = 0;
+		if (!wide_mem_access(e, read_data_mem))
+			return;
+		//Loads: lbu or lhu modify read data by masking
+		read_data_mem &= ctrl.halfword ? 0xffff : ctrl.byte ? 0xff : 0xffffffff;
+
+		MEM_WB &m = done[k];
+		m.control = ctrl;
+		m.write_reg = ctrl.link ? 31 : ctrl.reg_dest ? e.rd : e.rt;
+		m.write_data = ctrl.mem_read ? read_data_mem : e.alu_result;
+		m.imm = e.imm;
+		m.alu_zero = e.alu_zero;
+		m.pc = e.pc;
+		m.valid = true;
+		m.branch = e.branch;
+	}
+}
+
+void Processor::wide_wb(){
+	const MEM_WB *written = wide.memWrite.out();
+	uint32_t pc = 0;
+	for (int k = 0; k < width; k++){
+		const MEM_WB &m = written[k];
+		if (!m.valid)
+			continue;
+		uint32_t unused = 0;
+		regfile.access(0, 0, unused, unused, m.write_reg, m.control.reg_write, m.write_data);
+		if (!wb_repeat){
+			retired++;
+			if (tracer)
+				tracer->commit(m.pc, m.control.reg_write ? m.write_reg : -1, m.write_data);
+			if (m.control.branch || m.control.bne || m.control.jump)
+				bpu.resolve(m.pc, m.branch);
+		}
+		pc = m.pc;
+	}
+	regfile.pc = pc;
+}
@@ -0,0 +1,153 @@
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+#include <chrono>
+#include "trace.h"
+
+using namespace std;
+
+// Little endian field writers
+static uint8_t *put8(uint8_t *p, uint8_t v) { *p = v; return p + 1; }
+static uint8_t *put32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = v >> (8*i);
+    return p + 4;
+}
+static uint8_t *put64(uint8_t *p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = v >> (8*i);
+    return p + 8;
+}
+
+Tracer::Tracer() : head(0), tail(0), stopping(false) {
+    level = TRACE_NONE;
+    cycle = 0;
+    write_error = 0;
+    file = 0;
+    gz = 0;
+    memset(last_regs, 0, sizeof(last_regs));
+}
+
+// Start tracing to path, returns false if the file can't be opened
+bool Tracer::open(const char *path, trace_level lvl, bool compress) {
+    if (lvl == TRACE_NONE)
+        return true;
+    if (compress) {
+        gz = gzopen(path, "wb1");
+    } else {
+        file = fopen(path, "wb");
+    }
+    if (!file && !gz) {
+        cout << "Failed to open trace file: " << path << "\n";
+        return false;
+    }
+
+    ring.resize(TRACE_RING_SIZE);
+    head = tail = 0;
+    stopping = false;
+    write_error = 0;
+    level = lvl;
+
+    uint8_t hdr[6];
+    memcpy(hdr, TRACE_MAGIC, 4);
+    hdr[4] = TRACE_VERSION;
+    hdr[5] = level;
+    push(hdr, sizeof(hdr));
+
+    writer = std::thread(&Tracer::drain, this);
+    return true;
+}
+
+// Flush everything and stop the writer thread, reports a trace that could not be written
+void Tracer::close() {
+    if (level == TRACE_NONE)
+        return;
+    stopping.store(true, std::memory_order_release);
+    writer.join();
+    errno = 0;
+    if (gz && gzclose(gz) != Z_OK && !write_error)
+        write_error = errno ? errno : EIO;
+    if (file && fclose(file) && !write_error)
+        write_error = errno;
+    if (write_error)
+        cout << "Failed to write the trace file: " << strerror(write_error) << ", it is incomplete\n";
+    gz = 0;
+    file = 0;
+    level = TRACE_NONE;
+}
+
+// Copy a record into the ring, waits for the writer if it is full
+void Tracer::push(const uint8_t *data, uint32_t n) {
+    uint64_t h = head.load(std::memory_order_relaxed);
+    while (TRACE_RING_SIZE - (h - tail.load(std::memory_order_acquire)) < n)
+        std::this_thread::yield();
+
+    uint32_t at = h & (TRACE_RING_SIZE-1);
+    uint32_t first = n < TRACE_RING_SIZE - at ? n : TRACE_RING_SIZE - at;
+    memcpy(&ring[at], data, first);
+    memcpy(&ring[0], data + first, n - first);
+    head.store(h + n, std::memory_order_release);
+}
+
+// Writer thread body
+void Tracer::drain() {
+    uint64_t t = tail.load(std::memory_order_relaxed);
+    while (true) {
+        uint64_t h = head.load(std::memory_order_acquire);
+        if (h == t) {
+            if (stopping.load(std::memory_order_acquire) && head.load(std::memory_order_acquire) == t)
+                break;
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            continue;
+        }
+        uint32_t at = t & (TRACE_RING_SIZE-1);
+        uint32_t n = h - t < TRACE_RING_SIZE - at ? h - t : TRACE_RING_SIZE - at;
+        // after a failed write the rest is dropped, the simulation must not block on a full ring
+        if (!write_error) {
+            errno = 0;
+            if (gz ? gzwrite(gz, &ring[at], n) != (int)n : fwrite(&ring[at], 1, n, file) != n)
+                write_error = errno ? errno : EIO;
+        }
+        t += n;
+        tail.store(t, std::memory_order_release);
+    }
+}
+
+// An instruction retired, reg < 0 if it wrote no register
+void Tracer::commit(uint32_t pc, int reg, uint32_t value) {
+    uint8_t rec[18];
+    uint8_t *p = put8(rec, TRACE_REC_COMMIT);
+    p = put64(p, cycle);
+    p = put32(p, pc);
+    p = put8(p, reg < 0 ? 0xff : reg);
+    p = put32(p, value);
+    push(rec, p - rec);
+}
+
+// End of a cycle: emits the register deltas or the full state
+void Tracer::endCycle(uint32_t pc, const PhysReg *regs) {
+    uint8_t rec[1 + 8 + 4 + 32*5];
+    uint8_t *p;
+    if (level == TRACE_FULL) {
+        p = put8(rec, TRACE_REC_FULL);
+        p = put64(p, cycle);
+        p = put32(p, pc);
+        for (int i = 0; i < 32; i++)
+            p = put32(p, regs[i].value);
+        push(rec, p - rec);
+    } else if (level == TRACE_DELTA) {
+        p = put8(rec, TRACE_REC_DELTA);
+        p = put64(p, cycle);
+        uint8_t *count = p++;
+        *count = 0;
+        for (int i = 0; i < 32; i++) {
+            if (regs[i].value != last_regs[i]) {
+                p = put8(p, i);
+                p = put32(p, regs[i].value);
+                last_regs[i] = regs[i].value;
+                (*count)++;
+            }
+        }
+        if (*count)
+            push(rec, p - rec);
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef TRACE_CLASS
+#define TRACE_CLASS
+#include <cstdint>
+#include <cstdio>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <zlib.h>
+#include "regfile.h"
+
+#define TRACE_MAGIC "MTRC"
+#define TRACE_VERSION 1
+#define TRACE_RING_SIZE (1 << 22)   // bytes, power of two
+
+// What ends up in the trace, each level includes the ones before it
+// (full state replaces the register deltas)
+enum trace_level { TRACE_NONE, TRACE_COMMIT, TRACE_DELTA, TRACE_FULL };
+
+// Record types. All fields are little endian and unpadded:
+//   TRACE_REC_COMMIT: type u8, cycle u64, pc u32, reg u8 (0xff if none), value u32
+//   TRACE_REC_DELTA:  type u8, cycle u64, count u8, count x (reg u8, value u32)
+//   TRACE_REC_FULL:   type u8, cycle u64, pc u32, 32 x value u32
+// The file starts with TRACE_MAGIC, version u8 and level u8.
+enum trace_record { TRACE_REC_COMMIT = 1, TRACE_REC_DELTA = 2, TRACE_REC_FULL = 3 };
+
+// Binary trace sink. The simulator thread appends records to a single
+// producer/single consumer lock-free ring, and a writer thread drains it to
+// a plain or gzip compressed file. Decode the result with tracedump.
+class Tracer {
+    private:
+        trace_level level;
+        uint64_t cycle;
+        int32_t last_regs[32];          // register file at the last delta record
+
+        std::vector<uint8_t> ring;
+        std::atomic<uint64_t> head;     // bytes produced
+        std::atomic<uint64_t> tail;     // bytes consumed
+        std::atomic<bool> stopping;
+        int write_error;                // errno of the first failed write, 0 if none (writer thread)
+        std::thread writer;
+
+        FILE *file;
+        gzFile gz;
+
+        // Copy a record into the ring, waits for the writer if it is full
+        void push(const uint8_t *data, uint32_t n);
+
+        // Writer thread body
+        void drain();
+    public:
+        Tracer();
+        ~Tracer() { close(); }
+
+        // Start tracing to path, returns false if the file can't be opened
+        bool open(const char *path, trace_level lvl, bool compress);
+
+        // Flush everything and stop the writer thread, reports a trace that could not be written
+        void close();
+
+        bool enabled() { return level != TRACE_NONE; }
+
+        // Cycle number stamped on the records that follow
+        void setCycle(uint64_t c) { cycle = c; }
+
+        // An instruction retired, reg < 0 if it wrote no register
+        void commit(uint32_t pc, int reg, uint32_t value);
+
+        // End of a cycle: emits the register deltas or the full state
+        void endCycle(uint32_t pc, const PhysReg *regs);
+};
+
+#endif
@@ -0,0 +1,80 @@
+#include <iostream>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <zlib.h>
+#include "trace.h"
+
+using namespace std;
+
+// Turns a binary trace written with --trace back into text.
+// Reads plain and gzip compressed traces alike.
+
+static gzFile in;
+
+static bool get(uint8_t *buf, int n) {
+    return gzread(in, buf, n) == n;
+}
+static uint32_t get32(const uint8_t *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+static uint64_t get64(const uint8_t *p) {
+    return get32(p) | (uint64_t)get32(p + 4) << 32;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        cout << "Usage: tracedump <trace-file>\n";
+        return 1;
+    }
+    in = gzopen(argv[1], "rb");
+    if (!in) {
+        cout << "Failed to open trace file: " << argv[1] << "\n";
+        return 1;
+    }
+
+    uint8_t hdr[6];
+    if (!get(hdr, sizeof(hdr)) || memcmp(hdr, TRACE_MAGIC, 4) || hdr[4] != TRACE_VERSION) {
+        cout << "Not a trace file (or unsupported version): " << argv[1] << "\n";
+        return 1;
+    }
+    static const char *levels[] = { "none", "commit", "delta", "full" };
+    cout << "TRACE level=" << (hdr[5] < 4 ? levels[hdr[5]] : "?") << "\n";
+
+    uint8_t type;
+    uint8_t buf[32*5];
+    while (get(&type, 1)) {
+        if (!get(buf, 8))
+            break;
+        uint64_t cycle = get64(buf);
+        if (type == TRACE_REC_COMMIT) {
+            if (!get(buf, 9))
+                break;
+            cout << "CYCLE " << cycle << " COMMIT pc=0x" << hex << get32(buf) << dec;
+            if (buf[4] != 0xff)
+                cout << " R[" << (int)buf[4] << "] <- " << (int32_t)get32(buf + 5);
+            cout << "\n";
+        } else if (type == TRACE_REC_DELTA) {
+            uint8_t count;
+            if (!get(&count, 1) || !get(buf, count*5))
+                break;
+            cout << "CYCLE " << cycle;
+            for (int i = 0; i < count; i++)
+                cout << " R[" << (int)buf[i*5] << "]: " << (int32_t)get32(buf + i*5 + 1);
+            cout << "\n";
+        } else if (type == TRACE_REC_FULL) {
+            if (!get(buf, 4))
+                break;
+            cout << "\nCYCLE " << cycle << " pc=0x" << hex << get32(buf) << dec << "\n";
+            if (!get(buf, 32*4))
+                break;
+            for (int i = 0; i < 32; i++)
+                cout << "R[" << i << "]: " << (int32_t)get32(buf + i*4) << "\n";
+        } else {
+            cout << "Corrupt record type " << (int)type << "\n";
+            return 1;
+        }
+    }
+    gzclose(in);
+    return 0;
+}